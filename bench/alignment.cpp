@@ -0,0 +1,91 @@
+#include "bench.h"
+#include "synthetic.h"
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+
+using namespace YiCppLib::HTSLibpp;
+
+static void scan(benchmark::State& state, const std::string& filename) {
+    bench::throughput t(state);
+    for(auto _ : state) {
+        auto fp = htsOpen(filename, "r");
+        auto hdr = htsHeader<bamHeader>::read(fp);
+        for(auto& r : htsReader<bamRecord>::range(fp, hdr)) t.records++;
+        t.bytes += bench::fileSize(filename);
+    }
+    t.report();
+}
+
+static void BamSequentialScan(benchmark::State& state) { scan(state, bench::bamFile); }
+BENCHMARK(BamSequentialScan)->Unit(benchmark::kMillisecond);
+
+static void BamSyntheticScan(benchmark::State& state) { scan(state, bench::syntheticBam(state.range(0))); }
+BENCHMARK(BamSyntheticScan)->Arg(1000000)->Unit(benchmark::kMillisecond);
+
+static void BamBatchScan(benchmark::State& state) {
+    bench::throughput t(state);
+    htsBatch<bamRecord> batch(256);
+    for(auto _ : state) {
+        auto fp = htsOpen(bench::bamFile, "r");
+        auto hdr = htsHeader<bamHeader>::read(fp);
+        while(batch.fill(fp, hdr) > 0) t.records += batch.size();
+        t.bytes += bench::fileSize(bench::bamFile);
+    }
+    t.report();
+}
+BENCHMARK(BamBatchScan)->Unit(benchmark::kMillisecond);
+
+// the file, header and index are opened once, the region is queried over
+// and over, which is what a region lookup service does
+static void BamRegion(benchmark::State& state) {
+    bench::throughput t(state);
+    auto fp = htsOpen(bench::bamFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    auto idx = htsIndexOpen(bench::bamFile, bench::bamFile + ".bai");
+    for(auto _ : state) {
+        for(auto& r : htsReader<bamRecord>::range(fp, hdr, idx, bench::brca2Region)) {
+            t.records++;
+            t.bytes += r->l_data;
+        }
+    }
+    t.report();
+}
+BENCHMARK(BamRegion)->Unit(benchmark::kMillisecond);
+
+static void BamProxyFields(benchmark::State& state) {
+    bench::throughput t(state);
+    auto fp = htsOpen(bench::bamFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    auto idx = htsIndexOpen(bench::bamFile, bench::bamFile + ".bai");
+    for(auto _ : state) {
+        int64_t checksum = 0;
+        for(auto& r : htsReader<bamRecord>::range(fp, hdr, idx, bench::brca2Region)) {
+            auto proxy = htsProxy(r);
+            checksum += proxy.pos() + proxy.qual() + proxy.flag() + proxy.queryName().size() + proxy.cigar().size();
+            for(auto q : proxy.baseQualities()) checksum += q;
+            for(auto b : proxy.sequence()) checksum += b;
+            t.records++;
+            t.bytes += r->l_data;
+        }
+        benchmark::DoNotOptimize(checksum);
+    }
+    t.report();
+}
+BENCHMARK(BamProxyFields)->Unit(benchmark::kMillisecond);
+
+static void BamHeaderLines(benchmark::State& state) {
+    bench::throughput t(state);
+    auto fp = htsOpen(bench::bamFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    for(auto _ : state) {
+        size_t length = 0;
+        std::for_each(htsHeader<bamHeader>::cbegin_l(hdr), htsHeader<bamHeader>::cend_l(hdr), [&](const auto& line) {
+            length += line.size();
+            t.records++;
+        });
+        t.bytes += length;
+        benchmark::DoNotOptimize(length);
+    }
+    t.report();
+}
+BENCHMARK(BamHeaderLines);
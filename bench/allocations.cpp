@@ -0,0 +1,34 @@
+// Counts heap allocations by interposing the glibc allocator. The
+// interposed functions forward to the __libc_ entry points, so they are
+// safe to call from htslib, libstdc++ and the benchmark library alike.
+
+#include "bench.h"
+#include <atomic>
+#include <stdlib.h>
+
+static std::atomic<size_t> allocationCount{0};
+
+#ifdef __GLIBC__
+extern "C" {
+    void * __libc_malloc(size_t size);
+    void * __libc_calloc(size_t n, size_t size);
+    void * __libc_realloc(void * ptr, size_t size);
+
+    void * malloc(size_t size) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_malloc(size);
+    }
+
+    void * calloc(size_t n, size_t size) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_calloc(n, size);
+    }
+
+    void * realloc(void * ptr, size_t size) {
+        allocationCount.fetch_add(1, std::memory_order_relaxed);
+        return __libc_realloc(ptr, size);
+    }
+}
+#endif
+
+size_t bench::allocations() { return allocationCount.load(std::memory_order_relaxed); }
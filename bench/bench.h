@@ -0,0 +1,54 @@
+// Shared helpers of the benchmark suite
+//
+// Every benchmark reports three counters
+//   * records/s,     records visited per second
+//   * bytes/s,       input bytes per second. Whole file scans count the
+//                    size of the file on disk, region and field benchmarks
+//                    count the decoded size of the records they visit
+//   * allocs/record, heap allocations per record, counted by interposing
+//                    malloc (glibc only, 0 elsewhere)
+
+#include <benchmark/benchmark.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <string>
+#ifndef YICPPLIB_HTSLIBPP_BENCH
+#define YICPPLIB_HTSLIBPP_BENCH
+
+namespace bench {
+    const std::string datasets = "../test/datasets/";
+    const std::string bamFile = datasets + "brca2.na12878.bam";
+    const std::string exacFile = datasets + "brca2.exac.vcf";
+    const std::string trioFile = datasets + "brca2.platnium-trio.vcf";
+    const std::string brca2Region = "13:32900000-32950000";
+
+    // number of heap allocations made by the process so far
+    size_t allocations();
+
+    inline int64_t fileSize(const std::string& filename) {
+        struct stat st;
+        return stat(filename.c_str(), &st) == 0 ? st.st_size : 0;
+    }
+
+    // accumulates what a benchmark visited and turns it into counters
+    class throughput {
+        protected:
+            benchmark::State& m_state;
+            size_t m_allocations;
+
+        public:
+            int64_t records = 0;
+            int64_t bytes = 0;
+
+            throughput(benchmark::State& state): m_state(state), m_allocations(allocations()) {}
+
+            void report() {
+                auto allocs = allocations() - m_allocations;
+                m_state.SetBytesProcessed(bytes);
+                m_state.counters["records/s"] = benchmark::Counter(records, benchmark::Counter::kIsRate);
+                m_state.counters["allocs/record"] = benchmark::Counter(records > 0 ? static_cast<double>(allocs) / records : 0.0);
+            }
+    };
+}
+
+#endif
@@ -0,0 +1,59 @@
+// End-to-end benchmarks, which time a whole request the way a service
+// would serve it rather than a single wrapper call
+
+#include "bench.h"
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_cache.h"
+#include "../htslibpp_pileup.h"
+
+using namespace YiCppLib::HTSLibpp;
+
+// every request opens the file, reads the header and loads the index
+static void RegionDepthCold(benchmark::State& state) {
+    bench::throughput t(state);
+    for(auto _ : state) {
+        auto fp = htsOpen(bench::bamFile, "r");
+        auto hdr = htsHeader<bamHeader>::read(fp);
+        auto idx = htsIndexOpen(bench::bamFile, bench::bamFile + ".bai");
+        auto depth = htsPileup::depth(fp, hdr, idx, htsHeader<bamHeader>::region(hdr, bench::brca2Region));
+        t.records += depth.size();
+        t.bytes += depth.size() * sizeof(uint32_t);
+        benchmark::DoNotOptimize(depth.data());
+    }
+    t.report();
+}
+BENCHMARK(RegionDepthCold)->Unit(benchmark::kMillisecond);
+
+// the same request served from htsCache
+static void RegionDepthCached(benchmark::State& state) {
+    bench::throughput t(state);
+    htsCache cache;
+    for(auto _ : state) {
+        auto l = cache.acquire<bamHeader>(bench::bamFile);
+        auto depth = htsPileup::depth(l.file(), l.header(), l.index(), htsHeader<bamHeader>::region(l.header(), bench::brca2Region));
+        t.records += depth.size();
+        t.bytes += depth.size() * sizeof(uint32_t);
+        benchmark::DoNotOptimize(depth.data());
+    }
+    t.report();
+}
+BENCHMARK(RegionDepthCached)->Unit(benchmark::kMillisecond);
+
+// many small lookups, each counting the reads of a 1kb window
+static void SmallRegionLookups(benchmark::State& state) {
+    bench::throughput t(state);
+    htsCache cache;
+    int window = 0;
+    for(auto _ : state) {
+        auto l = cache.acquire<bamHeader>(bench::bamFile);
+        auto beg = 32900000 + (window++ % 50) * 1000;
+        auto region = "13:" + std::to_string(beg) + "-" + std::to_string(beg + 1000);
+        for(auto& r : htsReader<bamRecord>::range(l.file(), l.query(region))) {
+            t.records++;
+            t.bytes += r->l_data;
+        }
+    }
+    t.report();
+}
+BENCHMARK(SmallRegionLookups)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,3 @@
+#include "bench.h"
+
+BENCHMARK_MAIN();
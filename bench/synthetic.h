@@ -0,0 +1,117 @@
+// Synthetic inputs for the benchmark suite
+//
+// The test datasets are small enough to stay in the page cache and in the
+// CPU caches, which flatters every benchmark. The generators below write
+// larger, deterministic inputs to $TMPDIR. Each input is named after its
+// parameters and only generated once, so later runs reuse it. An input is
+// written under a name private to the process first, and renamed into
+// place once it is complete, so that concurrent runs never read a partial
+// input or write over each other's.
+
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <random>
+#include <string>
+#ifndef YICPPLIB_HTSLIBPP_BENCH_SYNTHETIC
+#define YICPPLIB_HTSLIBPP_BENCH_SYNTHETIC
+
+namespace bench {
+    inline std::string scratchFile(const std::string& name) {
+        return YiCppLib::HTSLibpp::htsTempDir() + "/htslibpp-bench-" + name;
+    }
+
+    inline std::string partialFile(const std::string& file) {
+        return file + "." + std::to_string(getpid()) + ".partial";
+    }
+
+    inline std::string randomBases(std::mt19937& rng, int length) {
+        static const char bases[] = "ACGT";
+        std::string seq(length, 'N');
+        for(auto& b : seq) b = bases[rng() & 3];
+        return seq;
+    }
+
+    // nRecords coordinate sorted reads of readLength bases on a single
+    // contig, about one in ten carrying a deletion, as an indexed BAM
+    inline std::string syntheticBam(size_t nRecords, int readLength = 150) {
+        using namespace YiCppLib::HTSLibpp;
+
+        auto bam = scratchFile("reads-" + std::to_string(nRecords) + "x" + std::to_string(readLength) + ".bam");
+        if(access((bam + ".bai").c_str(), R_OK) == 0) return bam;
+
+        std::mt19937 rng(nRecords);
+        int64_t contigLength = nRecords * 4 + readLength * 2;
+
+        auto sam = partialFile(bam + ".sam");
+        auto partial = partialFile(bam);
+        {
+            std::ofstream out(sam);
+            out << "@HD\tVN:1.4\tSO:coordinate\n";
+            out << "@SQ\tSN:chr1\tLN:" << contigLength << "\n";
+
+            int64_t pos = 1;
+            std::string qual(readLength, 'I');
+            for(size_t i = 0; i < nRecords; i++) {
+                pos += rng() % 8;
+                std::string cigar = std::to_string(readLength) + "M";
+                if(rng() % 10 == 0) cigar = std::to_string(readLength / 2) + "M2D" + std::to_string(readLength - readLength / 2) + "M";
+
+                out << "r" << i << "\t" << (rng() % 2 ? 16 : 0) << "\tchr1\t" << pos << "\t60\t" << cigar
+                    << "\t*\t0\t0\t" << randomBases(rng, readLength) << "\t" << qual << "\n";
+            }
+        }
+
+        {
+            auto in = htsOpen(sam, "r");
+            auto hdr = htsHeader<bamHeader>::read(in);
+            auto out = htsWriter<bamRecord>::open(partial);
+            htsWriter<bamRecord>::writeHeader(out, hdr);
+            for(auto& r : htsReader<bamRecord>::range(in, hdr)) htsWriter<bamRecord>::write(out, hdr, r);
+        }
+        unlink(sam.c_str());
+        htsWriter<bamRecord>::buildIndex(partial, partial + ".bai");
+
+        // the index marks the input as complete, so it goes last
+        rename(partial.c_str(), bam.c_str());
+        rename((partial + ".bai").c_str(), (bam + ".bai").c_str());
+        return bam;
+    }
+
+    // nSites biallelic SNVs with DP and GT for nSamples samples, as VCF text
+    inline std::string syntheticVcf(size_t nSites, size_t nSamples = 64) {
+        auto vcf = scratchFile("sites-" + std::to_string(nSites) + "x" + std::to_string(nSamples) + ".vcf");
+        if(access(vcf.c_str(), R_OK) == 0) return vcf;
+
+        std::mt19937 rng(nSites);
+        static const char * genotypes[] = { "0/0", "0/0", "0/0", "0/1", "0/1", "1/1", "./." };
+        static const char bases[] = "ACGT";
+
+        auto partial = partialFile(vcf);
+        std::ofstream out(partial);
+        out << "##fileformat=VCFv4.2\n";
+        out << "##contig=<ID=chr1,length=" << nSites * 10 + 100 << ">\n";
+        out << "##INFO=<ID=DP,Number=1,Type=Integer,Description=\"Total depth\">\n";
+        out << "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n";
+        out << "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Sample depth\">\n";
+        out << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT";
+        for(size_t s = 0; s < nSamples; s++) out << "\tS" << s;
+        out << "\n";
+
+        for(size_t i = 0; i < nSites; i++) {
+            auto ref = rng() & 3;
+            out << "chr1\t" << i * 10 + 1 << "\t.\t" << bases[ref] << "\t" << bases[(ref + 1 + rng() % 3) & 3]
+                << "\t" << rng() % 1000 << "\tPASS\tDP=" << rng() % 5000 << "\tGT:DP";
+            for(size_t s = 0; s < nSamples; s++) out << "\t" << genotypes[rng() % 7] << ":" << rng() % 80;
+            out << "\n";
+        }
+        out.close();
+        rename(partial.c_str(), vcf.c_str());
+        return vcf;
+    }
+}
+
+#endif
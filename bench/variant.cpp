@@ -0,0 +1,69 @@
+#include "bench.h"
+#include "synthetic.h"
+#include "../htslibpp.h"
+#include "../htslibpp_variant.h"
+
+using namespace YiCppLib::HTSLibpp;
+
+static void scan(benchmark::State& state, const std::string& filename, int unpack) {
+    bench::throughput t(state);
+    for(auto _ : state) {
+        auto fp = htsOpen(filename, "r");
+        auto hdr = htsHeader<bcfHeader>::read(fp);
+        for(auto& v : htsReader<bcfRecord>::range(fp, hdr)) {
+            if(unpack) bcf_unpack(v.get(), unpack);
+            t.records++;
+        }
+        t.bytes += bench::fileSize(filename);
+    }
+    t.report();
+}
+
+static void BcfScan(benchmark::State& state) { scan(state, bench::exacFile, 0); }
+BENCHMARK(BcfScan)->Unit(benchmark::kMillisecond);
+
+static void BcfScanUnpackAll(benchmark::State& state) { scan(state, bench::exacFile, BCF_UN_ALL); }
+BENCHMARK(BcfScanUnpackAll)->Unit(benchmark::kMillisecond);
+
+static void BcfSyntheticScan(benchmark::State& state) { scan(state, bench::syntheticVcf(state.range(0)), BCF_UN_ALL); }
+BENCHMARK(BcfSyntheticScan)->Arg(100000)->Unit(benchmark::kMillisecond);
+
+static void BcfProxyFields(benchmark::State& state) {
+    bench::throughput t(state);
+    for(auto _ : state) {
+        auto fp = htsOpen(bench::trioFile, "r");
+        auto hdr = htsHeader<bcfHeader>::read(fp);
+        auto dp = htsHeader<bcfHeader>::tagID(hdr, "DP");
+        auto gt = htsHeader<bcfHeader>::tagID(hdr, "GT");
+        int64_t checksum = 0;
+        for(auto& v : htsReader<bcfRecord>::range(fp, hdr)) {
+            auto proxy = htsProxy(v);
+            checksum += proxy.pos() + proxy.ref().size() + proxy.filters().size();
+            for(auto d : proxy.infoInt(dp)) checksum += d;
+            for(auto g : proxy.formatInt(gt)) checksum += g;
+            t.records++;
+        }
+        t.bytes += bench::fileSize(bench::trioFile);
+        benchmark::DoNotOptimize(checksum);
+    }
+    t.report();
+}
+BENCHMARK(BcfProxyFields)->Unit(benchmark::kMillisecond);
+
+static void BcfHeaderDictionary(benchmark::State& state) {
+    bench::throughput t(state);
+    auto fp = htsOpen(bench::exacFile, "r");
+    auto hdr = htsHeader<bcfHeader>::read(fp);
+    auto dict = htsHeader<bcfHeader>::DictType::ID;
+    for(auto _ : state) {
+        size_t length = 0;
+        std::for_each(htsHeader<bcfHeader>::dictBegin(hdr, dict), htsHeader<bcfHeader>::dictEnd(hdr, dict), [&](const auto& p) {
+            if(p.key != nullptr) length += strlen(p.key);
+            t.records++;
+        });
+        t.bytes += length;
+        benchmark::DoNotOptimize(length);
+    }
+    t.report();
+}
+BENCHMARK(BcfHeaderDictionary);
@@ -1,12 +1,53 @@
 #include <memory>
 #include <string>
+#include <ostream>
+#include <string.h>
 #include <functional>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <htslib/hts.h>
+#include <htslib/hfile.h>
 #include <htslib/vcf.h>
+#include <htslib/thread_pool.h>
+#include <errno.h>
+#ifdef HTSLIBPP_INSTRUMENT
+#include <htslib/bgzf.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#endif
 
 #ifndef YICPPLIB_HTSLIBPP_HTSLIBPP
 #define YICPPLIB_HTSLIBPP_HTSLIBPP
 
+// The hFILE backend interface is not part of htslib's installed headers,
+// but hfile_init and hfile_destroy are exported by libhts in every release
+// since 1.3, and the backend table has kept this layout. See
+// hfile_internal.h in the htslib sources.
+#ifndef HFILE_INTERNAL_H
+extern "C" {
+    struct hFILE_backend {
+        ssize_t (*read)(hFILE * fp, void * buffer, size_t nbytes);
+        ssize_t (*write)(hFILE * fp, const void * buffer, size_t nbytes);
+        off_t (*seek)(hFILE * fp, off_t offset, int whence);
+        int (*flush)(hFILE * fp);
+        int (*close)(hFILE * fp);
+    };
+
+    hFILE * hfile_init(size_t struct_size, const char * mode, size_t capacity);
+    void hfile_destroy(hFILE * fp);
+}
+#endif
+
 template<class T> class TD;     // A crude instrument to check compiler deduced type
 
 namespace YiCppLib {
@@ -46,15 +87,76 @@ namespace YiCppLib {
             static _ptr_array_iterator end(T * head, SIZE_T& size)   { return _ptr_array_iterator{head, size, size}; }
     };
 
+    // A non-owning view over a contiguous c-style array, for handing out
+    // pieces of htslib owned memory without copying them.
+    template<class T> struct htsSpan {
+        protected:
+            T * m_data;
+            size_t m_size;
+
+        public:
+            htsSpan(): m_data(nullptr), m_size(0) {}
+            htsSpan(T * data, size_t size): m_data(data), m_size(size) {}
+
+            T * data() const    { return m_data; }
+            size_t size() const { return m_size; }
+            bool empty() const  { return m_size == 0; }
+
+            T * begin() const { return m_data; }
+            T * end() const   { return m_data + m_size; }
+
+            T& operator[](size_t i) const { return m_data[i]; }
+    };
+
+    // A non-owning view over a run of characters that is not necessarily
+    // null terminated. Converting it to a std::string is the only thing
+    // that allocates.
+    struct htsStringView : htsSpan<const char> {
+        htsStringView(): htsSpan<const char>() {}
+        htsStringView(const char * data, size_t size): htsSpan<const char>(data, size) {}
+
+        std::string str() const { return std::string(m_data, m_size); }
+        operator std::string() const { return str(); }
+
+        bool operator==(const htsStringView& rhs) const { return m_size == rhs.m_size && (m_size == 0 || memcmp(m_data, rhs.m_data, m_size) == 0); }
+        bool operator!=(const htsStringView& rhs) const { return !(*this == rhs); }
+        bool operator==(const char * rhs) const { return *this == htsStringView(rhs, strlen(rhs)); }
+        bool operator!=(const char * rhs) const { return !(*this == rhs); }
+        bool operator==(const std::string& rhs) const { return *this == htsStringView(rhs.data(), rhs.size()); }
+        bool operator!=(const std::string& rhs) const { return !(*this == rhs); }
+    };
+
+    inline std::ostream& operator<<(std::ostream& os, const htsStringView& view) { return os.write(view.data(), view.size()); }
+
     namespace HTSLibpp {
         // undefined generic htsHeader struct placeholder. Specific header types
         // will implement template specifications.
         template<class T> struct htsHeader;
 
+        // undefined generic htsHeaderIndex struct placeholder. Specific header
+        // types will implement template specifications.
+        template<class T> struct htsHeaderIndex;
+
         // undefined generic htsReader struct placeholder. Specific reader types
         // will implement template specifications.
         template<class T> struct htsReader;
 
+        // undefined generic htsBatch struct placeholder. Specific record
+        // types will implement template specifications.
+        template<class T> struct htsBatch;
+
+        // undefined generic htsWriter struct placeholder. Specific record
+        // types will implement template specifications.
+        template<class T> struct htsWriter;
+
+        // undefined generic htsRecordPool struct placeholder. Specific record
+        // types will implement template specifications.
+        template<class T> struct htsRecordPool;
+
+        // undefined generic htsParallel struct placeholder. Specific record
+        // types will implement template specifications.
+        template<class T> struct htsParallel;
+
         
         // proxy base templates
 
@@ -67,6 +169,51 @@ namespace YiCppLib {
          */
         template<class T>
         inline auto htsProxy(const T& actual) { return HTSProxy<decltype(actual)>(actual); }
+
+        // field projections
+
+        /* A projection names the fields of a record that a job looks at,
+         * as a list of tags, e.g. htsFields<htsField::Core, htsField::Cigar>.
+         * Readers skip decoding other fields where the format allows it,
+         * and hand out an HTSProjection: a proxy with only the accessors of
+         * the projected fields, so that using any other fails to compile.
+         */
+        namespace htsField {
+            // the fixed fields of a record: position, and the flags and
+            // mapping quality of an alignment
+            struct Core {};
+
+            // alignments
+            struct Mate {};
+            struct Name {};
+            struct Cigar {};
+            struct Seq {};
+            struct Qual {};
+            struct Aux {};
+            struct MD {};
+
+            // variants
+            struct Alleles {};
+            struct Filter {};
+            struct Info {};
+            struct Format {};
+        }
+
+        template<class F, class... Fs> struct htsFieldIn : std::false_type {};
+        template<class F, class G, class... Fs> struct htsFieldIn<F, G, Fs...> :
+            std::conditional<std::is_same<F, G>::value, std::true_type, htsFieldIn<F, Fs...>>::type {};
+
+        template<class... Fs> struct htsFields {
+            template<class F> static constexpr bool has() { return htsFieldIn<F, Fs...>::value; }
+        };
+
+        /* The uninstanciated holder struct of projected proxies, and the
+         * function that makes them, e.g. htsProject<FieldsT>(rec)
+         */
+        template<class T, class FieldsT> struct HTSProjection;
+
+        template<class FieldsT, class T>
+        inline auto htsProject(const T& actual) { return HTSProjection<decltype(actual), FieldsT>(actual); }
     }
 
 }
@@ -76,24 +223,601 @@ namespace YiCppLib {
 namespace YiCppLib {
     namespace HTSLibpp {
 
+        // Instrumentation
+        //
+        // Building with -DHTSLIBPP_INSTRUMENT turns on a set of counters for
+        // every open file, kept up to date by the read functions of the
+        // htsReader and htsBatch specializations, and therefore by every
+        // iterator and range built on top of them
+        //   * records,   records read
+        //   * bytesIn,   compressed bytes consumed, BGZF files only
+        //   * bytesOut,  decoded bytes of the records handed out
+        //   * blocks,    BGZF blocks entered
+        //   * seeks,     jumps to another index chunk or backwards
+        //   * readNanos, time spent inside sam_read1, bcf_read and friends
+        //
+        // The counters of a file are folded into a per-filename total when
+        // it is closed. Without the flag the probes are empty inline
+        // functions and the snapshots are empty.
+        struct htsStats {
+            std::string filename;
+            uint64_t records = 0;
+            uint64_t bytesIn = 0;
+            uint64_t bytesOut = 0;
+            uint64_t blocks = 0;
+            uint64_t seeks = 0;
+            uint64_t readNanos = 0;
+
+            htsStats& operator+=(const htsStats& other) {
+                records += other.records;
+                bytesIn += other.bytesIn;
+                bytesOut += other.bytesOut;
+                blocks += other.blocks;
+                seeks += other.seeks;
+                readNanos += other.readNanos;
+                return *this;
+            }
+        };
+
+#ifdef HTSLIBPP_INSTRUMENT
+        class htsInstrumentation {
+            public:
+                struct counters {
+                    std::string filename;
+                    std::atomic<uint64_t> records{0};
+                    std::atomic<uint64_t> bytesIn{0};
+                    std::atomic<uint64_t> bytesOut{0};
+                    std::atomic<uint64_t> blocks{0};
+                    std::atomic<uint64_t> seeks{0};
+                    std::atomic<uint64_t> readNanos{0};
+
+                    htsStats load() const {
+                        htsStats s;
+                        s.filename = filename;
+                        s.records = records.load(std::memory_order_relaxed);
+                        s.bytesIn = bytesIn.load(std::memory_order_relaxed);
+                        s.bytesOut = bytesOut.load(std::memory_order_relaxed);
+                        s.blocks = blocks.load(std::memory_order_relaxed);
+                        s.seeks = seeks.load(std::memory_order_relaxed);
+                        s.readNanos = readNanos.load(std::memory_order_relaxed);
+                        return s;
+                    }
+                };
+
+            protected:
+                struct registry {
+                    std::mutex lock;
+                    std::unordered_map<const ::htsFile *, std::unique_ptr<counters>> open;
+                    std::unordered_map<std::string, htsStats> closed;
+
+                    // bumped whenever a file is closed, which invalidates the
+                    // per-thread lookup caches
+                    std::atomic<uint64_t> generation{0};
+                };
+
+                static registry& instance() {
+                    static registry r;
+                    return r;
+                }
+
+            public:
+                // the counters of a file, created on first use. the last
+                // lookup of every thread is cached, so a read loop only takes
+                // the lock on its first record
+                static counters * find(const ::htsFile * fp) {
+                    struct cached { const ::htsFile * fp; counters * c; uint64_t generation; };
+                    static thread_local cached last{nullptr, nullptr, 0};
+
+                    auto& r = instance();
+                    auto generation = r.generation.load(std::memory_order_acquire);
+                    if(last.fp == fp && last.generation == generation) return last.c;
+
+                    std::lock_guard<std::mutex> guard(r.lock);
+                    auto& c = r.open[fp];
+                    if(!c) {
+                        c.reset(new counters);
+                        c->filename = fp->fn != nullptr ? fp->fn : "";
+                    }
+                    last = cached{fp, c.get(), generation};
+                    return c.get();
+                }
+
+                static void release(const ::htsFile * fp) {
+                    auto& r = instance();
+                    std::lock_guard<std::mutex> guard(r.lock);
+                    auto found = r.open.find(fp);
+                    if(found == r.open.end()) return;
+
+                    auto stats = found->second->load();
+                    auto& total = r.closed[stats.filename];
+                    total.filename = stats.filename;
+                    total += stats;
+                    r.open.erase(found);
+                    r.generation.fetch_add(1, std::memory_order_release);
+                }
+
+                static htsStats of(const ::htsFile * fp) {
+                    auto& r = instance();
+                    std::lock_guard<std::mutex> guard(r.lock);
+                    auto found = r.open.find(fp);
+                    return found != r.open.end() ? found->second->load() : htsStats{};
+                }
+
+                // totals per filename, over open and closed files
+                static std::vector<htsStats> snapshot() {
+                    auto& r = instance();
+                    std::lock_guard<std::mutex> guard(r.lock);
+
+                    auto totals = r.closed;
+                    for(const auto& f : r.open) {
+                        auto stats = f.second->load();
+                        auto& total = totals[stats.filename];
+                        total.filename = stats.filename;
+                        total += stats;
+                    }
+
+                    std::vector<htsStats> result;
+                    for(auto& t : totals) result.push_back(std::move(t.second));
+                    std::sort(result.begin(), result.end(), [](const auto& a, const auto& b) { return a.filename < b.filename; });
+                    return result;
+                }
+        };
+
+        // Times one read call and updates the counters of its file. The
+        // probe is created right before the call, and read() is called
+        // with its return value and the decoded size of the record. iter
+        // is the index iterator being read from, if any.
+        class htsProbe {
+            protected:
+                using clock = std::chrono::steady_clock;
+
+                const ::htsFile * m_fp;
+                const hts_itr_t * m_iter;
+                int m_chunk;
+                int64_t m_offset;
+                int64_t m_block;
+                clock::time_point m_start;
+
+                BGZF * bgzf() const { return m_fp->is_bgzf ? m_fp->fp.bgzf : nullptr; }
+
+            public:
+                htsProbe(const ::htsFile * fp, const hts_itr_t * iter = nullptr):
+                    m_fp(fp), m_iter(iter), m_chunk(iter != nullptr ? iter->i : 0), m_offset(0), m_block(0) {
+                    if(auto b = bgzf()) {
+                        m_offset = htell(b->fp);
+                        m_block = b->block_address;
+                    }
+                    m_start = clock::now();
+                }
+
+                void read(int retVal, size_t bytes) {
+                    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_start).count();
+                    auto c = htsInstrumentation::find(m_fp);
+
+                    c->readNanos.fetch_add(nanos, std::memory_order_relaxed);
+                    if(retVal >= 0) {
+                        c->records.fetch_add(1, std::memory_order_relaxed);
+                        c->bytesOut.fetch_add(bytes, std::memory_order_relaxed);
+                    }
+
+                    if(m_iter != nullptr && m_iter->i != m_chunk) c->seeks.fetch_add(1, std::memory_order_relaxed);
+
+                    if(auto b = bgzf()) {
+                        int64_t offset = htell(b->fp);
+                        if(offset > m_offset) c->bytesIn.fetch_add(offset - m_offset, std::memory_order_relaxed);
+                        if(b->block_address != m_block) c->blocks.fetch_add(1, std::memory_order_relaxed);
+                        if(offset < m_offset && m_iter == nullptr) c->seeks.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+        };
+
+        inline int htsClose(::htsFile * fp) {
+            htsInstrumentation::release(fp);
+            return hts_close(fp);
+        }
+#else
+        class htsProbe {
+            public:
+                htsProbe(const ::htsFile *, const hts_itr_t * = nullptr) {}
+                void read(int, size_t) {}
+        };
+
+        inline int htsClose(::htsFile * fp) { return hts_close(fp); }
+#endif
+
         // First order of business when dealing with hts files is to open it.
         // To follow the principle of Resource Acquisition Is Initialization,
         // or RAII for short, we define a type alias HTSLibpp::htsFile to
         // be an unique pointer to the underlying struct htsFile *, which
         // will be closed automatically upon going out-of-scope by calling
         // hts_close
-        using htsFile = HTS_UPTR(::htsFile, hts_close);
+        using htsFile = HTS_UPTR(::htsFile, htsClose);
         using htsIndex = HTS_UPTR(::hts_idx_t, hts_idx_destroy);
         using htsIterator = HTS_UPTR(::hts_itr_t, hts_itr_destroy);
 
+        // the counters of one open file
+        inline auto htsStatsOf(const htsFile& fp) {
+#ifdef HTSLIBPP_INSTRUMENT
+            return htsInstrumentation::of(fp.get());
+#else
+            return htsStats{};
+#endif
+        }
+
+        // the counters of every file read so far, summed per filename
+        inline auto htsStatsSnapshot() {
+#ifdef HTSLIBPP_INSTRUMENT
+            return htsInstrumentation::snapshot();
+#else
+            return std::vector<htsStats>{};
+#endif
+        }
+
+        // the snapshot in the Prometheus text exposition format
+        inline std::string htsStatsPrometheus(const std::string& prefix = "htslibpp") {
+#ifdef HTSLIBPP_INSTRUMENT
+            auto snapshot = htsStatsSnapshot();
+            auto label = [](const std::string& filename) {
+                std::string escaped;
+                for(auto c : filename) {
+                    if(c == '\\' || c == '"') escaped += '\\';
+                    if(c == '\n') { escaped += "\\n"; continue; }
+                    escaped += c;
+                }
+                return escaped;
+            };
+
+            std::ostringstream out;
+            auto metric = [&](const char * name, const char * help, uint64_t htsStats::* field) {
+                out << "# HELP " << prefix << "_" << name << " " << help << "\n";
+                out << "# TYPE " << prefix << "_" << name << " counter\n";
+                for(const auto& s : snapshot) out << prefix << "_" << name << "{file=\"" << label(s.filename) << "\"} " << s.*field << "\n";
+            };
+
+            metric("records_total", "Records read.", &htsStats::records);
+            metric("bytes_in_total", "Compressed bytes consumed.", &htsStats::bytesIn);
+            metric("bytes_out_total", "Decoded record bytes.", &htsStats::bytesOut);
+            metric("blocks_total", "BGZF blocks entered.", &htsStats::blocks);
+            metric("seeks_total", "Index chunk switches and backward jumps.", &htsStats::seeks);
+            metric("read_nanoseconds_total", "Time spent in htslib read calls.", &htsStats::readNanos);
+            return out.str();
+#else
+            return std::string{};
+#endif
+        }
+
         inline auto htsOpen(const std::string& filename, const std::string& mode) {
             return htsFile{ hts_open(filename.c_str(), mode.c_str()) };
         }
 
+        // BGZF blocks can be inflated and deflated by a pool of worker
+        // threads. One pool can be shared by any number of open files, so
+        // it lives in its own RAII wrapper rather than inside htsFile. The
+        // pool must outlive every htsFile that has been attached to it.
+        using htsTPool = HTS_UPTR(::hts_tpool, hts_tpool_destroy);
+
+        struct htsThreadPool {
+            protected:
+                htsTPool m_pool;
+                ::htsThreadPool m_handle;
+
+            public:
+                // a qsize of 0 lets htslib pick its default queue depth
+                htsThreadPool(int nThreads, int qsize = 0): m_pool(hts_tpool_init(nThreads)), m_handle{m_pool.get(), qsize} {}
+
+                ::htsThreadPool * get() { return m_pool.get() != nullptr ? &m_handle : nullptr; }
+                int size() const { return m_pool.get() != nullptr ? hts_tpool_size(m_pool.get()) : 0; }
+        };
+
+        inline auto htsSetThreadPool(htsFile& fp, htsThreadPool& pool) {
+            if(fp.get() == nullptr || pool.get() == nullptr) return -1;
+            return hts_set_thread_pool(fp.get(), pool.get());
+        }
+
+        // open a file and attach it to a pool. the handle is empty if the
+        // file cannot be opened or the pool cannot be attached
+        inline auto htsOpen(const std::string& filename, const std::string& mode, htsThreadPool& pool) {
+            auto fp = htsOpen(filename, mode);
+            if(fp.get() != nullptr && htsSetThreadPool(fp, pool) < 0) fp.reset();
+            return fp;
+        }
+
+        // In-memory input. The buffer is read through a hFILE backend of
+        // our own, so reads are served straight out of memory without any
+        // syscalls or a copy of the whole buffer, and the resulting htsFile
+        // works with every htsReader range, region queries included. The
+        // buffer is not copied or owned; it has to outlive the htsFile.
+        struct htsMemoryHFile {
+            ::hFILE base;
+            const char * data;
+            size_t size;
+            size_t pos;
+
+            static ssize_t read(::hFILE * fp, void * buffer, size_t nbytes) {
+                auto f = reinterpret_cast<htsMemoryHFile *>(fp);
+                nbytes = std::min(nbytes, f->size - f->pos);
+                memcpy(buffer, f->data + f->pos, nbytes);
+                f->pos += nbytes;
+                return nbytes;
+            }
+
+            static ssize_t write(::hFILE *, const void *, size_t) {
+                errno = EROFS;
+                return -1;
+            }
+
+            static off_t seek(::hFILE * fp, off_t offset, int whence) {
+                auto f = reinterpret_cast<htsMemoryHFile *>(fp);
+                off_t origin = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? f->pos : whence == SEEK_END ? f->size : -1;
+                if(origin < 0 || origin + offset < 0 || static_cast<size_t>(origin + offset) > f->size) {
+                    errno = EINVAL;
+                    return -1;
+                }
+                f->pos = origin + offset;
+                return f->pos;
+            }
+
+            static int flush(::hFILE *) { return 0; }
+            static int close(::hFILE *) { return 0; }
+
+            static ::hFILE * open(const void * data, size_t size) {
+                static const ::hFILE_backend backend = { read, write, seek, flush, close };
+
+                auto f = reinterpret_cast<htsMemoryHFile *>(hfile_init(sizeof(htsMemoryHFile), "r", 0));
+                if(f == nullptr) return nullptr;
+                f->data = static_cast<const char *>(data);
+                f->size = size;
+                f->pos = 0;
+                f->base.backend = &backend;
+                return &f->base;
+            }
+        };
+
+        inline auto htsOpenMemory(const void * data, size_t size, const std::string& mode = "r") {
+            auto hfp = htsMemoryHFile::open(data, size);
+            if(hfp == nullptr) return htsFile{nullptr};
+
+            auto fp = htsFile{ hts_hopen(hfp, "mem:", mode.c_str()) };
+            if(fp.get() == nullptr) hclose_abruptly(hfp);
+            return fp;
+        }
+
+        // A read-only memory mapping of a whole file, with madvise hints
+        // for how it is going to be read. Pages are faulted in by the
+        // kernel, ahead of time for SEQUENTIAL and WILLNEED.
+        struct htsMappedFile {
+            enum class Access { NORMAL, SEQUENTIAL, RANDOM, WILLNEED };
+
+            protected:
+                void * m_data;
+                size_t m_size;
+
+                static int advice(Access access) {
+                    switch(access) {
+                        case Access::SEQUENTIAL: return MADV_SEQUENTIAL;
+                        case Access::RANDOM:     return MADV_RANDOM;
+                        case Access::WILLNEED:   return MADV_WILLNEED;
+                        default:                 return MADV_NORMAL;
+                    }
+                }
+
+            public:
+                explicit htsMappedFile(const std::string& filename, Access access = Access::SEQUENTIAL): m_data(nullptr), m_size(0) {
+                    int fd = open(filename.c_str(), O_RDONLY);
+                    if(fd < 0) return;
+
+                    struct stat st;
+                    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+                        auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                        if(data != MAP_FAILED) {
+                            m_data = data;
+                            m_size = st.st_size;
+                            madvise(m_data, m_size, advice(access));
+                        }
+                    }
+                    close(fd);
+                }
+
+                htsMappedFile(const htsMappedFile&) = delete;
+                htsMappedFile& operator=(const htsMappedFile&) = delete;
+
+                htsMappedFile(htsMappedFile&& other): m_data(other.m_data), m_size(other.m_size) {
+                    other.m_data = nullptr;
+                    other.m_size = 0;
+                }
+
+                ~htsMappedFile() { if(m_data != nullptr) munmap(m_data, m_size); }
+
+                bool good() const { return m_data != nullptr; }
+                const void * data() const { return m_data; }
+                size_t size() const { return m_size; }
+
+                // hint how a part of the file is going to be read, e.g.
+                // WILLNEED ahead of a region query. returns 0 on success
+                int advise(size_t offset, size_t length, Access access) const {
+                    if(m_data == nullptr || offset >= m_size) return -1;
+
+                    static const size_t page = sysconf(_SC_PAGESIZE);
+                    auto start = offset / page * page;
+                    length = std::min(length + (offset - start), m_size - start);
+                    return madvise(static_cast<char *>(m_data) + start, length, advice(access));
+                }
+        };
+
+        // the mapping has to outlive the htsFile
+        inline auto htsOpen(const htsMappedFile& file, const std::string& mode = "r") {
+            if(!file.good()) return htsFile{nullptr};
+            return htsOpenMemory(file.data(), file.size(), mode);
+        }
+
+        // Output files are opened with a mode string that encodes both the
+        // format and the compression level. htsWriteMode builds it from a
+        // format and a level, where a level of -1 means htslib's default and
+        // 0 means uncompressed BGZF.
+        enum class htsOutputFormat { SAM, BAM, CRAM, VCF, VCF_GZ, BCF };
+
+        inline auto htsWriteMode(htsOutputFormat format, int level = -1) {
+            std::string mode = "w";
+            switch(format) {
+                case htsOutputFormat::BAM:
+                case htsOutputFormat::BCF:    mode += "b"; break;
+                case htsOutputFormat::CRAM:   mode += "c"; break;
+                case htsOutputFormat::VCF_GZ: mode += "z"; break;
+                default: return mode;
+            }
+            if(level >= 0 && level <= 9) mode += static_cast<char>('0' + level);
+            return mode;
+        }
+
+        // Scratch files, such as sort runs and spill partitions, go into
+        // $TMPDIR, or /tmp if it is not set. htsTempPrefix names them after
+        // the stage that writes them, the process and the object that owns
+        // them, so that concurrent owners never collide.
+        inline std::string htsTempDir() {
+            const char * tmpdir = getenv("TMPDIR");
+            return tmpdir != nullptr && *tmpdir != '\0' ? tmpdir : "/tmp";
+        }
+
+        inline std::string htsTempPrefix(const std::string& stage, const void * owner) {
+            return htsTempDir() + "/htslibpp-" + stage + "-" + std::to_string(getpid()) + "-" +
+                std::to_string(reinterpret_cast<uintptr_t>(owner)) + "-";
+        }
+
+        // CRAM files are encoded against a reference, which is set per file
+        inline auto htsSetReference(htsFile& fp, const std::string& fasta) {
+            if(fp.get() == nullptr) return -1;
+            return hts_set_fai_filename(fp.get(), fasta.c_str());
+        }
+
         inline auto htsIndexOpen(const std::string& filename, const std::string& indexFilename) {
             return htsIndex(hts_idx_load2(filename.c_str(), indexFilename.c_str()));
         }
 
+        // Record pools
+        //
+        // Records that are only held for a short while, e.g. in a sorting
+        // window or while waiting for their mate, can be taken from a pool
+        // instead of being allocated. A pooled record is a unique_ptr whose
+        // deleter hands the record back to the free list of the releasing
+        // thread, where it keeps its data buffers for the next user.
+        //
+        // Free lists are per thread, so taking and returning a record never
+        // takes a lock. A free list holds at most maxCached records, and
+        // anything beyond that is destroyed. htsPoolTraits<RawT> tells the
+        // pool how to create, destroy and reset a raw htslib struct.
+        template<class RawT> struct htsPoolTraits;
+
+        template<class RawT> class htsRawPool {
+            protected:
+                struct freelist {
+                    std::vector<RawT *> items;
+                    ~freelist() {
+                        destroyed() = true;
+                        for(auto p : items) htsPoolTraits<RawT>::destroy(p);
+                    }
+                };
+
+                static freelist& local() {
+                    static thread_local freelist f;
+                    return f;
+                }
+
+                // records released by other thread_local objects after the
+                // free list of the thread is gone are destroyed right away
+                static bool& destroyed() {
+                    static thread_local bool d = false;
+                    return d;
+                }
+
+            public:
+                static const size_t maxCached = 1024;
+
+                static void release(RawT * p) {
+                    if(p == nullptr) return;
+
+                    if(!destroyed()) {
+                        auto& f = local();
+                        if(f.items.size() < maxCached) {
+                            htsPoolTraits<RawT>::recycle(p);
+                            f.items.push_back(p);
+                            return;
+                        }
+                    }
+                    htsPoolTraits<RawT>::destroy(p);
+                }
+
+                struct deleter { void operator()(RawT * p) const { htsRawPool::release(p); } };
+                using pointer = std::unique_ptr<RawT, deleter>;
+
+                static pointer acquire() {
+                    auto& f = local();
+                    if(f.items.empty()) return pointer(htsPoolTraits<RawT>::init());
+
+                    auto p = f.items.back();
+                    f.items.pop_back();
+                    return pointer(p);
+                }
+
+                // records on the free list of the calling thread
+                static size_t cached() { return local().items.size(); }
+
+                // destroy the free list of the calling thread
+                static void trim() {
+                    auto& f = local();
+                    for(auto p : f.items) htsPoolTraits<RawT>::destroy(p);
+                    f.items.clear();
+                }
+        };
+
+        // HTS Regions
+
+        /* A region is an interval on a contig identified by its numeric id
+         * in the file header. Coordinates are 0-based and half-open, the
+         * same as what hts_parse_reg produces. A tid of -1 marks a region
+         * that failed to resolve.
+         */
+        struct htsRegion {
+            int tid;
+            int beg;
+            int end;
+
+            bool operator<(const htsRegion& rhs) const {
+                if(tid != rhs.tid) return tid < rhs.tid;
+                if(beg != rhs.beg) return beg < rhs.beg;
+                return end < rhs.end;
+            }
+            bool operator==(const htsRegion& rhs) const { return tid == rhs.tid && beg == rhs.beg && end == rhs.end; }
+            bool operator!=(const htsRegion& rhs) const { return !(*this == rhs); }
+        };
+
+        // sort regions, drop unresolved ones, and merge those that overlap
+        // or abut so every position is covered at most once. Regions that
+        // are less than gap bases apart can be merged as well
+        inline auto htsMergeRegions(std::vector<htsRegion> regions, int gap = 0) {
+            regions.erase(std::remove_if(regions.begin(), regions.end(), [](const auto& r) { return r.tid == -1 || r.end <= r.beg; }), regions.end());
+            std::sort(regions.begin(), regions.end());
+
+            std::vector<htsRegion> merged;
+            for(const auto& r : regions) {
+                if(!merged.empty() && merged.back().tid == r.tid && r.beg <= static_cast<int64_t>(merged.back().end) + gap)
+                    merged.back().end = std::max(merged.back().end, r.end);
+                else
+                    merged.push_back(r);
+            }
+            return merged;
+        }
+
+        // cut regions into pieces of at most length bases
+        inline auto htsSplitRegions(const std::vector<htsRegion>& regions, int length) {
+            std::vector<htsRegion> pieces;
+            for(const auto& r : regions) {
+                if(length <= 0 || r.end - r.beg <= length) { pieces.push_back(r); continue; }
+                for(int beg = r.beg; beg < r.end; beg += std::min(length, r.end - beg))
+                    pieces.push_back(htsRegion{r.tid, beg, beg + std::min(length, r.end - beg)});
+            }
+            return pieces;
+        }
+
         // HTS Record iterators
         
         /* hts file records are accessed in a somewhat similar
@@ -124,7 +848,55 @@ namespace YiCppLib {
                 bool operator==(const iterator& rhs) { return rec.get() == nullptr && rhs.rec.get() == nullptr; }
                 bool operator!=(const iterator& rhs) { return !(*this == rhs); }
         };
+
+        /* A single pass range over the records that next(rec) reads into a
+         * record of its own, handing out a projection of each. next returns
+         * a negative value at the end of the input. The projections are
+         * only valid until the iterator moves on
+         */
+        template<class RecT, class ProxyT, class NextF>
+        struct htsProjectedRange {
+            protected:
+                RecT m_rec;
+                NextF m_next;
+
+            public:
+                htsProjectedRange(RecT&& rec, NextF&& next): m_rec(std::move(rec)), m_next(std::move(next)) {}
+
+                struct iterator : public std::iterator<std::input_iterator_tag, ProxyT> {
+                    protected:
+                        htsProjectedRange * m_range;
+
+                        void advance() { if(m_range->m_next(m_range->m_rec.get()) < 0) m_range = nullptr; }
+
+                    public:
+                        iterator(htsProjectedRange * range): m_range(range) { if(m_range != nullptr) advance(); }
+
+                        ProxyT operator*() const { return ProxyT(*m_range->m_rec); }
+
+                        iterator& operator++() { if(m_range != nullptr) advance(); return *this; }
+                        void operator++(int)   { ++(*this); }
+
+                        bool operator==(const iterator& rhs) const { return m_range == rhs.m_range; }
+                        bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
+                };
+
+                iterator begin() { return iterator(m_rec.get() != nullptr ? this : nullptr); }
+                iterator end()   { return iterator(nullptr); }
+        };
     }
 }
 
+namespace std {
+    // string views can key unordered containers without copying the string.
+    // the hash is FNV-1a over the bytes of the view
+    template<> struct hash<YiCppLib::htsStringView> {
+        size_t operator()(const YiCppLib::htsStringView& view) const {
+            uint64_t h = 14695981039346656037ULL;
+            for(auto c : view) h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+            return static_cast<size_t>(h);
+        }
+    };
+}
+
 #endif
@@ -6,7 +6,12 @@
 #include "htslibpp.h"
 #include <htslib/sam.h>
 #include <string.h>
+#include <stdlib.h>
 #include <utility>
+#include <istream>
+#include <sstream>
+#include <memory>
+#include <unordered_map>
 #ifndef YICPPLIB_HTSLIBPP_ALIGNMENT
 #define YICPPLIB_HTSLIBPP_ALIGNMENT
 
@@ -33,7 +38,7 @@ namespace YiCppLib {
         template<> struct htsHeader<bamHeader> {
 
             inline static auto read(const htsFile& file) noexcept {
-                return bamHeader{ bam_hdr_read(file->fp.bgzf) };
+                return bamHeader{ sam_hdr_read(file.get()) };
             }
 
             struct line_iterator : public std::iterator<std::forward_iterator_tag, std::string> {
@@ -61,6 +66,115 @@ namespace YiCppLib {
             inline static auto cbegin_l(const bamHeader& header) noexcept { return line_iterator(header); }
             inline static auto cend_l(const bamHeader& header) noexcept { return line_iterator(header, header->l_text); }
 
+            // resolve a region string such as "13:32900000-32950000" against
+            // the header's reference dictionary. An unknown contig yields a
+            // region with tid -1
+            inline static auto region(const bamHeader& header, const std::string& region_s) {
+                int beg = 0, end = 0;
+                const char * name_end = hts_parse_reg(region_s.c_str(), &beg, &end);
+                if(name_end == nullptr) return htsRegion{-1, 0, 0};
+
+                std::string name(region_s.c_str(), name_end);
+                int tid = bam_name2id(header.get(), name.c_str());
+                if(tid < 0) return htsRegion{-1, 0, 0};
+
+                return htsRegion{tid, beg, std::min(end, static_cast<int>(header->target_len[tid]))};
+            }
+
+            // resolve a list of region strings, merging the ones that overlap
+            inline static auto regions(const bamHeader& header, const std::vector<std::string>& regions_s) {
+                std::vector<htsRegion> resolved;
+                for(const auto& r : regions_s) resolved.push_back(region(header, r));
+                return htsMergeRegions(std::move(resolved));
+            }
+
+            // resolve BED formatted intervals, one "chrom start end" per line.
+            // Header, comment and unresolvable lines are skipped
+            inline static auto regions(const bamHeader& header, std::istream& bed) {
+                std::vector<htsRegion> resolved;
+                std::string line, chrom;
+                while(std::getline(bed, line)) {
+                    if(line.empty() || line[0] == '#' || line.compare(0, 5, "track") == 0 || line.compare(0, 7, "browser") == 0) continue;
+
+                    std::istringstream fields(line);
+                    int beg = 0, end = 0;
+                    if(!(fields >> chrom >> beg >> end)) continue;
+
+                    int tid = bam_name2id(header.get(), chrom.c_str());
+                    if(tid >= 0) resolved.push_back(htsRegion{tid, beg, end});
+                }
+                return htsMergeRegions(std::move(resolved));
+            }
+
+            // split every reference sequence into shards of at most length
+            // bases. Unplaced reads (those without a coordinate) can be added
+            // as a shard of their own, which has tid HTS_IDX_NOCOOR
+            inline static auto shards(const bamHeader& header, int length, bool withUnplaced = false) {
+                std::vector<htsRegion> contigs;
+                for(int32_t tid = 0; tid < header->n_targets; tid++)
+                    contigs.push_back(htsRegion{tid, 0, static_cast<int>(header->target_len[tid])});
+
+                auto pieces = htsSplitRegions(contigs, length);
+                if(withUnplaced) pieces.push_back(htsRegion{HTS_IDX_NOCOOR, 0, 0});
+                return pieces;
+            }
+
+        };
+    }
+}
+
+// --- BAM HEADER INDEX --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // An immutable, pre-parsed view of a bamHeader for hot loops that
+        // resolve reference names over and over. It is built once, after
+        // which every lookup is a hash lookup, and it is meant to be shared
+        // read-only between threads through the shared_ptr build returns.
+        template<> struct htsHeaderIndex<bamHeader> {
+            struct contig {
+                int tid;
+                uint32_t length;
+            };
+
+            protected:
+                std::unordered_map<std::string, contig> m_contigs;
+                std::vector<std::string> m_lines;
+
+                htsHeaderIndex(const bamHeader& header) {
+                    m_contigs.reserve(header->n_targets);
+                    for(int32_t tid = 0; tid < header->n_targets; tid++)
+                        m_contigs.emplace(header->target_name[tid], contig{tid, header->target_len[tid]});
+
+                    const char * text = header->text;
+                    const char * end = text + header->l_text;
+                    while(text < end) {
+                        const char * eol = static_cast<const char *>(memchr(text, '\n', end - text));
+                        if(eol == nullptr) eol = end;
+                        if(eol > text) m_lines.emplace_back(text, eol);
+                        text = eol + 1;
+                    }
+                }
+
+            public:
+                static std::shared_ptr<const htsHeaderIndex> build(const bamHeader& header) {
+                    return std::shared_ptr<const htsHeaderIndex>(new htsHeaderIndex(header));
+                }
+
+                // the contig of a given name, nullptr if there is none
+                const contig * find(const std::string& name) const {
+                    auto it = m_contigs.find(name);
+                    return it != m_contigs.end() ? &it->second : nullptr;
+                }
+
+                int tid(const std::string& name) const {
+                    auto c = find(name);
+                    return c != nullptr ? c->tid : -1;
+                }
+
+                size_t contigCount() const { return m_contigs.size(); }
+
+                // the header text, split into lines without the newlines
+                const std::vector<std::string>& lines() const { return m_lines; }
         };
     }
 }
@@ -76,9 +190,25 @@ namespace YiCppLib {
         using bamRecord = HTS_UPTR(::bam1_t, bam_destroy1);
 
         template<> struct htsReader<bamRecord> {
+            // the htslib read calls that every iterator and batch goes
+            // through, so that they can be probed when instrumented
+            static inline int next(htsFile& fp, const bamHeader& hdr, bam1_t * rec) {
+                htsProbe probe(fp.get());
+                auto retVal = sam_read1(fp.get(), hdr.get(), rec);
+                probe.read(retVal, rec->l_data);
+                return retVal;
+            }
+
+            static inline int next(htsFile& fp, hts_itr_t * iter, bam1_t * rec) {
+                htsProbe probe(fp.get(), iter);
+                auto retVal = sam_itr_next(fp.get(), iter, rec);
+                probe.read(retVal, rec->l_data);
+                return retVal;
+            }
+
             // read the next bam record from the file.
             static inline void read(htsFile& fp, const bamHeader& hdr, bamRecord& rec) {
-                auto retVal = sam_read1(fp.get(), hdr.get(), rec.get());
+                auto retVal = next(fp, hdr, rec.get());
                 if(retVal <= 0) rec.reset(nullptr);
             }
 
@@ -92,7 +222,7 @@ namespace YiCppLib {
 
             // read the next bam record from hts_iterator
             static inline void read(htsFile& fp, htsIterator& iter, bamRecord& rec) {
-                auto retVal = sam_itr_next(fp.get(), iter.get(), rec.get());
+                auto retVal = next(fp, iter.get(), rec.get());
                 if(retVal <= 0) rec.reset(nullptr);
             }
 
@@ -128,9 +258,62 @@ namespace YiCppLib {
                 return iterator_r(fp, htsIterator{sam_itr_querys(idx.get(), hdr.get(), range_s.c_str())});
             }
             static auto end(htsFile& fp, const bamHeader& hdr, htsIndex& idx, std::string range_s) { 
-                return iterator_r(fp, htsIterator{sam_itr_querys(idx.get(), hdr.get(), range_s.c_str())}, nullptr);
+                return iterator_r(fp, htsIterator{nullptr}, nullptr);
             }
 
+            // multi-region iterator
+            //
+            // The targets are sorted and merged, then targets that are close
+            // to each other are grouped into a single index query, so the
+            // BGZF blocks between them are not inflated twice. Records that
+            // only fall into the gaps between targets are skipped, and a
+            // record that overlaps several targets is yielded only once.
+            struct iterator_m : public bam_iterator_base {
+                protected:
+                    htsIndex& idx;
+                    const std::vector<htsRegion>& targets;
+                    const std::vector<htsRegion>& queries;
+                    size_t nextQuery;
+                    size_t target;
+                    htsIterator sam_iter;
+
+                    // a record already returned by the previous query
+                    bool seen() const {
+                        if(nextQuery < 2) return false;
+                        const auto& prev = queries[nextQuery - 2];
+                        return prev.tid == rec->core.tid && rec->core.pos < prev.end;
+                    }
+
+                    // does the record overlap any target. records come in
+                    // coordinate order, so targets behind it are never needed again
+                    bool wanted() {
+                        while(target < targets.size() && (targets[target].tid < rec->core.tid ||
+                                    (targets[target].tid == rec->core.tid && targets[target].end <= rec->core.pos))) target++;
+
+                        return target < targets.size() && targets[target].tid == rec->core.tid && targets[target].beg < bam_endpos(rec.get());
+                    }
+
+                    virtual void advance() {
+                        if(rec.get() == nullptr) return;
+
+                        while(true) {
+                            if(sam_iter.get() != nullptr && next(fp, sam_iter.get(), rec.get()) >= 0) {
+                                if(!seen() && wanted()) return;
+                                continue;
+                            }
+
+                            if(nextQuery >= queries.size()) { rec.reset(nullptr); return; }
+
+                            const auto& q = queries[nextQuery++];
+                            sam_iter.reset(sam_itr_queryi(idx.get(), q.tid, q.beg, q.end));
+                        }
+                    }
+
+                public:
+                    iterator_m(htsFile& fp, htsIndex& idx, const std::vector<htsRegion>& targets, const std::vector<htsRegion>& queries, bamRecord&& rec):
+                        bam_iterator_base(fp, std::move(rec)), idx(idx), targets(targets), queries(queries), nextQuery(0), target(0), sam_iter(nullptr) { advance(); }
+            };
+
             // --- RANGE EXPRESSIONS --- //
             struct bam_range_s {
                 protected:
@@ -155,45 +338,392 @@ namespace YiCppLib {
                     auto end()   { return htsReader<bamRecord>::end(fp, hdr, idx, region); }
             };
 
+            // a range over an index query that has already been made, e.g.
+            // one handed out by htsCache. The query is moved into the first
+            // iterator, so the range can only be traversed once
+            struct bam_range_i {
+                protected:
+                    htsFile& fp;
+                    htsIterator iter;
+
+                public:
+                    bam_range_i(htsFile& fp, htsIterator&& iter): fp(fp), iter(std::move(iter)) {}
+                    auto end()   { return iterator_r(fp, htsIterator{nullptr}, nullptr); }
+                    auto begin() {
+                        if(iter.get() == nullptr) return end();
+                        return iterator_r(fp, std::move(iter));
+                    }
+            };
+
+            struct bam_range_m {
+                protected:
+                    htsFile& fp;
+                    htsIndex& idx;
+                    std::vector<htsRegion> targets;
+                    std::vector<htsRegion> queries;
+
+                public:
+                    // targets closer than mergeGap bases share one index query
+                    static const int defaultMergeGap = 1024;
+
+                    bam_range_m(htsFile& fp, htsIndex& idx, const std::vector<htsRegion>& regions, int mergeGap = defaultMergeGap):
+                        fp(fp), idx(idx), targets(htsMergeRegions(regions)), queries(htsMergeRegions(targets, mergeGap)) {}
+
+                    auto begin() { return iterator_m(fp, idx, targets, queries, bamRecord{bam_init1()}); }
+                    auto end()   { return iterator_m(fp, idx, targets, queries, bamRecord{nullptr}); }
+            };
+
             static inline auto range(htsFile& fp, const bamHeader& hdr) { return bam_range_s(fp, hdr); }
+            static inline auto range(htsFile& fp, const bamHeader& hdr, htsIndex& idx, const std::vector<htsRegion>& regions, int mergeGap = bam_range_m::defaultMergeGap) {
+                return bam_range_m(fp, idx, regions, mergeGap);
+            }
+            static inline auto range(htsFile& fp, const bamHeader& hdr, htsIndex& idx, const std::vector<std::string>& regions, int mergeGap = bam_range_m::defaultMergeGap) {
+                return bam_range_m(fp, idx, htsHeader<bamHeader>::regions(hdr, regions), mergeGap);
+            }
             static inline auto range(htsFile& fp, const bamHeader& hdr, htsIndex& idx, const std::string& region) { return bam_range_r(fp, hdr, idx, region); }
+            static inline auto range(htsFile& fp, htsIterator&& iter) { return bam_range_i(fp, std::move(iter)); }
+
+            // --- PROJECTED READS --- //
+
+            // the CRAM data series that decode the fields of a projection
+            template<class FieldsT> static constexpr int requiredFields() {
+                return (FieldsT::template has<htsField::Core>()  ? SAM_FLAG | SAM_RNAME | SAM_POS | SAM_MAPQ : 0) |
+                       (FieldsT::template has<htsField::Mate>()  ? SAM_RNEXT | SAM_PNEXT | SAM_TLEN : 0) |
+                       (FieldsT::template has<htsField::Name>()  ? SAM_QNAME : 0) |
+                       (FieldsT::template has<htsField::Cigar>() ? SAM_CIGAR : 0) |
+                       (FieldsT::template has<htsField::Seq>()   ? SAM_SEQ : 0) |
+                       (FieldsT::template has<htsField::Qual>()  ? SAM_QUAL : 0) |
+                       (FieldsT::template has<htsField::Aux>()   ? SAM_AUX | SAM_RGAUX : 0) |
+                       (FieldsT::template has<htsField::MD>()    ? SAM_AUX : 0);
+            }
+
+            // Restrict decoding to a projection. Only CRAM decodes less,
+            // skipping sequence and quality reconstruction unless they are
+            // projected, and only generating MD and NM for htsField::MD.
+            // Other formats ignore the settings. Has to be called before
+            // the first record is read
+            template<class FieldsT> static inline int project(htsFile& fp) {
+                if(hts_set_opt(fp.get(), CRAM_OPT_REQUIRED_FIELDS, requiredFields<FieldsT>()) != 0) return -1;
+                return hts_set_opt(fp.get(), CRAM_OPT_DECODE_MD, FieldsT::template has<htsField::MD>() ? 1 : 0);
+            }
+
+            // read the whole file, or an index query, under a projection.
+            // the range yields HTSProjection<const bam1_t &, FieldsT>, and is
+            // empty if the projection cannot be set
+            template<class FieldsT> static inline auto projected(htsFile& fp, const bamHeader& hdr) {
+                bamRecord rec{project<FieldsT>(fp) == 0 ? bam_init1() : nullptr};
+                auto next = [&fp, &hdr](bam1_t * rec) { return htsReader<bamRecord>::next(fp, hdr, rec); };
+                return htsProjectedRange<bamRecord, HTSProjection<const bam1_t &, FieldsT>, decltype(next)>(std::move(rec), std::move(next));
+            }
+
+            template<class FieldsT> static inline auto projected(htsFile& fp, htsIterator&& iter) {
+                bamRecord rec{project<FieldsT>(fp) == 0 ? bam_init1() : nullptr};
+                auto next = [&fp, iter = std::move(iter)](bam1_t * rec) {
+                    return iter.get() != nullptr ? htsReader<bamRecord>::next(fp, iter.get(), rec) : -1;
+                };
+                return htsProjectedRange<bamRecord, HTSProjection<const bam1_t &, FieldsT>, decltype(next)>(std::move(rec), std::move(next));
+            }
 
         };
     }
 }
 
+// --- BAM RECORD BATCHES --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // A batch is a fixed-capacity slab of bam1_t structs that is refilled
+        // over and over. The records in the slab hold on to their data
+        // buffers between refills, so once the buffers have grown to fit the
+        // longest records no further allocation takes place. The slab is
+        // contiguous and can be handed to later stages as a span.
+        template<> struct htsBatch<bamRecord> {
+            protected:
+                std::vector<bam1_t> m_slab;
+                size_t m_size;
+
+            public:
+                htsBatch(size_t capacity = 4096): m_slab(capacity), m_size(0) {}
+                ~htsBatch() { for(auto& b : m_slab) free(b.data); }
+
+                htsBatch(const htsBatch&) = delete;
+                htsBatch& operator=(const htsBatch&) = delete;
+                htsBatch(htsBatch&& other): m_slab(std::move(other.m_slab)), m_size(other.m_size) { other.m_size = 0; }
+                htsBatch& operator=(htsBatch&& other) { std::swap(m_slab, other.m_slab); std::swap(m_size, other.m_size); return *this; }
+
+                // refill the batch sequentially from the file. returns the
+                // number of records read, which is 0 at the end of the file,
+                // or -1 on a read error. the records read before the error
+                // are kept, and size() tells how many there are
+                ssize_t fill(htsFile& fp, const bamHeader& hdr) {
+                    for(m_size = 0; m_size < m_slab.size(); m_size++) {
+                        auto retVal = htsReader<bamRecord>::next(fp, hdr, &m_slab[m_size]);
+                        if(retVal < -1) return -1;
+                        if(retVal < 0) break;
+                    }
+                    return m_size;
+                }
+
+                // refill the batch from a region iterator
+                ssize_t fill(htsFile& fp, htsIterator& iter) {
+                    for(m_size = 0; m_size < m_slab.size(); m_size++) {
+                        auto retVal = htsReader<bamRecord>::next(fp, iter.get(), &m_slab[m_size]);
+                        if(retVal < -1) return -1;
+                        if(retVal < 0) break;
+                    }
+                    return m_size;
+                }
+
+                size_t size() const     { return m_size; }
+                size_t capacity() const { return m_slab.size(); }
+                bool empty() const      { return m_size == 0; }
+
+                bam1_t * begin() { return m_slab.data(); }
+                bam1_t * end()   { return m_slab.data() + m_size; }
+                bam1_t& operator[](size_t i) { return m_slab[i]; }
+
+                auto span() { return htsSpan<bam1_t>(m_slab.data(), m_size); }
+        };
+    }
+}
+
+// --- BAM WRITER --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // The writing counterpart of htsReader<bamRecord>. A file is opened
+        // for writing, the header is written once, and records follow either
+        // one at a time or a batch at a time. Compression runs on the thread
+        // pool if one is given.
+        //
+        // An index can be built while writing with htslib 1.10 and later:
+        // call indexInit right after writeHeader and indexSave before the
+        // file is closed. With older htslib, indexInit returns -1 and
+        // buildIndex can index the file once it has been closed.
+        template<> struct htsWriter<bamRecord> {
+            static inline auto open(const std::string& filename, htsOutputFormat format = htsOutputFormat::BAM, int level = -1) {
+                return htsOpen(filename, htsWriteMode(format, level));
+            }
+
+            static inline auto open(const std::string& filename, htsOutputFormat format, int level, htsThreadPool& pool) {
+                return htsOpen(filename, htsWriteMode(format, level), pool);
+            }
+
+            static inline int writeHeader(htsFile& fp, const bamHeader& hdr) {
+                return sam_hdr_write(fp.get(), hdr.get());
+            }
+
+            static inline int write(htsFile& fp, const bamHeader& hdr, const bam1_t& rec) {
+                return sam_write1(fp.get(), hdr.get(), &rec);
+            }
+
+            static inline int write(htsFile& fp, const bamHeader& hdr, const bamRecord& rec) {
+                return write(fp, hdr, *rec);
+            }
+
+            // write every record of a batch. returns the number of records
+            // written, or -1 on the first failure
+            static inline int write(htsFile& fp, const bamHeader& hdr, htsBatch<bamRecord>& batch) {
+                for(auto& rec : batch) if(write(fp, hdr, rec) < 0) return -1;
+                return static_cast<int>(batch.size());
+            }
+
+            // start building an index on the fly. a minShift of 0 builds a
+            // .bai, anything else a .csi. htslib keeps a pointer to the index
+            // filename, so the string has to outlive the call to indexSave.
+            // needs htslib 1.10 or later; with older versions this and
+            // indexSave return -1
+            static inline int indexInit(htsFile& fp, const bamHeader& hdr, const std::string& indexFilename, int minShift = 0) {
+#if defined(HTS_VERSION) && HTS_VERSION >= 101000
+                return sam_idx_init(fp.get(), hdr.get(), minShift, indexFilename.c_str());
+#else
+                return -1;
+#endif
+            }
+
+            static inline int indexSave(htsFile& fp) {
+#if defined(HTS_VERSION) && HTS_VERSION >= 101000
+                return sam_idx_save(fp.get());
+#else
+                return -1;
+#endif
+            }
+
+            // index a closed file. an empty indexFilename uses the default name
+            static inline int buildIndex(const std::string& filename, const std::string& indexFilename = "", int minShift = 0) {
+                return sam_index_build2(filename.c_str(), indexFilename.empty() ? nullptr : indexFilename.c_str(), minShift);
+            }
+        };
+    }
+}
+
+// --- BAM RECORD POOL --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // bam1_t needs no reset between users, its data buffer is simply
+        // overwritten by the next read
+        template<> struct htsPoolTraits<bam1_t> {
+            static bam1_t * init() { return bam_init1(); }
+            static void destroy(bam1_t * b) { bam_destroy1(b); }
+            static void recycle(bam1_t *) {}
+        };
+
+        template<> struct htsRecordPool<bamRecord> : public htsRawPool<bam1_t> {
+            // a pooled deep copy of a record
+            static pointer dup(const bam1_t& src) {
+                auto rec = acquire();
+                if(rec && bam_copy1(rec.get(), &src) == nullptr) rec.reset();
+                return rec;
+            }
+
+            // the next record of the file, or an empty pointer at the end
+            static pointer read(htsFile& fp, const bamHeader& hdr) {
+                auto rec = acquire();
+                if(rec && htsReader<bamRecord>::next(fp, hdr, rec.get()) < 0) rec.reset();
+                return rec;
+            }
+        };
+
+        using bamPooledRecord = htsRecordPool<bamRecord>::pointer;
+    }
+}
+
 // proxy classes
 namespace YiCppLib {
     namespace HTSLibpp {
-        // the proxy around bamRecord, which describes an alignment.
-        template<> struct HTSProxy<const bamRecord &> {
-            private:
-                const bamRecord& m_actual;
-                inline auto data(uint32_t start) const { return std::string((const char *)(m_actual->data) + start); }
+        // A lazy view over the 4-bit packed read sequence. Bases are only
+        // decoded when they are looked at, and nothing is copied.
+        struct htsSequenceView {
+            protected:
+                const uint8_t * m_packed;
+                size_t m_size;
+
+            public:
+                struct iterator : public std::iterator<std::forward_iterator_tag, char> {
+                    protected:
+                        const uint8_t * m_packed;
+                        size_t m_pos;
+
+                    public:
+                        iterator(const uint8_t * packed, size_t pos): m_packed(packed), m_pos(pos) {}
+
+                        char operator*() const { return seq_nt16_str[bam_seqi(m_packed, m_pos)]; }
+
+                        iterator& operator++()    { ++m_pos; return *this; }
+                        iterator  operator++(int) { auto retVal = *this; ++(*this); return retVal; }
+
+                        bool operator==(const iterator& rhs) const { return m_pos == rhs.m_pos; }
+                        bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
+                };
+
+                htsSequenceView(const uint8_t * packed, size_t size): m_packed(packed), m_size(size) {}
+
+                size_t size() const { return m_size; }
+                bool empty() const  { return m_size == 0; }
+
+                // the raw packed bytes, two bases per byte, high nibble first
+                const uint8_t * packed() const { return m_packed; }
+
+                // the 4-bit code of base i, see seq_nt16_str for the alphabet
+                uint8_t code(size_t i) const { return bam_seqi(m_packed, i); }
+                char operator[](size_t i) const { return seq_nt16_str[code(i)]; }
+
+                iterator begin() const { return iterator(m_packed, 0); }
+                iterator end() const   { return iterator(m_packed, m_size); }
+
+                // decoding the whole sequence into a string allocates
+                std::string str() const { return std::string(begin(), end()); }
+        };
+
+        // the proxy around a raw bam1_t, which describes an alignment. None
+        // of the accessors copy or allocate; the views they return point into
+        // the record and are valid until the record is next read into.
+        template<> struct HTSProxy<const bam1_t &> {
+            protected:
+                const bam1_t& m_actual;
 
             public:
 
-                HTSProxy(const bamRecord& actual): m_actual(actual) {}
-
-                inline auto chrID() const     { return m_actual->core.tid;  }
-                inline auto pos() const       { return m_actual->core.pos;  }
-                inline auto qual() const      { return m_actual->core.qual; }
-                inline auto mateChrID() const { return m_actual->core.mtid; }
-                inline auto matePos() const   { return m_actual->core.mpos; }
-
-                // more expensive extractions
-                inline auto queryName() const   { return data(0); }
-                inline auto cigar() const       { return data(m_actual->core.l_qname); }
-                //inline auto queryName() const { return data(0, m_actual->core.l_qname); } 
-                //inline auto cigar() const     { return data(m_actual->core.l_qname, m_actual->core.n_cigar<<2); }
-                //inline auto sequence() const  P return data(m_actual->core.l_qname + m_actual->core.n_cigar<<2, )
-                //inline auto sequence() const { return std::string((char*)(m_actual->data + (m_actual->core.n_cigar)<<2 + m_actual->core.l_qname) ); }
-                //inline auto baseQualities() const { return std::string((char*)(m_actual->data + (m_actual->core.n_cigar)<<2 + m_actual->core.l_qname + (m_actual->core.l_qseq + 1) >> 1)); } 
-                // TO-BE-IMPLEMENTED
-                // inline auto auxiliary() const;
-                // inline auto auxiliary_length() const;
-                // inline auto get_base(uint32_t i) const;
-            
+                HTSProxy(const bam1_t& actual): m_actual(actual) {}
+
+                inline auto chrID() const      { return m_actual.core.tid;  }
+                inline auto pos() const        { return m_actual.core.pos;  }
+                inline auto qual() const       { return m_actual.core.qual; }
+                inline auto flag() const       { return m_actual.core.flag; }
+                inline auto mateChrID() const  { return m_actual.core.mtid; }
+                inline auto matePos() const    { return m_actual.core.mpos; }
+                inline auto insertSize() const { return m_actual.core.isize; }
+                inline auto queryLength() const { return m_actual.core.l_qseq; }
+
+                // variable length data
+                inline auto queryName() const {
+                    const char * name = bam_get_qname(&m_actual);
+                    return htsStringView(name, strnlen(name, m_actual.core.l_qname));
+                }
+
+                // binary CIGAR operations, decode with bam_cigar_op / bam_cigar_oplen
+                inline auto cigar() const { return htsSpan<const uint32_t>(bam_get_cigar(&m_actual), m_actual.core.n_cigar); }
+
+                inline auto sequence() const { return htsSequenceView(bam_get_seq(&m_actual), m_actual.core.l_qseq); }
+                inline auto get_base(uint32_t i) const { return sequence()[i]; }
+
+                // phred scaled base qualities, 0xff at index 0 if absent
+                inline auto baseQualities() const { return htsSpan<const uint8_t>(bam_get_qual(&m_actual), m_actual.core.l_qseq); }
+
+                // the raw auxiliary block, and a single tag looked up within it
+                inline auto auxiliary() const { return htsSpan<const uint8_t>(bam_get_aux(&m_actual), bam_get_l_aux(&m_actual)); }
+                inline auto auxiliary_length() const { return auxiliary().size(); }
+                inline const uint8_t * auxiliary(const char tag[2]) const { return bam_aux_get(&m_actual, tag); }
+        };
+
+        // the proxy around bamRecord, which is the same as the one around
+        // the bam1_t it owns
+        template<> struct HTSProxy<const bamRecord &> : HTSProxy<const bam1_t &> {
+            HTSProxy(const bamRecord& actual): HTSProxy<const bam1_t &>(*actual) {}
+        };
+
+        // the proxy around a bam1_t that was read under a projection. It
+        // has the accessors of HTSProxy<const bam1_t &> for the projected
+        // fields only, since the others may not have been decoded
+        template<class FieldsT> struct HTSProjection<const bam1_t &, FieldsT> : protected HTSProxy<const bam1_t &> {
+            protected:
+                using proxy = HTSProxy<const bam1_t &>;
+                template<class F> static constexpr bool has() { return FieldsT::template has<F>(); }
+
+            public:
+                HTSProjection(const bam1_t& actual): proxy(actual) {}
+                HTSProjection(const bamRecord& actual): proxy(*actual) {}
+
+                inline auto chrID() const { static_assert(has<htsField::Core>(), "chrID() needs htsField::Core"); return proxy::chrID(); }
+                inline auto pos() const   { static_assert(has<htsField::Core>(), "pos() needs htsField::Core");   return proxy::pos(); }
+                inline auto qual() const  { static_assert(has<htsField::Core>(), "qual() needs htsField::Core");  return proxy::qual(); }
+                inline auto flag() const  { static_assert(has<htsField::Core>(), "flag() needs htsField::Core");  return proxy::flag(); }
+
+                inline auto mateChrID() const  { static_assert(has<htsField::Mate>(), "mateChrID() needs htsField::Mate");  return proxy::mateChrID(); }
+                inline auto matePos() const    { static_assert(has<htsField::Mate>(), "matePos() needs htsField::Mate");    return proxy::matePos(); }
+                inline auto insertSize() const { static_assert(has<htsField::Mate>(), "insertSize() needs htsField::Mate"); return proxy::insertSize(); }
+
+                inline auto queryName() const { static_assert(has<htsField::Name>(), "queryName() needs htsField::Name"); return proxy::queryName(); }
+
+                inline auto cigar() const { static_assert(has<htsField::Cigar>(), "cigar() needs htsField::Cigar"); return proxy::cigar(); }
+
+                // the end of the alignment on the reference, exclusive
+                inline auto endPos() const {
+                    static_assert(has<htsField::Core>() && has<htsField::Cigar>(), "endPos() needs htsField::Core and htsField::Cigar");
+                    return bam_endpos(&m_actual);
+                }
+
+                inline auto queryLength() const { static_assert(has<htsField::Seq>(), "queryLength() needs htsField::Seq"); return proxy::queryLength(); }
+                inline auto sequence() const    { static_assert(has<htsField::Seq>(), "sequence() needs htsField::Seq");    return proxy::sequence(); }
+                inline auto get_base(uint32_t i) const { static_assert(has<htsField::Seq>(), "get_base() needs htsField::Seq"); return proxy::get_base(i); }
+
+                inline auto baseQualities() const { static_assert(has<htsField::Qual>(), "baseQualities() needs htsField::Qual"); return proxy::baseQualities(); }
+
+                // MD and NM are auxiliary tags too, so htsField::MD alone
+                // gives access to them
+                inline auto auxiliary() const { static_assert(has<htsField::Aux>(), "auxiliary() needs htsField::Aux"); return proxy::auxiliary(); }
+                inline const uint8_t * auxiliary(const char tag[2]) const {
+                    static_assert(has<htsField::Aux>() || has<htsField::MD>(), "auxiliary(tag) needs htsField::Aux or htsField::MD");
+                    return proxy::auxiliary(tag);
+                }
         };
     }
 }
@@ -0,0 +1,220 @@
+// YiCppLib::HTSLibpp::Async
+//
+// This file contains a prefetching reader, which reads and decodes records
+// on a background thread while the consumer works on the previous batch
+
+#include "htslibpp.h"
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_ASYNC
+#define YICPPLIB_HTSLIBPP_ASYNC
+
+// The reader owns a fixed set of htsBatch slabs that circulate between two
+// threads through a pair of single-producer single-consumer queues
+//
+//   producer: take an empty batch -> fill it -> hand it over
+//   consumer: take a full batch   -> iterate it -> give it back
+//
+// Because the same slabs are refilled over and over, the bam1_t and bcf1_t
+// buffers keep their capacity, and a pass does not allocate once every
+// slab has been used. Since every slab is always in exactly one of the two
+// queues, or held by one of the two threads, neither queue can overflow.
+//
+// The producer is the only user of the htsFile while the reader is alive.
+// The end of the input is marked by an empty batch, after which the
+// producer latches a done flag and exits; every later call to next()
+// returns null instead of waiting for a batch that will never come. A read
+// error ends the input the same way, after the records read before it, and
+// is reported by status() once the end has been reached.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        // A bounded lock-free queue for exactly one producer thread and one
+        // consumer thread. The capacity is rounded up to a power of two.
+        template<class T> class htsSPSCQueue {
+            protected:
+                std::vector<T> m_ring;
+                size_t m_mask;
+
+                // the two indices live on separate cache lines so the two
+                // threads do not invalidate each other's writes
+                alignas(64) std::atomic<size_t> m_head;
+                alignas(64) std::atomic<size_t> m_tail;
+
+                static size_t roundUp(size_t n) {
+                    size_t capacity = 1;
+                    while(capacity < n) capacity *= 2;
+                    return capacity;
+                }
+
+            public:
+                htsSPSCQueue(size_t capacity): m_ring(roundUp(capacity)), m_mask(m_ring.size() - 1), m_head(0), m_tail(0) {}
+
+                htsSPSCQueue(const htsSPSCQueue&) = delete;
+                htsSPSCQueue& operator=(const htsSPSCQueue&) = delete;
+
+                // producer side. returns false if the queue is full
+                bool push(T value) {
+                    auto tail = m_tail.load(std::memory_order_relaxed);
+                    if(tail - m_head.load(std::memory_order_acquire) == m_ring.size()) return false;
+                    m_ring[tail & m_mask] = std::move(value);
+                    m_tail.store(tail + 1, std::memory_order_release);
+                    return true;
+                }
+
+                // consumer side. returns false if the queue is empty
+                bool pop(T& value) {
+                    auto head = m_head.load(std::memory_order_relaxed);
+                    if(head == m_tail.load(std::memory_order_acquire)) return false;
+                    value = std::move(m_ring[head & m_mask]);
+                    m_head.store(head + 1, std::memory_order_release);
+                    return true;
+                }
+
+                size_t capacity() const { return m_ring.size(); }
+        };
+
+        template<class RecT> class htsAsyncReader {
+            public:
+                using batch_t = htsBatch<RecT>;
+                using value_type = typename std::remove_reference<decltype(*std::declval<batch_t&>().begin())>::type;
+
+            protected:
+                std::vector<std::unique_ptr<batch_t>> m_batches;
+                htsSPSCQueue<batch_t *> m_full;
+                htsSPSCQueue<batch_t *> m_empty;
+                std::atomic<bool> m_stop;
+                std::atomic<bool> m_done;
+                std::atomic<bool> m_failed;
+                std::thread m_producer;
+
+                // spin briefly, then back off with growing sleeps, which
+                // suits the millisecond waits of a slow filesystem
+                template<class F> bool wait(F&& ready) {
+                    for(unsigned spins = 0; !ready(); spins++) {
+                        if(m_stop.load(std::memory_order_relaxed)) return false;
+                        if(spins < 64) continue;
+                        if(spins < 128) std::this_thread::yield();
+                        else std::this_thread::sleep_for(std::chrono::microseconds(std::min(1000u, spins - 127)));
+                    }
+                    return true;
+                }
+
+                template<class FillF> void produce(FillF fill) {
+                    batch_t * b = nullptr;
+                    while(wait([&]() { return m_empty.pop(b); })) {
+                        auto n = fill(*b);
+                        if(n < 0) m_failed.store(true, std::memory_order_relaxed);
+                        m_full.push(b);
+                        if(n <= 0) break;
+                    }
+                    m_done.store(true, std::memory_order_release);
+                }
+
+            public:
+                // fill(batch) refills a batch and returns the number of
+                // records read, 0 at the end of the input and -1 on a read
+                // error, keeping the records read before it. depth batches of
+                // batchSize records each are read ahead
+                template<class FillF>
+                htsAsyncReader(FillF&& fill, size_t batchSize = 1024, size_t depth = 4):
+                    m_full(depth + 1), m_empty(depth + 1), m_stop(false), m_done(false), m_failed(false) {
+
+                    for(size_t i = 0; i < depth + 1; i++) {
+                        m_batches.emplace_back(new batch_t(batchSize));
+                        m_empty.push(m_batches.back().get());
+                    }
+                    m_producer = std::thread(&htsAsyncReader::produce<typename std::decay<FillF>::type>, this, std::forward<FillF>(fill));
+                }
+
+                // read the whole file sequentially
+                template<class HeaderT>
+                htsAsyncReader(htsFile& fp, const HeaderT& hdr, size_t batchSize = 1024, size_t depth = 4):
+                    htsAsyncReader([&fp, &hdr](batch_t& b) { return b.fill(fp, hdr); }, batchSize, depth) {}
+
+                // read through an index iterator
+                htsAsyncReader(htsFile& fp, htsIterator& iter, size_t batchSize = 1024, size_t depth = 4):
+                    htsAsyncReader([&fp, &iter](batch_t& b) { return b.fill(fp, iter); }, batchSize, depth) {}
+
+                htsAsyncReader(const htsAsyncReader&) = delete;
+                htsAsyncReader& operator=(const htsAsyncReader&) = delete;
+
+                // stops the producer, also when the input was not read to the end
+                ~htsAsyncReader() {
+                    m_stop = true;
+                    if(m_producer.joinable()) m_producer.join();
+                }
+
+                // take the next full batch, which is empty at the end of the
+                // input, or null once the end has been taken. every batch
+                // taken has to be given back with recycle
+                batch_t * next() {
+                    batch_t * b = nullptr;
+                    wait([&]() {
+                        if(m_full.pop(b)) return true;
+                        // the producer pushes its last batch before the
+                        // flag is set, so look once more after seeing it
+                        if(!m_done.load(std::memory_order_acquire)) return false;
+                        m_full.pop(b);
+                        return true;
+                    });
+                    return b;
+                }
+
+                void recycle(batch_t * b) { m_empty.push(b); }
+
+                // -1 if the input ended on a read error, 0 otherwise. only
+                // meaningful once next() has returned null
+                int status() const { return m_failed.load(std::memory_order_acquire) ? -1 : 0; }
+
+                // --- RANGE EXPRESSION --- //
+
+                // A single pass input iterator over the records of every
+                // batch. A record stays valid until the iterator moves past
+                // the end of its batch
+                struct iterator : public std::iterator<std::input_iterator_tag, value_type> {
+                    protected:
+                        htsAsyncReader * m_reader;
+                        batch_t * m_batch;
+                        size_t m_index;
+
+                        void load() {
+                            m_index = 0;
+                            m_batch = m_reader->next();
+                            if(m_batch != nullptr && m_batch->empty()) {
+                                m_reader->recycle(m_batch);
+                                m_batch = nullptr;
+                            }
+                        }
+
+                    public:
+                        iterator(htsAsyncReader * reader): m_reader(reader), m_batch(nullptr), m_index(0) { if(m_reader) load(); }
+
+                        value_type& operator*() { return (*m_batch)[m_index]; }
+                        value_type * operator->() { return &(*m_batch)[m_index]; }
+
+                        iterator& operator++() {
+                            if(m_batch != nullptr && ++m_index == m_batch->size()) {
+                                m_reader->recycle(m_batch);
+                                load();
+                            }
+                            return *this;
+                        }
+
+                        bool operator==(const iterator& rhs) const { return m_batch == rhs.m_batch; }
+                        bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
+                };
+
+                iterator begin() { return iterator(this); }
+                iterator end()   { return iterator(nullptr); }
+        };
+    }
+}
+
+#endif
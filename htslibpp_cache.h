@@ -0,0 +1,354 @@
+// YiCppLib::HTSLibpp::Cache
+//
+// This file contains a process-wide cache of headers, indexes and open file
+// handles, for services that run many small region queries against the
+// same few files
+
+#include "htslibpp.h"
+#include "htslibpp_alignment.h"
+#include "htslibpp_variant.h"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_CACHE
+#define YICPPLIB_HTSLIBPP_CACHE
+
+// A file is loaded into the cache the first time it is asked for, which
+// reads its header and index once. Every later request for the same path
+// gets a lease on the cached entry: the shared header and index, plus an
+// open htsFile that is taken from the entry's pool of idle handles, or
+// opened if the pool is empty. The handle goes back into the pool when the
+// lease is destroyed.
+//
+// Entries are keyed by path, and are reloaded when the file changes on
+// disk: when its modification time, to the nanosecond, its size or its
+// inode differs from when it was loaded. They are evicted least recently used
+// first once the estimated memory of all entries goes over the cap. An
+// evicted entry stays alive until its last lease is gone.
+//
+// Region strings are cached per entry as well. The first query of a region
+// parses it and looks its contig up in the header, and later queries of
+// the same string go straight to the index with the resolved tid, begin
+// and end. The internals of hts_itr_t differ between htslib versions, so
+// iterators themselves are never copied. Leased handles are positioned
+// wherever the previous lease left them, so they are meant for index
+// queries rather than for reading a file from the start.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        // how the cache loads and queries each kind of file
+        template<class HeaderT> struct htsCacheTraits;
+
+        template<> struct htsCacheTraits<bamHeader> {
+            static const char * tag() { return "bam:"; }
+
+            // bam_name2id builds the name lookup table of the header the
+            // first time it is called. do it now, while the header is not
+            // yet shared between threads
+            static bamHeader header(htsFile& fp) {
+                auto hdr = htsHeader<bamHeader>::read(fp);
+                if(hdr.get() != nullptr && hdr->n_targets > 0) bam_name2id(hdr.get(), hdr->target_name[0]);
+                return hdr;
+            }
+
+            static htsIndex index(const std::string& filename, const std::string& indexFilename) {
+                if(indexFilename.empty()) return htsIndex{hts_idx_load(filename.c_str(), HTS_FMT_BAI)};
+                return htsIndexOpen(filename, indexFilename);
+            }
+
+            // the names hts_idx_load looks for next to the file, in order
+            static std::vector<std::string> indexNames(const std::string& filename) { return {filename + ".csi", filename + ".bai"}; }
+
+            static int tid(const bamHeader& hdr, const char * name) { return bam_name2id(hdr.get(), name); }
+
+            static hts_itr_t * query(const htsIndex& idx, const htsRegion& r) {
+                return sam_itr_queryi(idx.get(), r.tid, r.beg, r.end);
+            }
+
+            static size_t headerBytes(const bamHeader& hdr) {
+                return sizeof(bam_hdr_t) + hdr->l_text + hdr->n_targets * (sizeof(char *) + sizeof(uint32_t) + 32);
+            }
+        };
+
+        // only BCF files are cached, as bgzipped VCF files are queried
+        // through a tabix index and a different record source
+        template<> struct htsCacheTraits<bcfHeader> {
+            static const char * tag() { return "bcf:"; }
+
+            static bcfHeader header(htsFile& fp) { return htsHeader<bcfHeader>::read(fp); }
+
+            static htsIndex index(const std::string& filename, const std::string& indexFilename) {
+                if(indexFilename.empty()) return bcfIndexOpen(filename);
+                return htsIndexOpen(filename, indexFilename);
+            }
+
+            static std::vector<std::string> indexNames(const std::string& filename) { return {filename + ".csi"}; }
+
+            static int tid(const bcfHeader& hdr, const char * name) { return bcf_hdr_name2id(hdr.get(), name); }
+
+            static hts_itr_t * query(const htsIndex& idx, const htsRegion& r) {
+                return bcf_itr_queryi(idx.get(), r.tid, r.beg, r.end);
+            }
+
+            static size_t headerBytes(const bcfHeader& hdr) {
+                return sizeof(bcf_hdr_t) + hdr->nhrec * 256 + hdr->n[BCF_DT_SAMPLE] * 32;
+            }
+        };
+
+        class htsCache {
+            public:
+                // rough cost of an idle handle: the BGZF block buffers and
+                // the hFILE read buffer
+                static const size_t handleBytes = 192 << 10;
+
+            protected:
+                struct entry {
+                    virtual ~entry() {}
+                    virtual size_t bytes() const = 0;
+                };
+
+                template<class HeaderT> struct file_entry : public entry {
+                    using traits = htsCacheTraits<HeaderT>;
+
+                    const std::string filename;
+                    const struct stat st;
+                    const size_t maxHandles;
+                    HeaderT hdr;
+                    htsIndex idx;
+                    size_t fixedBytes;
+
+                    mutable std::mutex lock;
+                    std::vector<htsFile> handles;
+                    std::unordered_map<std::string, htsRegion> regions;
+                    size_t regionBytes;
+
+                    file_entry(const std::string& filename, const struct stat& st, size_t maxHandles):
+                        filename(filename), st(st), maxHandles(maxHandles),
+                        hdr(nullptr), idx(nullptr), fixedBytes(0), regionBytes(0) {}
+
+                    size_t bytes() const override {
+                        std::lock_guard<std::mutex> guard(lock);
+                        return fixedBytes + handles.size() * handleBytes + regionBytes;
+                    }
+
+                    // whether the file on disk is still the one that was loaded
+                    bool current(const struct stat& now) const {
+                        return st.st_ino == now.st_ino && st.st_dev == now.st_dev && st.st_size == now.st_size &&
+                            st.st_mtim.tv_sec == now.st_mtim.tv_sec && st.st_mtim.tv_nsec == now.st_mtim.tv_nsec;
+                    }
+
+                    // parse a region string the way sam_itr_querys does,
+                    // "." being the whole file and "*" the unplaced reads.
+                    // a contig that is not in the header gives a tid of -1
+                    htsRegion resolve(const std::string& region) const {
+                        if(region == ".") return htsRegion{HTS_IDX_START, 0, 0};
+                        if(region == "*") return htsRegion{HTS_IDX_NOCOOR, 0, 0};
+
+                        int beg = 0, end = 0;
+                        const char * name_end = hts_parse_reg(region.c_str(), &beg, &end);
+                        if(name_end == nullptr) return htsRegion{-1, 0, 0};
+
+                        std::string name(region.c_str(), name_end);
+                        return htsRegion{traits::tid(hdr, name.c_str()), beg, end};
+                    }
+
+                    htsFile take() {
+                        {
+                            std::lock_guard<std::mutex> guard(lock);
+                            if(!handles.empty()) {
+                                auto fp = std::move(handles.back());
+                                handles.pop_back();
+                                return fp;
+                            }
+                        }
+                        return htsOpen(filename, "r");
+                    }
+
+                    void give(htsFile&& fp) {
+                        std::lock_guard<std::mutex> guard(lock);
+                        if(handles.size() < maxHandles) handles.push_back(std::move(fp));
+                    }
+
+                    htsIterator query(const std::string& region) {
+                        htsRegion r;
+                        {
+                            std::lock_guard<std::mutex> guard(lock);
+                            auto found = regions.find(region);
+                            if(found == regions.end()) {
+                                r = resolve(region);
+                                if(r.tid == -1) return htsIterator{nullptr};
+
+                                regionBytes += region.size() + sizeof(htsRegion) + 2 * sizeof(void *);
+                                found = regions.emplace(region, r).first;
+                            }
+                            r = found->second;
+                        }
+
+                        // the index is only read from here on, which htslib
+                        // allows from any number of threads
+                        return htsIterator{traits::query(idx, r)};
+                    }
+                };
+
+                struct slot {
+                    std::shared_ptr<entry> value;
+                    std::list<std::string>::iterator recency;
+                };
+
+                size_t m_memoryCap;
+                size_t m_maxHandles;
+                mutable std::mutex m_lock;
+                std::unordered_map<std::string, slot> m_entries;
+                std::list<std::string> m_recency;
+
+                // called with m_lock held
+                void evict() {
+                    size_t total = 0;
+                    for(const auto& e : m_entries) total += e.second.value->bytes();
+
+                    while(total > m_memoryCap && m_recency.size() > 1) {
+                        auto found = m_entries.find(m_recency.back());
+                        total -= found->second.value->bytes();
+                        m_entries.erase(found);
+                        m_recency.pop_back();
+                    }
+                }
+
+                template<class HeaderT>
+                std::shared_ptr<file_entry<HeaderT>> lookup(const std::string& key, const struct stat& st) {
+                    auto found = m_entries.find(key);
+                    if(found == m_entries.end()) return nullptr;
+
+                    auto e = std::static_pointer_cast<file_entry<HeaderT>>(found->second.value);
+                    if(!e->current(st)) return nullptr;
+
+                    m_recency.splice(m_recency.begin(), m_recency, found->second.recency);
+                    return e;
+                }
+
+                template<class HeaderT>
+                std::shared_ptr<file_entry<HeaderT>> load(const std::string& filename, const std::string& indexFilename, const struct stat& st) {
+                    auto e = std::make_shared<file_entry<HeaderT>>(filename, st, m_maxHandles);
+
+                    auto fp = htsOpen(filename, "r");
+                    if(fp.get() == nullptr) return nullptr;
+                    e->hdr = htsCacheTraits<HeaderT>::header(fp);
+                    e->idx = htsCacheTraits<HeaderT>::index(filename, indexFilename);
+                    if(e->hdr.get() == nullptr || e->idx.get() == nullptr) return nullptr;
+
+                    // the index is estimated by its size on disk
+                    auto idxNames = indexFilename.empty() ? htsCacheTraits<HeaderT>::indexNames(filename) : std::vector<std::string>{indexFilename};
+                    struct stat ist;
+                    off_t idxBytes = 0;
+                    for(const auto& n : idxNames) if(stat(n.c_str(), &ist) == 0) { idxBytes = ist.st_size; break; }
+                    e->fixedBytes = htsCacheTraits<HeaderT>::headerBytes(e->hdr) + idxBytes;
+
+                    e->give(std::move(fp));
+                    return e;
+                }
+
+            public:
+                // A lease on a cached file. It is movable but not copyable,
+                // and the open handle goes back to the cache on destruction
+                template<class HeaderT> class lease {
+                    protected:
+                        std::shared_ptr<file_entry<HeaderT>> m_entry;
+                        htsFile m_fp;
+
+                    public:
+                        lease(std::shared_ptr<file_entry<HeaderT>> e): m_entry(std::move(e)), m_fp(m_entry ? m_entry->take() : htsFile{nullptr}) {}
+                        lease(lease&&) = default;
+                        lease& operator=(lease&&) = default;
+                        ~lease() { if(m_entry && m_fp.get() != nullptr) m_entry->give(std::move(m_fp)); }
+
+                        bool good() const { return m_fp.get() != nullptr; }
+
+                        htsFile& file()               { return m_fp; }
+                        const HeaderT& header() const { return m_entry->hdr; }
+                        htsIndex& index()             { return m_entry->idx; }
+
+                        // a fresh iterator over a region, resolved from the cached
+                        // region string. returns an empty iterator if the region
+                        // does not resolve
+                        htsIterator query(const std::string& region) { return m_entry->query(region); }
+                };
+
+                htsCache(size_t memoryCap = 256 << 20, size_t maxHandles = 16): m_memoryCap(memoryCap), m_maxHandles(maxHandles) {}
+
+                htsCache(const htsCache&) = delete;
+                htsCache& operator=(const htsCache&) = delete;
+
+                // the process-wide cache
+                static htsCache& instance() {
+                    static htsCache cache;
+                    return cache;
+                }
+
+                // lease a file, loading it first if it is not cached or has
+                // changed on disk. an empty indexFilename looks for the index
+                // next to the file. check good() on the returned lease
+                template<class HeaderT>
+                lease<HeaderT> acquire(const std::string& filename, const std::string& indexFilename = "") {
+                    struct stat st;
+                    if(stat(filename.c_str(), &st) != 0) return lease<HeaderT>(nullptr);
+
+                    auto key = htsCacheTraits<HeaderT>::tag() + filename;
+                    {
+                        std::lock_guard<std::mutex> guard(m_lock);
+                        auto e = lookup<HeaderT>(key, st);
+                        if(e) return lease<HeaderT>(std::move(e));
+                    }
+
+                    // load outside of the lock, so that other files can be
+                    // served meanwhile. if two threads race to load the same
+                    // file, the first one to finish wins
+                    auto loaded = load<HeaderT>(filename, indexFilename, st);
+                    if(!loaded) return lease<HeaderT>(nullptr);
+
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    auto e = lookup<HeaderT>(key, st);
+                    if(e) return lease<HeaderT>(std::move(e));
+
+                    auto found = m_entries.find(key);
+                    if(found != m_entries.end()) {
+                        m_recency.erase(found->second.recency);
+                        m_entries.erase(found);
+                    }
+
+                    m_recency.push_front(key);
+                    m_entries.emplace(key, slot{loaded, m_recency.begin()});
+                    lease<HeaderT> result(std::move(loaded));
+                    evict();
+                    return result;
+                }
+
+                size_t size() const {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    return m_entries.size();
+                }
+
+                // estimated memory held by every cached entry
+                size_t memoryUsage() const {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    size_t total = 0;
+                    for(const auto& e : m_entries) total += e.second.value->bytes();
+                    return total;
+                }
+
+                void clear() {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    m_entries.clear();
+                    m_recency.clear();
+                }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,405 @@
+// YiCppLib::HTSLibpp::Columns
+//
+// This file contains a columnar store for the core fields of alignments,
+// filled from a stream of bamRecords a chunk at a time, along with
+// selection masks and the histogram and group-by aggregations that run
+// over its columns.
+
+#include "htslibpp.h"
+#include "htslibpp_alignment.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_COLUMNS
+#define YICPPLIB_HTSLIBPP_COLUMNS
+
+// A chunk holds a fixed number of alignments as one array per field,
+// i.e. struct-of-arrays. Each array follows the Arrow buffer layout: the
+// values of a field are contiguous, start on a 64-byte boundary, and the
+// buffer is zero padded to a multiple of 64 bytes. A column can therefore
+// be handed to Arrow as the values buffer of a primitive array without
+// copying, for as long as the chunk is neither refilled nor destroyed.
+//
+//   column        type     source
+//   tid           int32    core.tid
+//   pos           int64    core.pos
+//   mapq          uint8    core.qual
+//   flag          uint16   core.flag
+//   mateTid       int32    core.mtid
+//   matePos       int64    core.mpos
+//   insertSize    int64    core.isize
+//   queryLength   int32    core.l_qseq
+//
+// Positions are 64 bits wide regardless of the htslib version, so the
+// layout does not change when htslib widens hts_pos_t.
+//
+// A mask selects rows of a chunk. It is a bitmap in Arrow order, where row
+// i is bit i % 8 of byte i / 8, stored as 64-bit words, which on a little
+// endian host is the same thing. It can be handed to Arrow as a validity
+// bitmap, or used as a filter by the aggregations below.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        // a fixed size array of trivially copyable values, 64-byte aligned
+        // and zero padded to a multiple of 64 bytes
+        template<class T> class htsAlignedArray {
+            protected:
+                T * m_data;
+                size_t m_capacity;
+
+            public:
+                static const size_t alignment = 64;
+
+                static size_t paddedBytes(size_t n) {
+                    return (n * sizeof(T) + alignment - 1) / alignment * alignment;
+                }
+
+                explicit htsAlignedArray(size_t n = 0): m_data(nullptr), m_capacity(0) {
+                    void * p = nullptr;
+                    auto bytes = paddedBytes(n);
+                    if(bytes == 0 || posix_memalign(&p, alignment, bytes) != 0) return;
+                    memset(p, 0, bytes);
+                    m_data = static_cast<T *>(p);
+                    m_capacity = bytes / sizeof(T);
+                }
+
+                htsAlignedArray(const htsAlignedArray&) = delete;
+                htsAlignedArray& operator=(const htsAlignedArray&) = delete;
+
+                htsAlignedArray(htsAlignedArray&& other): m_data(other.m_data), m_capacity(other.m_capacity) {
+                    other.m_data = nullptr;
+                    other.m_capacity = 0;
+                }
+
+                htsAlignedArray& operator=(htsAlignedArray&& other) {
+                    std::swap(m_data, other.m_data);
+                    std::swap(m_capacity, other.m_capacity);
+                    return *this;
+                }
+
+                ~htsAlignedArray() { free(m_data); }
+
+                T * data()                  { return m_data; }
+                const T * data() const      { return m_data; }
+                size_t capacity() const     { return m_capacity; }
+                T& operator[](size_t i)             { return m_data[i]; }
+                const T& operator[](size_t i) const { return m_data[i]; }
+        };
+
+        class htsColumnMask {
+            protected:
+                htsAlignedArray<uint64_t> m_words;
+                size_t m_size;
+
+                // clear the bits past the last row, so popcounts and
+                // negation never see them
+                void trim() {
+                    if(m_size % 64) m_words[m_size / 64] &= (1ULL << (m_size % 64)) - 1;
+                }
+
+            public:
+                explicit htsColumnMask(size_t size = 0): m_words((size + 63) / 64), m_size(size) {}
+
+                // set bit i for every row i in [0, size) where pred(i) holds
+                template<class PredF> static htsColumnMask build(size_t size, PredF&& pred) {
+                    htsColumnMask mask(size);
+                    for(size_t base = 0; base < size; base += 64) {
+                        uint64_t bits = 0;
+                        size_t n = std::min<size_t>(64, size - base);
+                        for(size_t b = 0; b < n; b++) bits |= static_cast<uint64_t>(pred(base + b) ? 1 : 0) << b;
+                        mask.m_words[base / 64] = bits;
+                    }
+                    return mask;
+                }
+
+                size_t size() const  { return m_size; }
+                size_t words() const { return (m_size + 63) / 64; }
+                const uint64_t * data() const { return m_words.data(); }
+                uint64_t word(size_t w) const { return m_words[w]; }
+
+                bool test(size_t i) const { return m_words[i / 64] >> (i % 64) & 1; }
+
+                // number of selected rows
+                size_t count() const {
+                    size_t total = 0;
+                    for(size_t w = 0; w < words(); w++) total += __builtin_popcountll(m_words[w]);
+                    return total;
+                }
+
+                htsColumnMask& operator&=(const htsColumnMask& other) {
+                    for(size_t w = 0; w < std::min(words(), other.words()); w++) m_words[w] &= other.m_words[w];
+                    for(size_t w = other.words(); w < words(); w++) m_words[w] = 0;
+                    return *this;
+                }
+
+                htsColumnMask& operator|=(const htsColumnMask& other) {
+                    for(size_t w = 0; w < std::min(words(), other.words()); w++) m_words[w] |= other.m_words[w];
+                    trim();
+                    return *this;
+                }
+
+                htsColumnMask& flip() {
+                    for(size_t w = 0; w < words(); w++) m_words[w] = ~m_words[w];
+                    trim();
+                    return *this;
+                }
+
+                // call f(i) for every selected row, in order
+                template<class F> void forEach(F&& f) const {
+                    for(size_t w = 0; w < words(); w++)
+                        for(uint64_t bits = m_words[w]; bits; bits &= bits - 1) f(w * 64 + __builtin_ctzll(bits));
+                }
+        };
+
+        class htsAlignmentColumns {
+            protected:
+                size_t m_capacity;
+                size_t m_size;
+
+                htsAlignedArray<int32_t> m_tid;
+                htsAlignedArray<int64_t> m_pos;
+                htsAlignedArray<uint8_t> m_mapq;
+                htsAlignedArray<uint16_t> m_flag;
+                htsAlignedArray<int32_t> m_mateTid;
+                htsAlignedArray<int64_t> m_matePos;
+                htsAlignedArray<int64_t> m_insertSize;
+                htsAlignedArray<int32_t> m_queryLength;
+
+                template<class T> htsSpan<const T> column(const htsAlignedArray<T>& a) const {
+                    return htsSpan<const T>(a.data(), m_size);
+                }
+
+            public:
+                explicit htsAlignmentColumns(size_t capacity = 65536):
+                    m_capacity(capacity), m_size(0),
+                    m_tid(capacity), m_pos(capacity), m_mapq(capacity), m_flag(capacity),
+                    m_mateTid(capacity), m_matePos(capacity), m_insertSize(capacity), m_queryLength(capacity) {}
+
+                size_t size() const     { return m_size; }
+                size_t capacity() const { return m_capacity; }
+                bool full() const       { return m_size == m_capacity; }
+                bool empty() const      { return m_size == 0; }
+
+                // rows are overwritten by the next fill. the padding past
+                // the last row is only zero until the chunk is first filled
+                void clear() { m_size = 0; }
+
+                htsSpan<const int32_t> tid() const          { return column(m_tid); }
+                htsSpan<const int64_t> pos() const          { return column(m_pos); }
+                htsSpan<const uint8_t> mapq() const         { return column(m_mapq); }
+                htsSpan<const uint16_t> flag() const        { return column(m_flag); }
+                htsSpan<const int32_t> mateTid() const      { return column(m_mateTid); }
+                htsSpan<const int64_t> matePos() const      { return column(m_matePos); }
+                htsSpan<const int64_t> insertSize() const   { return column(m_insertSize); }
+                htsSpan<const int32_t> queryLength() const  { return column(m_queryLength); }
+
+                // append the core fields of an alignment. returns false if
+                // the chunk is full
+                bool push(const bam1_t& rec) {
+                    if(full()) return false;
+
+                    auto i = m_size++;
+                    m_tid[i] = rec.core.tid;
+                    m_pos[i] = rec.core.pos;
+                    m_mapq[i] = rec.core.qual;
+                    m_flag[i] = rec.core.flag;
+                    m_mateTid[i] = rec.core.mtid;
+                    m_matePos[i] = rec.core.mpos;
+                    m_insertSize[i] = rec.core.isize;
+                    m_queryLength[i] = rec.core.l_qseq;
+                    return true;
+                }
+
+                bool push(const bamRecord& rec) { return push(*rec); }
+
+                // refill the chunk from a file, reusing rec for every read.
+                // returns the number of alignments read, 0 at the end of the
+                // file, or -1 on a read error. the alignments read before the
+                // error are kept
+                ssize_t fill(htsFile& fp, const bamHeader& hdr, bamRecord& rec) {
+                    clear();
+                    while(!full()) {
+                        auto retVal = htsReader<bamRecord>::next(fp, hdr, rec.get());
+                        if(retVal < -1) return -1;
+                        if(retVal < 0) break;
+                        push(*rec);
+                    }
+                    return m_size;
+                }
+
+                // refill the chunk from a region of an indexed file
+                ssize_t fill(htsFile& fp, htsIterator& iter, bamRecord& rec) {
+                    clear();
+                    while(!full()) {
+                        auto retVal = htsReader<bamRecord>::next(fp, iter.get(), rec.get());
+                        if(retVal < -1) return -1;
+                        if(retVal < 0) break;
+                        push(*rec);
+                    }
+                    return m_size;
+                }
+
+                // refill the chunk from a range of records, such as the
+                // ones htsReader<bamRecord>::range returns, advancing it
+                template<class IterT> size_t fill(IterT& it, const IterT& end) {
+                    clear();
+                    for(; !full() && it != end; ++it) push(*it);
+                    return m_size;
+                }
+
+                // run f(chunk) over every chunk of a range, the last one
+                // possibly partial. returns the number of alignments seen
+                template<class RangeT, class F> size_t forEachChunk(RangeT&& range, F&& f) {
+                    size_t total = 0;
+                    auto it = range.begin();
+                    auto end = range.end();
+                    while(fill(it, end) > 0) {
+                        total += m_size;
+                        f(static_cast<const htsAlignmentColumns&>(*this));
+                    }
+                    return total;
+                }
+
+                // --- SELECTION --- //
+
+                template<class PredF> htsColumnMask select(PredF&& pred) const {
+                    return htsColumnMask::build(m_size, std::forward<PredF>(pred));
+                }
+
+                // rows with all of the required flag bits and none of the
+                // excluded ones, as in samtools view -f and -F
+                htsColumnMask flagMask(uint16_t required, uint16_t excluded = 0) const {
+                    auto flag = m_flag.data();
+                    return select([=](size_t i) { return (flag[i] & required) == required && (flag[i] & excluded) == 0; });
+                }
+
+                htsColumnMask mapqMask(uint8_t minimum) const {
+                    auto mapq = m_mapq.data();
+                    return select([=](size_t i) { return mapq[i] >= minimum; });
+                }
+        };
+
+        // --- AGGREGATIONS --- //
+
+        // Both aggregations accumulate, so one instance can be fed every
+        // chunk of a file. Rows are walked either densely, or through the
+        // set bits of a mask a word at a time.
+        namespace columns {
+            template<class F> inline void forRows(size_t n, const htsColumnMask * mask, F&& f) {
+                if(mask == nullptr) for(size_t i = 0; i < n; i++) f(i);
+                else mask->forEach([&](size_t i) { if(i < n) f(i); });
+            }
+        }
+
+        // counts of values in equal width bins starting at lo. values
+        // outside the bins are clamped into the first or the last one
+        class htsColumnHistogram {
+            protected:
+                // four interleaved sets of counters, so increments of the
+                // same bin in a row do not stall on each other
+                static const size_t lanes = 4;
+
+                int64_t m_lo;
+                int64_t m_width;
+                size_t m_bins;
+                std::vector<uint64_t> m_counts;
+
+                size_t bin(int64_t v) const {
+                    auto offset = std::max<int64_t>(v - m_lo, 0);
+                    return std::min<size_t>(static_cast<size_t>(offset / m_width), m_bins - 1);
+                }
+
+            public:
+                htsColumnHistogram(int64_t lo, int64_t width, size_t bins):
+                    m_lo(lo), m_width(std::max<int64_t>(width, 1)), m_bins(std::max<size_t>(bins, 1)),
+                    m_counts(m_bins * lanes, 0) {}
+
+                size_t bins() const { return m_bins; }
+                int64_t lowerBound(size_t b) const { return m_lo + static_cast<int64_t>(b) * m_width; }
+
+                uint64_t operator[](size_t b) const {
+                    uint64_t total = 0;
+                    for(size_t l = 0; l < lanes; l++) total += m_counts[b * lanes + l];
+                    return total;
+                }
+
+                std::vector<uint64_t> counts() const {
+                    std::vector<uint64_t> result(m_bins);
+                    for(size_t b = 0; b < m_bins; b++) result[b] = (*this)[b];
+                    return result;
+                }
+
+                uint64_t total() const {
+                    uint64_t total = 0;
+                    for(auto c : m_counts) total += c;
+                    return total;
+                }
+
+                template<class T> void add(htsSpan<const T> values, const htsColumnMask * mask = nullptr) {
+                    auto counts = m_counts.data();
+                    if(mask != nullptr) {
+                        columns::forRows(values.size(), mask, [&](size_t i) { counts[bin(values[i]) * lanes]++; });
+                        return;
+                    }
+
+                    size_t i = 0, n = values.size();
+                    for(; i + lanes <= n; i += lanes)
+                        for(size_t l = 0; l < lanes; l++) counts[bin(values[i + l]) * lanes + l]++;
+                    for(; i < n; i++) counts[bin(values[i]) * lanes]++;
+                }
+
+                template<class T> void add(htsSpan<const T> values, const htsColumnMask& mask) { add(values, &mask); }
+        };
+
+        // count, sum, minimum and maximum of a value column grouped by a
+        // key column whose keys are small non-negative integers, such as
+        // tid, mapq or flag. rows with keys outside [0, groups) are skipped,
+        // which drops unmapped reads when grouping by tid
+        class htsColumnGroupBy {
+            public:
+                struct group {
+                    uint64_t count;
+                    int64_t sum;
+                    int64_t min;
+                    int64_t max;
+
+                    double mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+                };
+
+            protected:
+                std::vector<group> m_groups;
+
+            public:
+                explicit htsColumnGroupBy(size_t groups): m_groups(groups, group{0, 0, INT64_MAX, INT64_MIN}) {}
+
+                size_t groups() const { return m_groups.size(); }
+                const group& operator[](size_t k) const { return m_groups[k]; }
+
+                template<class K, class V>
+                void add(htsSpan<const K> keys, htsSpan<const V> values, const htsColumnMask * mask = nullptr) {
+                    auto groups = m_groups.data();
+                    auto n = std::min(keys.size(), values.size());
+                    auto size = static_cast<int64_t>(m_groups.size());
+                    columns::forRows(n, mask, [&](size_t i) {
+                        auto k = static_cast<int64_t>(keys[i]);
+                        if(k < 0 || k >= size) return;
+                        auto v = static_cast<int64_t>(values[i]);
+                        auto& g = groups[k];
+                        g.count++;
+                        g.sum += v;
+                        g.min = std::min(g.min, v);
+                        g.max = std::max(g.max, v);
+                    });
+                }
+
+                template<class K, class V>
+                void add(htsSpan<const K> keys, htsSpan<const V> values, const htsColumnMask& mask) { add(keys, values, &mask); }
+        };
+    }
+}
+
+#endif
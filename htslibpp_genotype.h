@@ -0,0 +1,205 @@
+// YiCppLib::HTSLibpp::Genotype
+//
+// This file contains a columnar genotype store that is filled from a
+// stream of bcfRecords, for cohort analyses that look at the GT field of
+// every sample at every site.
+
+#include "htslibpp.h"
+#include "htslibpp_variant.h"
+#include <stdint.h>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_GENOTYPE
+#define YICPPLIB_HTSLIBPP_GENOTYPE
+
+// Each genotype is reduced to the number of non-reference alleles it
+// carries, which is packed into 2 bits per sample
+//   * 00, missing (also used to pad the last word of a variant)
+//   * 01, no non-reference allele,  e.g. 0/0
+//   * 10, one non-reference allele, e.g. 0/1
+//   * 11, two non-reference alleles, e.g. 1/1 or 1/2
+//
+// Only diploid genotypes fit these codes. A variant with a called sample of
+// any other ploidy, such as a haploid call on chrX, is not stored, so that
+// every allele frequency is taken over two alleles per called sample.
+//
+// A block holds a fixed number of variants. The genotypes of one variant
+// are stored contiguously as 64-bit words holding 32 samples each, so the
+// per-variant reductions work a word at a time with popcounts instead of a
+// sample at a time.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        struct htsGenotypeBlock {
+            enum Code : uint8_t { MISSING = 0, HOM_REF = 1, HET = 2, HOM_ALT = 3 };
+
+            protected:
+                static const uint64_t lowBits = 0x5555555555555555ULL;
+
+                size_t m_samples;
+                size_t m_words;
+                size_t m_capacity;
+                size_t m_size;
+                size_t m_skipped;
+                std::vector<uint64_t> m_data;
+                std::vector<int32_t> m_chrID;
+                std::vector<int32_t> m_pos;
+
+                static inline size_t popcount(uint64_t w) { return __builtin_popcountll(w); }
+
+                template<class F> size_t countWords(size_t v, F&& f) const {
+                    size_t total = 0;
+                    for(auto w = variant(v), e = w + m_words; w != e; ++w) total += f(*w & lowBits, (*w >> 1) & lowBits);
+                    return total;
+                }
+
+                // reduce a genotype, ploidy values wide, to a 2-bit code.
+                // returns -1 if the sample is called but not diploid
+                static inline int encode(const int32_t * gt, int ploidy) {
+                    int values = 0, dosage = 0;
+                    bool missing = false;
+                    for(; values < ploidy && gt[values] != bcf_int32_vector_end; values++) {
+                        if(gt[values] == bcf_int32_missing || bcf_gt_is_missing(gt[values])) missing = true;
+                        else if(bcf_gt_allele(gt[values]) > 0) dosage++;
+                    }
+                    if(missing || values == 0) return MISSING;
+                    return values == 2 ? dosage + 1 : -1;
+                }
+
+            public:
+                htsGenotypeBlock(size_t samples, size_t capacity = 4096):
+                    m_samples(samples), m_words((samples + 31) / 32), m_capacity(capacity), m_size(0), m_skipped(0),
+                    m_data(m_words * capacity) {
+                    m_chrID.reserve(capacity);
+                    m_pos.reserve(capacity);
+                }
+
+                // size a block for the samples of a header, after any
+                // subsetting done with htsHeader<bcfHeader>::setSamples
+                static auto forHeader(bcfHeader& hdr, size_t capacity = 4096) {
+                    auto dict = htsHeader<bcfHeader>::DictType::SAMPLE;
+                    size_t samples = htsHeader<bcfHeader>::dictEnd(hdr, dict) - htsHeader<bcfHeader>::dictBegin(hdr, dict);
+                    return htsGenotypeBlock(samples, capacity);
+                }
+
+                size_t samples() const  { return m_samples; }
+                size_t size() const     { return m_size; }
+                size_t capacity() const { return m_capacity; }
+                bool full() const       { return m_size == m_capacity; }
+                bool empty() const      { return m_size == 0; }
+
+                // variants that fill read but did not store, because they
+                // were not diploid
+                size_t skipped() const  { return m_skipped; }
+                size_t wordsPerVariant() const { return m_words; }
+
+                void clear() {
+                    std::fill(m_data.begin(), m_data.begin() + m_size * m_words, 0);
+                    m_chrID.clear();
+                    m_pos.clear();
+                    m_size = 0;
+                    m_skipped = 0;
+                }
+
+                // the packed genotypes of variant v, and where it sits
+                const uint64_t * variant(size_t v) const { return m_data.data() + v * m_words; }
+                int32_t chrID(size_t v) const { return m_chrID[v]; }
+                int32_t pos(size_t v) const   { return m_pos[v]; }
+
+                Code at(size_t v, size_t sample) const {
+                    return static_cast<Code>(variant(v)[sample / 32] >> ((sample % 32) * 2) & 3);
+                }
+
+                // append a variant from its GT values, which hold ploidy
+                // values per sample. returns false if the block is full, or
+                // if a called sample is not diploid
+                bool push(int32_t chrID, int32_t pos, const int32_t * gt, int ploidy) {
+                    if(full()) return false;
+
+                    uint64_t * words = m_data.data() + m_size * m_words;
+                    for(size_t s = 0; s < m_samples; s++) {
+                        auto code = encode(gt + s * ploidy, ploidy);
+                        if(code < 0) {
+                            std::fill(words, words + m_words, 0);
+                            return false;
+                        }
+                        words[s / 32] |= static_cast<uint64_t>(code) << ((s % 32) * 2);
+                    }
+
+                    m_chrID.push_back(chrID);
+                    m_pos.push_back(pos);
+                    m_size++;
+                    return true;
+                }
+
+                // append a variant from a record, gtID being the tag id of GT.
+                // records without GT are stored with every sample missing.
+                // returns false if the block is full or the record is not diploid
+                bool push(const bcf1_t& rec, int gtID) {
+                    if(full()) return false;
+
+                    auto proxy = htsProxy(rec);
+                    auto gt = proxy.formatInt(gtID);
+                    auto ploidy = proxy.valuesPerSample(gtID);
+                    if(gt.size() < m_samples * ploidy || ploidy == 0) {
+                        m_chrID.push_back(rec.rid);
+                        m_pos.push_back(rec.pos);
+                        m_size++;
+                        return true;
+                    }
+                    return push(rec.rid, rec.pos, gt.data(), ploidy);
+                }
+
+                // refill the block from a file, reusing rec for every read.
+                // returns the number of variants stored, 0 at the end of the
+                // file, or -1 on a read error. the variants read before the
+                // error are kept. variants that are not diploid are counted
+                // by skipped() instead of being stored
+                ssize_t fill(htsFile& fp, const bcfHeader& hdr, bcfRecord& rec) {
+                    clear();
+                    auto gtID = htsHeader<bcfHeader>::tagID(hdr, "GT");
+                    while(!full()) {
+                        auto retVal = htsReader<bcfRecord>::next(fp, hdr, rec.get());
+                        if(retVal < -1) return -1;
+                        if(retVal < 0) break;
+                        if(!push(*rec, gtID)) m_skipped++;
+                    }
+                    return m_size;
+                }
+
+                // --- PER-VARIANT REDUCTIONS --- //
+
+                // number of samples with a called genotype
+                size_t calledCount(size_t v) const {
+                    return countWords(v, [](uint64_t lo, uint64_t hi) { return popcount(lo | hi); });
+                }
+
+                // number of non-reference alleles over called samples
+                size_t alleleCount(size_t v) const {
+                    return countWords(v, [](uint64_t lo, uint64_t hi) { return popcount(hi) + popcount(lo & hi); });
+                }
+
+                // number of samples carrying exactly one non-reference allele
+                size_t hetCount(size_t v) const {
+                    return countWords(v, [](uint64_t lo, uint64_t hi) { return popcount(hi & ~lo); });
+                }
+
+                double callRate(size_t v) const {
+                    return m_samples ? static_cast<double>(calledCount(v)) / m_samples : 0.0;
+                }
+
+                double heterozygosity(size_t v) const {
+                    auto called = calledCount(v);
+                    return called ? static_cast<double>(hetCount(v)) / called : 0.0;
+                }
+
+                // non-reference allele frequency over called alleles
+                double alleleFrequency(size_t v) const {
+                    auto called = calledCount(v);
+                    return called ? static_cast<double>(alleleCount(v)) / (2 * called) : 0.0;
+                }
+        };
+    }
+}
+
+#endif
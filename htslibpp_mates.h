@@ -0,0 +1,307 @@
+// YiCppLib::HTSLibpp::Mates
+//
+// This file contains a streaming mate-pairing stage, which joins the two
+// reads of a pair as a coordinate sorted BAM stream goes by
+
+#include "htslibpp.h"
+#include "htslibpp_alignment.h"
+#include "htslibpp_parallel.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_MATES
+#define YICPPLIB_HTSLIBPP_MATES
+
+// Only primary reads of paired fragments take part; secondary and
+// supplementary alignments and unpaired reads are ignored.
+//
+// The first read of a pair to come by is copied into a pooled record and
+// kept in a hash table, keyed by a view of its own query name, until its
+// mate arrives. The pair is then handed to the pair callback in stream
+// order, and the copy goes back to the pool.
+//
+// A read whose mate position is already behind the stream, but whose mate
+// is not pending, is an orphan: its mate was dropped upstream or lies
+// outside the region being read. Pending reads whose mate position falls
+// behind the stream are swept out as orphans whenever the stream moves on
+// to another reference, and when the table is over its cap.
+//
+// Memory is bounded by spilling. When the table still holds more than
+// maxPending reads after a sweep, every pending read is written out to one
+// of a number of temporary BAM files, partitioned by a hash of the query
+// name. From then on a read whose mate should have been seen, but is not
+// pending, is spilled as well, since its mate may be on disk. finish()
+// joins each partition in memory, one at a time, so pairs that went
+// through the spill are emitted after the in-stream ones and out of stream
+// order.
+//
+// If a partition cannot be created or written, spilling stops for good:
+// the read is handed over as an orphan, as is every read that would have
+// been spilled after it, and push() and finish() return -1 from then on.
+// A partition that cannot be read back in finish() fails the same way.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        class htsMatePairer {
+            protected:
+                using recordPool = htsRecordPool<bamRecord>;
+
+                const bamHeader& m_hdr;
+                size_t m_maxPending;
+                std::string m_spillPrefix;
+                std::vector<htsFile> m_spill;
+                bool m_spilled;
+                int m_status;
+
+                std::unordered_map<htsStringView, bamPooledRecord> m_pending;
+                int32_t m_tid;
+
+                static htsStringView name(const bam1_t& rec) {
+                    return htsStringView(bam_get_qname(&rec), rec.core.l_qname > 0 ? strnlen(bam_get_qname(&rec), rec.core.l_qname) : 0);
+                }
+
+                // positions in stream order, where unmapped reads without a
+                // position come last
+                static int64_t position(int32_t tid, int32_t pos) {
+                    return (static_cast<int64_t>(tid < 0 ? INT32_MAX : tid) << 32) | static_cast<uint32_t>(pos < 0 ? 0 : pos);
+                }
+                static int64_t position(const bam1_t& rec) { return position(rec.core.tid, rec.core.pos); }
+                static int64_t matePosition(const bam1_t& rec) { return position(rec.core.mtid, rec.core.mpos); }
+
+                static bool eligible(const bam1_t& rec) {
+                    return (rec.core.flag & BAM_FPAIRED) && !(rec.core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY));
+                }
+
+                // write a read to its partition, or hand it over as an
+                // orphan once spilling has failed
+                template<class OrphanF> void spill(const bam1_t& rec, OrphanF& onOrphan) {
+                    if(m_status == 0 && !m_spill.empty()) {
+                        auto part = std::hash<htsStringView>()(name(rec)) % m_spill.size();
+                        auto& fp = m_spill[part];
+                        if(fp.get() == nullptr) {
+                            fp = htsWriter<bamRecord>::open(partition(part), htsOutputFormat::BAM, 1);
+                            if(fp.get() != nullptr && htsWriter<bamRecord>::writeHeader(fp, m_hdr) < 0) {
+                                fp.reset();
+                                unlink(partition(part).c_str());
+                            }
+                        }
+                        if(fp.get() != nullptr && htsWriter<bamRecord>::write(fp, m_hdr, rec) >= 0) {
+                            m_spilled = true;
+                            return;
+                        }
+                        m_status = -1;
+                    }
+                    onOrphan(rec);
+                }
+
+                std::string partition(size_t part) const { return m_spillPrefix + std::to_string(part) + ".bam"; }
+
+                // drop pending reads whose mate can no longer come by
+                template<class OrphanF> void sweep(int64_t current, OrphanF& onOrphan) {
+                    for(auto it = m_pending.begin(); it != m_pending.end(); ) {
+                        if(matePosition(*it->second) < current) {
+                            if(m_spilled) spill(*it->second, onOrphan);
+                            else onOrphan(static_cast<const bam1_t&>(*it->second));
+                            it = m_pending.erase(it);
+                        }
+                        else ++it;
+                    }
+                }
+
+                template<class OrphanF> void spillPending(OrphanF& onOrphan) {
+                    for(auto& p : m_pending) spill(*p.second, onOrphan);
+                    m_pending.clear();
+                }
+
+            public:
+                static const size_t defaultMaxPending = 1 << 20;
+
+                // spill files are named after spillPrefix, which defaults to
+                // a name in $TMPDIR. a partition count of 0 disables
+                // spilling, in which case maxPending is not enforced
+                htsMatePairer(const bamHeader& hdr, size_t maxPending = defaultMaxPending, size_t partitions = 64, const std::string& spillPrefix = ""):
+                    m_hdr(hdr), m_maxPending(maxPending), m_spillPrefix(spillPrefix.empty() ? htsTempPrefix("mates", this) : spillPrefix),
+                    m_spill(partitions), m_spilled(false), m_status(0), m_tid(-1) {}
+
+                htsMatePairer(const htsMatePairer&) = delete;
+                htsMatePairer& operator=(const htsMatePairer&) = delete;
+
+                ~htsMatePairer() {
+                    for(size_t i = 0; i < m_spill.size(); i++) {
+                        if(m_spill[i].get() == nullptr) continue;
+                        m_spill[i].reset();
+                        unlink(partition(i).c_str());
+                    }
+                }
+
+                size_t pending() const { return m_pending.size(); }
+                bool spilled() const { return m_spilled; }
+
+                // 0, or -1 once the spill has failed
+                int status() const { return m_status; }
+
+                // add the next record of a coordinate sorted stream.
+                // onPair(first, second) receives the two reads of a pair in
+                // stream order, onOrphan(read) a read whose mate is missing.
+                // returns status()
+                template<class PairF, class OrphanF>
+                int push(const bam1_t& rec, PairF&& onPair, OrphanF&& onOrphan) {
+                    if(!eligible(rec)) return m_status;
+
+                    auto current = position(rec);
+                    if(rec.core.tid != m_tid) {
+                        sweep(current, onOrphan);
+                        m_tid = rec.core.tid;
+                    }
+
+                    auto found = m_pending.find(name(rec));
+                    if(found != m_pending.end()) {
+                        auto mate = std::move(found->second);
+                        m_pending.erase(found);
+                        onPair(static_cast<const bam1_t&>(*mate), rec);
+                        return m_status;
+                    }
+
+                    // the mate should have come by already
+                    if(matePosition(rec) < current) {
+                        if(m_spilled) spill(rec, onOrphan);
+                        else onOrphan(rec);
+                        return m_status;
+                    }
+
+                    auto copy = recordPool::dup(rec);
+                    auto key = name(*copy);
+                    m_pending.emplace(key, std::move(copy));
+
+                    if(m_pending.size() > m_maxPending && !m_spill.empty() && m_status == 0) {
+                        sweep(current, onOrphan);
+                        if(m_pending.size() > m_maxPending / 2) spillPending(onOrphan);
+                    }
+                    return m_status;
+                }
+
+                template<class PairF, class OrphanF>
+                int push(const bamRecord& rec, PairF&& onPair, OrphanF&& onOrphan) {
+                    return push(*rec, std::forward<PairF>(onPair), std::forward<OrphanF>(onOrphan));
+                }
+
+                // the end of the stream. every read still pending is an
+                // orphan, unless spilling has started, in which case the
+                // spill partitions are joined one by one. returns status()
+                template<class PairF, class OrphanF>
+                int finish(PairF&& onPair, OrphanF&& onOrphan) {
+                    if(!m_spilled) {
+                        for(auto& p : m_pending) onOrphan(static_cast<const bam1_t&>(*p.second));
+                        m_pending.clear();
+                        return m_status;
+                    }
+
+                    spillPending(onOrphan);
+                    for(size_t i = 0; i < m_spill.size(); i++) {
+                        if(m_spill[i].get() == nullptr) continue;
+                        if(hts_close(m_spill[i].release()) < 0) m_status = -1;
+
+                        auto fp = htsOpen(partition(i), "r");
+                        auto hdr = fp.get() != nullptr ? htsHeader<bamHeader>::read(fp) : bamHeader{nullptr};
+                        if(hdr.get() == nullptr) {
+                            m_status = -1;
+                            unlink(partition(i).c_str());
+                            continue;
+                        }
+
+                        std::unordered_map<htsStringView, bamPooledRecord> reads;
+                        for(auto rec = recordPool::read(fp, hdr); rec; rec = recordPool::read(fp, hdr)) {
+                            auto found = reads.find(name(*rec));
+                            if(found == reads.end()) {
+                                auto key = name(*rec);
+                                reads.emplace(key, std::move(rec));
+                                continue;
+                            }
+
+                            auto mate = std::move(found->second);
+                            reads.erase(found);
+                            if(position(*rec) < position(*mate)) std::swap(rec, mate);
+                            onPair(static_cast<const bam1_t&>(*mate), static_cast<const bam1_t&>(*rec));
+                        }
+                        for(auto& r : reads) onOrphan(static_cast<const bam1_t&>(*r.second));
+
+                        unlink(partition(i).c_str());
+                    }
+                    m_spilled = false;
+                    return m_status;
+                }
+
+                // --- SHARDED PAIRING --- //
+
+                // Pair the reads of every shard in parallel, and fold the
+                // pairs into a per-shard accumulator with map(acc, first,
+                // second). Pairs that cross a shard boundary turn up as
+                // orphans in both shards; they are collected and paired in
+                // a final serial pass, which maps them into the merged
+                // result. Each record is visited by a single shard.
+                //
+                // Like htsParallel<bamRecord>::reduce, the result is stored
+                // in acc, which also provides the starting value. Returns 0,
+                // or -1 if a shard could not be opened, queried or read;
+                // acc is left untouched then
+                template<class AccT, class MapF, class MergeF>
+                static int reduce(const std::string& filename, const std::string& indexFilename,
+                        const std::vector<htsRegion>& shards, size_t nThreads, AccT& acc, MapF&& map, MergeF&& merge,
+                        htsThreadPool * pool = nullptr) {
+
+                    using parallel = htsParallel<bamRecord>;
+                    std::vector<AccT> partials(shards.size(), acc);
+                    std::vector<std::vector<bamPooledRecord>> orphans(shards.size());
+                    std::atomic<bool> ok{true};
+
+                    bool opened = parallel::forEachShard(filename, indexFilename, shards, nThreads, [&](size_t i, const htsRegion& shard, parallel::worker& w) {
+                        htsIterator iter{sam_itr_queryi(w.idx.get(), shard.tid, shard.beg, shard.end)};
+                        if(iter.get() == nullptr) { ok = false; return; }
+
+                        auto& partial = partials[i];
+                        auto onPair = [&](const bam1_t& first, const bam1_t& second) { map(partial, first, second); };
+                        auto onOrphan = [&](const bam1_t& rec) { orphans[i].push_back(recordPool::dup(rec)); };
+
+                        htsMatePairer pairer(w.hdr, defaultMaxPending, 0);
+                        int retVal;
+                        while((retVal = htsReader<bamRecord>::next(w.fp, iter.get(), w.rec.get())) >= 0)
+                            if(parallel::owns(shards, i, w.rec, parallel::Boundary::START)) pairer.push(w.rec, onPair, onOrphan);
+                        if(retVal < -1 || pairer.finish(onPair, onOrphan) < 0) ok = false;
+                    }, pool);
+
+                    if(!opened || !ok) return -1;
+
+                    auto fp = htsOpen(filename, "r");
+                    if(fp.get() == nullptr) return -1;
+                    auto hdr = htsHeader<bamHeader>::read(fp);
+                    if(hdr.get() == nullptr) return -1;
+
+                    AccT result = acc;
+                    for(auto& partial : partials) merge(result, std::move(partial));
+
+                    // orphans of different shards are merged back into
+                    // stream order, as every shard's orphans are sorted
+                    std::vector<bamPooledRecord> crossing;
+                    for(auto& o : orphans) for(auto& r : o) crossing.push_back(std::move(r));
+                    std::stable_sort(crossing.begin(), crossing.end(), [](const auto& a, const auto& b) { return position(*a) < position(*b); });
+
+                    htsMatePairer pairer(hdr, crossing.size() + 1, 0);
+                    auto onPair = [&](const bam1_t& first, const bam1_t& second) { map(result, first, second); };
+                    auto onOrphan = [](const bam1_t&) {};
+                    for(auto& r : crossing) pairer.push(*r, onPair, onOrphan);
+                    pairer.finish(onPair, onOrphan);
+
+                    acc = std::move(result);
+                    return 0;
+                }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,160 @@
+// YiCppLib::HTSLibpp::Parallel
+//
+// This file contains a region-sharded parallel traversal engine on top of
+// the c++14 SAM/BAM/CRAM wrappers
+
+#include "htslibpp.h"
+#include "htslibpp_alignment.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_PARALLEL
+#define YICPPLIB_HTSLIBPP_PARALLEL
+
+// A whole genome pass can be cut into shards, each of which is a region on
+// a single reference sequence. Shards are handed out to worker threads on
+// a first-come first-serve basis. Every worker owns its own htsFile,
+// bamHeader, htsIndex and bamRecord, so no htslib state is shared between
+// threads except for an optional decompression thread pool.
+//
+// The results of every shard are kept apart until all workers are done,
+// and are then merged in shard order. The final result therefore does not
+// depend on how the shards happened to be scheduled.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        template<> struct htsParallel<bamRecord> {
+
+            // A record that overlaps more than one shard can be treated in
+            // one of two ways
+            //   * START,   the record is visited once, by the first shard it
+            //              overlaps
+            //   * OVERLAP, the record is visited by every shard it overlaps,
+            //              which is what coverage-like passes usually want
+            //
+            // START relies on the shards being sorted and non-overlapping,
+            // which is what htsMergeRegions and htsSplitRegions produce.
+            enum class Boundary { START, OVERLAP };
+
+            // the per-worker state handed to shard functions
+            struct worker {
+                htsFile fp;
+                bamHeader hdr;
+                htsIndex idx;
+                bamRecord rec;
+
+                worker(const std::string& filename, const std::string& indexFilename, htsThreadPool * pool):
+                    fp(pool != nullptr ? htsOpen(filename, "r", *pool) : htsOpen(filename, "r")),
+                    hdr(fp.get() != nullptr ? htsHeader<bamHeader>::read(fp) : bamHeader{nullptr}),
+                    idx(htsIndexOpen(filename, indexFilename)),
+                    rec(bam_init1()) {}
+
+                bool good() const { return fp.get() != nullptr && hdr.get() != nullptr && idx.get() != nullptr; }
+            };
+
+            // does shard i own this record under the given boundary rule.
+            // Under START a record is left to the preceding shard if it
+            // reaches into that shard as well
+            static inline bool owns(const std::vector<htsRegion>& shards, size_t i, const bamRecord& rec, Boundary boundary) {
+                if(boundary == Boundary::OVERLAP || i == 0 || shards[i].tid < 0) return true;
+
+                const auto& prev = shards[i-1];
+                return prev.tid != shards[i].tid || rec->core.pos >= prev.end;
+            }
+
+            // The building block of the engine: run fn(shardIndex, shard, worker)
+            // once per shard, spread over nThreads threads. Returns false if
+            // any worker could not open the file, header or index.
+            template<class ShardF>
+            static bool forEachShard(const std::string& filename, const std::string& indexFilename,
+                    const std::vector<htsRegion>& shards, size_t nThreads, ShardF&& fn, htsThreadPool * pool = nullptr) {
+
+                std::atomic<size_t> next{0};
+                std::atomic<bool> ok{true};
+
+                auto work = [&]() {
+                    worker w(filename, indexFilename, pool);
+                    if(!w.good()) { ok = false; return; }
+
+                    for(size_t i = next++; i < shards.size(); i = next++) fn(i, shards[i], w);
+                };
+
+                nThreads = std::max<size_t>(1, std::min(nThreads, shards.size()));
+                std::vector<std::thread> threads;
+                for(size_t t = 1; t < nThreads; t++) threads.emplace_back(work);
+                work();
+                for(auto& t : threads) t.join();
+
+                return ok;
+            }
+
+            // Map every record of every shard into a per-shard accumulator,
+            // which starts out as a copy of acc, using map(acc, rec). The
+            // per-shard accumulators are then folded together in shard order
+            // with merge(into, std::move(from)), and the result stored in acc.
+            // Returns 0, or -1 if a worker could not open the file, header or
+            // index, a shard could not be queried or a read failed; acc is
+            // left untouched then
+            template<class AccT, class MapF, class MergeF>
+            static int reduce(const std::string& filename, const std::string& indexFilename,
+                    const std::vector<htsRegion>& shards, size_t nThreads, AccT& acc, MapF&& map, MergeF&& merge,
+                    Boundary boundary = Boundary::START, htsThreadPool * pool = nullptr) {
+
+                std::vector<AccT> partials(shards.size(), acc);
+                std::atomic<bool> ok{true};
+
+                bool opened = forEachShard(filename, indexFilename, shards, nThreads, [&](size_t i, const htsRegion& shard, worker& w) {
+                    htsIterator iter{sam_itr_queryi(w.idx.get(), shard.tid, shard.beg, shard.end)};
+                    if(iter.get() == nullptr) { ok = false; return; }
+
+                    auto& partial = partials[i];
+                    int retVal;
+                    while((retVal = htsReader<bamRecord>::next(w.fp, iter.get(), w.rec.get())) >= 0)
+                        if(owns(shards, i, w.rec, boundary)) map(partial, w.rec);
+                    if(retVal < -1) ok = false;
+                }, pool);
+
+                if(!opened || !ok) return -1;
+
+                AccT result = acc;
+                for(auto& partial : partials) merge(result, std::move(partial));
+                acc = std::move(result);
+                return 0;
+            }
+
+            // shard every reference sequence of the file into pieces of
+            // shardLength bases, including the unplaced reads, and reduce
+            template<class AccT, class MapF, class MergeF>
+            static int reduce(const std::string& filename, const std::string& indexFilename,
+                    int shardLength, size_t nThreads, AccT& acc, MapF&& map, MergeF&& merge, htsThreadPool * pool = nullptr) {
+
+                auto fp = htsOpen(filename, "r");
+                if(fp.get() == nullptr) return -1;
+                auto hdr = htsHeader<bamHeader>::read(fp);
+                if(hdr.get() == nullptr) return -1;
+
+                auto shards = htsHeader<bamHeader>::shards(hdr, shardLength, true);
+                return reduce(filename, indexFilename, shards, nThreads, acc, std::forward<MapF>(map), std::forward<MergeF>(merge), Boundary::START, pool);
+            }
+
+            // resolve and merge a list of region strings, cut them into pieces
+            // of shardLength bases, and reduce
+            template<class AccT, class MapF, class MergeF>
+            static int reduce(const std::string& filename, const std::string& indexFilename,
+                    const std::vector<std::string>& regions, int shardLength, size_t nThreads, AccT& acc, MapF&& map, MergeF&& merge,
+                    htsThreadPool * pool = nullptr) {
+
+                auto fp = htsOpen(filename, "r");
+                if(fp.get() == nullptr) return -1;
+                auto hdr = htsHeader<bamHeader>::read(fp);
+                if(hdr.get() == nullptr) return -1;
+
+                auto shards = htsSplitRegions(htsHeader<bamHeader>::regions(hdr, regions), shardLength);
+                return reduce(filename, indexFilename, shards, nThreads, acc, std::forward<MapF>(map), std::forward<MergeF>(merge), Boundary::START, pool);
+            }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,255 @@
+// YiCppLib::HTSLibpp::Pileup
+//
+// This file contains a streaming pileup engine, which turns position sorted
+// bamRecords into per-position base counts or depth arrays
+
+#include "htslibpp.h"
+#include "htslibpp_alignment.h"
+#include "htslibpp_parallel.h"
+#include <stdint.h>
+#include <array>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_PILEUP
+#define YICPPLIB_HTSLIBPP_PILEUP
+
+// The engine does not track reads at all. Instead every read that passes
+// the filters is walked along its CIGAR once, as soon as it is pushed, and
+// adds one count per reference position it covers to a ring buffer of
+// columns. Because records arrive sorted by position, every column before
+// the start of the current read is final and can be emitted, and its slot
+// in the ring is reused. The ring only grows when a single read spans more
+// columns than it can hold, so a pass over a region does not allocate once
+// it has warmed up.
+//
+// A column counts the A, C, G, T and N bases and the deletions at one
+// position. Ambiguity codes other than N are counted as N.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        struct htsPileupFilter {
+            int minMapQ = 0;
+            int minBaseQ = 0;
+            uint16_t excludeFlags = BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP;
+
+            bool pass(const bam1_t& rec) const {
+                return (rec.core.flag & excludeFlags) == 0 && rec.core.qual >= minMapQ;
+            }
+        };
+
+        struct htsPileupColumn {
+            enum Base : uint8_t { A = 0, C = 1, G = 2, T = 3, N = 4, DEL = 5 };
+
+            int32_t tid;
+            int32_t pos;
+            std::array<uint32_t, 6> counts;
+
+            uint32_t operator[](Base b) const { return counts[b]; }
+
+            // reads with a base or a deletion at this position
+            uint32_t depth() const {
+                uint32_t d = 0;
+                for(auto c : counts) d += c;
+                return d;
+            }
+
+            bool operator==(const htsPileupColumn& other) const {
+                return tid == other.tid && pos == other.pos && counts == other.counts;
+            }
+            bool operator!=(const htsPileupColumn& other) const { return !(*this == other); }
+        };
+
+        class htsPileup {
+            protected:
+                using counts_t = std::array<uint32_t, 6>;
+
+                htsPileupFilter m_filter;
+                htsRegion m_clip;
+
+                // m_ring holds the columns from m_start onwards, the first
+                // of them in slot m_head. m_size is how many are in use
+                std::vector<counts_t> m_ring;
+                size_t m_head;
+                size_t m_size;
+                int32_t m_tid;
+                int32_t m_start;
+
+                static inline uint8_t baseIndex(uint8_t nt16) {
+                    static const uint8_t table[16] = { 4, 0, 1, 4, 2, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4 };
+                    return table[nt16];
+                }
+
+                counts_t& slot(size_t offset) { return m_ring[(m_head + offset) & (m_ring.size() - 1)]; }
+
+                void reserve(size_t columns) {
+                    if(columns <= m_ring.size()) return;
+
+                    auto capacity = m_ring.size();
+                    while(capacity < columns) capacity *= 2;
+
+                    std::vector<counts_t> ring(capacity, counts_t{});
+                    for(size_t i = 0; i < m_size; i++) ring[i] = slot(i);
+                    m_ring.swap(ring);
+                    m_head = 0;
+                }
+
+                // emit and recycle the columns before pos
+                template<class EmitF> void retire(int32_t pos, EmitF& emit) {
+                    while(m_size > 0 && m_start < pos) {
+                        auto& c = m_ring[m_head];
+                        htsPileupColumn column{m_tid, m_start, c};
+                        if(column.depth() > 0) emit(static_cast<const htsPileupColumn&>(column));
+                        c.fill(0);
+                        m_head = (m_head + 1) & (m_ring.size() - 1);
+                        m_start++;
+                        m_size--;
+                    }
+                    if(m_size == 0 && m_start < pos) m_start = pos;
+                }
+
+                bool clipped(int32_t pos) const {
+                    return m_clip.tid >= 0 && (pos < m_clip.beg || pos >= m_clip.end);
+                }
+
+                void add(int32_t pos, uint8_t base) {
+                    if(clipped(pos)) return;
+                    auto offset = static_cast<size_t>(pos - m_start);
+                    if(offset >= m_size) { reserve(offset + 1); m_size = offset + 1; }
+                    slot(offset)[base]++;
+                }
+
+            public:
+                // only positions inside clip are counted, unless clip has a
+                // negative tid
+                htsPileup(const htsPileupFilter& filter = htsPileupFilter{}, const htsRegion& clip = htsRegion{-1, 0, 0}):
+                    m_filter(filter), m_clip(clip), m_ring(1024, counts_t{}), m_head(0), m_size(0), m_tid(-1), m_start(0) {}
+
+                const htsPileupFilter& filter() const { return m_filter; }
+
+                // add a record, emitting every column that is complete. the
+                // records have to be pushed in position order; a record that
+                // starts before a column that was already emitted is skipped,
+                // and -1 returned. returns 0 otherwise
+                template<class EmitF> int push(const bam1_t& rec, EmitF&& emit) {
+                    if(rec.core.tid < 0 || !m_filter.pass(rec)) return 0;
+                    if(rec.core.tid == m_tid && rec.core.pos < m_start) return -1;
+
+                    if(rec.core.tid != m_tid) {
+                        retire(INT32_MAX, emit);
+                        m_tid = rec.core.tid;
+                        m_start = rec.core.pos;
+                    }
+                    retire(rec.core.pos, emit);
+
+                    const uint32_t * cigar = bam_get_cigar(&rec);
+                    const uint8_t * seq = bam_get_seq(&rec);
+                    const uint8_t * qual = bam_get_qual(&rec);
+
+                    int32_t rpos = rec.core.pos;
+                    int32_t qpos = 0;
+                    for(uint32_t i = 0; i < rec.core.n_cigar; i++) {
+                        auto len = static_cast<int32_t>(bam_cigar_oplen(cigar[i]));
+                        switch(bam_cigar_op(cigar[i])) {
+                            case BAM_CMATCH:
+                            case BAM_CEQUAL:
+                            case BAM_CDIFF:
+                                for(int32_t j = 0; j < len; j++, rpos++, qpos++)
+                                    if(qual[qpos] >= m_filter.minBaseQ) add(rpos, baseIndex(bam_seqi(seq, qpos)));
+                                break;
+                            case BAM_CDEL:
+                                for(int32_t j = 0; j < len; j++, rpos++) add(rpos, htsPileupColumn::DEL);
+                                break;
+                            case BAM_CREF_SKIP:
+                                rpos += len;
+                                break;
+                            case BAM_CINS:
+                            case BAM_CSOFT_CLIP:
+                                qpos += len;
+                                break;
+                            default:
+                                break;
+                        }
+                    }
+                    return 0;
+                }
+
+                template<class EmitF> int push(const bamRecord& rec, EmitF&& emit) { return push(*rec, std::forward<EmitF>(emit)); }
+
+                // emit every remaining column
+                template<class EmitF> void flush(EmitF&& emit) {
+                    retire(INT32_MAX, emit);
+                    m_tid = -1;
+                }
+
+                // --- WHOLE REGION PASSES --- //
+
+                // run the pileup over one region, calling emit for every
+                // column with a non-zero depth
+                template<class EmitF>
+                static void run(htsFile& fp, const bamHeader& hdr, htsIndex& idx, const htsRegion& region,
+                        const htsPileupFilter& filter, EmitF&& emit) {
+                    htsPileup pileup(filter, region);
+                    for(auto& r : htsReader<bamRecord>::range(fp, hdr, idx, std::vector<htsRegion>{region}, 0)) pileup.push(r, emit);
+                    pileup.flush(emit);
+                }
+
+                static auto columns(htsFile& fp, const bamHeader& hdr, htsIndex& idx, const htsRegion& region,
+                        const htsPileupFilter& filter = htsPileupFilter{}) {
+                    std::vector<htsPileupColumn> result;
+                    run(fp, hdr, idx, region, filter, [&](const htsPileupColumn& c) { result.push_back(c); });
+                    return result;
+                }
+
+                // the depth of every position of the region, zeros included
+                static auto depth(htsFile& fp, const bamHeader& hdr, htsIndex& idx, const htsRegion& region,
+                        const htsPileupFilter& filter = htsPileupFilter{}) {
+                    std::vector<uint32_t> result(std::max(0, region.end - region.beg), 0);
+                    run(fp, hdr, idx, region, filter, [&](const htsPileupColumn& c) { result[c.pos - region.beg] = c.depth(); });
+                    return result;
+                }
+
+                // --- PARALLEL PASSES --- //
+
+                // the same passes over a list of shards, as produced by
+                // htsMergeRegions or htsSplitRegions. every shard runs its own
+                // pileup clipped to the shard, so reads crossing a boundary
+                // count towards both sides, and the results are concatenated
+                // in shard order into result. returns 0, or -1 if a worker
+                // could not open the file, header or index, in which case
+                // result is left untouched
+                static int columns(const std::string& filename, const std::string& indexFilename,
+                        const std::vector<htsRegion>& shards, size_t nThreads, std::vector<htsPileupColumn>& result,
+                        const htsPileupFilter& filter = htsPileupFilter{}, htsThreadPool * pool = nullptr) {
+
+                    std::vector<std::vector<htsPileupColumn>> partials(shards.size());
+                    bool ok = htsParallel<bamRecord>::forEachShard(filename, indexFilename, shards, nThreads,
+                            [&](size_t i, const htsRegion& shard, htsParallel<bamRecord>::worker& w) {
+                                partials[i] = columns(w.fp, w.hdr, w.idx, shard, filter);
+                            }, pool);
+                    if(!ok) return -1;
+
+                    result.clear();
+                    for(auto& partial : partials) result.insert(result.end(), partial.begin(), partial.end());
+                    return 0;
+                }
+
+                static int depth(const std::string& filename, const std::string& indexFilename,
+                        const std::vector<htsRegion>& shards, size_t nThreads, std::vector<uint32_t>& result,
+                        const htsPileupFilter& filter = htsPileupFilter{}, htsThreadPool * pool = nullptr) {
+
+                    std::vector<std::vector<uint32_t>> partials(shards.size());
+                    bool ok = htsParallel<bamRecord>::forEachShard(filename, indexFilename, shards, nThreads,
+                            [&](size_t i, const htsRegion& shard, htsParallel<bamRecord>::worker& w) {
+                                partials[i] = depth(w.fp, w.hdr, w.idx, shard, filter);
+                            }, pool);
+                    if(!ok) return -1;
+
+                    result.clear();
+                    for(auto& partial : partials) result.insert(result.end(), partial.begin(), partial.end());
+                    return 0;
+                }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,389 @@
+// YiCppLib::HTSLibpp::Reference
+//
+// This file contains a process-wide reference sequence provider, which maps
+// a FASTA file into memory once and shares it between all of its readers
+
+#include "htslibpp.h"
+#include "htslibpp_alignment.h"
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <algorithm>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#if defined(HTS_VERSION) && HTS_VERSION >= 101000
+#include <htslib/cram.h>
+#endif
+#ifndef YICPPLIB_HTSLIBPP_REFERENCE
+#define YICPPLIB_HTSLIBPP_REFERENCE
+
+// A plain FASTA file is mapped as a whole. A slice of a contig that lies
+// within a single line of the file points straight into the mapping, and
+// longer slices are put together line by line from it, without any read
+// calls.
+//
+// A bgzip compressed FASTA file is mapped as well, and its blocks are
+// located through the .gzi index. Blocks are inflated on demand into a
+// cache that is shared by every thread, and bounded in size by dropping
+// the least recently used blocks first.
+//
+// htslib decodes CRAM against reference sequences that it loads itself,
+// through the .fai of the FASTA file set as CRAM_OPT_REFERENCE, into a
+// refs_t that belongs to the open file. attach() points a CRAM file at
+// the provider's FASTA file. With htslib 1.10 and later, all files
+// attached to the same provider and sharing the same reference sequence
+// dictionary also share a single refs_t, through CRAM_OPT_SHARED_REF, so
+// that a contig is loaded once per process rather than once per reader,
+// and CRAM decoding does not take more memory as readers are added. htslib
+// cannot decode from the mapping itself; slices serve the library's own
+// consumers.
+//
+// Sharing needs cram_get_refs and CRAM_OPT_SHARED_REF, which htslib only
+// exports from 1.10 on. Built against an older htslib, such as the 1.4.1
+// the tests default to, attach() only sets CRAM_OPT_REFERENCE, and every
+// reader loads its own copy of the contigs it decodes against.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        // A piece of reference sequence, which either points into the
+        // mapping or holds a copy. Views are valid as long as the provider
+        struct htsReferenceSlice {
+            protected:
+                std::string m_copy;
+                const char * m_data;
+                size_t m_size;
+
+            public:
+                htsReferenceSlice(): m_data(nullptr), m_size(0) {}
+                htsReferenceSlice(const char * data, size_t size): m_data(data), m_size(size) {}
+                explicit htsReferenceSlice(std::string&& copy): m_copy(std::move(copy)), m_data(m_copy.data()), m_size(m_copy.size()) {}
+
+                htsReferenceSlice(const htsReferenceSlice&) = delete;
+                htsReferenceSlice& operator=(const htsReferenceSlice&) = delete;
+
+                htsReferenceSlice(htsReferenceSlice&& other): m_copy(std::move(other.m_copy)), m_data(other.m_data), m_size(other.m_size) {
+                    if(!m_copy.empty()) m_data = m_copy.data();
+                }
+
+                htsReferenceSlice& operator=(htsReferenceSlice&& other) {
+                    m_copy = std::move(other.m_copy);
+                    m_data = m_copy.empty() ? other.m_data : m_copy.data();
+                    m_size = other.m_size;
+                    return *this;
+                }
+
+                // does the slice point into the mapping
+                bool zeroCopy() const { return m_copy.empty() && m_data != nullptr; }
+
+                const char * data() const { return m_data; }
+                size_t size() const { return m_size; }
+                bool empty() const { return m_size == 0; }
+                char operator[](size_t i) const { return m_data[i]; }
+
+                htsStringView view() const { return htsStringView(m_data, m_size); }
+        };
+
+        class htsReference {
+            public:
+                // a line of the .fai index
+                struct contig {
+                    std::string name;
+                    int64_t length;
+                    uint64_t offset;
+                    int64_t lineBases;
+                    int64_t lineWidth;
+                };
+
+                static const size_t defaultCacheBytes = 64 << 20;
+
+            protected:
+                std::string m_fasta;
+                htsMappedFile m_file;
+                bool m_good;
+                bool m_compressed;
+                std::vector<contig> m_contigs;
+                std::unordered_map<std::string, int> m_ids;
+
+                // the .gzi index as {uncompressed offset, compressed offset}
+                // of every block, in file order
+                std::vector<std::pair<uint64_t, uint64_t>> m_blocks;
+
+                struct cached {
+                    std::shared_ptr<const std::string> data;
+                    std::list<uint64_t>::iterator recency;
+                };
+
+                size_t m_cacheCap;
+                size_t m_cacheBytes;
+                mutable std::mutex m_lock;
+                std::unordered_map<uint64_t, cached> m_cache;
+                std::list<uint64_t> m_recency;
+
+                // one handle per reference sequence dictionary, whose refs_t
+                // is shared with the files attached to the provider
+                std::mutex m_cramLock;
+                std::unordered_map<std::string, htsFile> m_donors;
+
+                const uint8_t * bytes() const { return static_cast<const uint8_t *>(m_file.data()); }
+
+                bool loadFai(const std::string& filename) {
+                    std::ifstream in(filename);
+                    if(!in) return false;
+
+                    contig c;
+                    while(in >> c.name >> c.length >> c.offset >> c.lineBases >> c.lineWidth) {
+                        if(c.lineBases <= 0 || c.lineWidth < c.lineBases) return false;
+                        m_ids.emplace(c.name, static_cast<int>(m_contigs.size()));
+                        m_contigs.push_back(c);
+                    }
+                    return in.eof();
+                }
+
+                // the .gzi index is a count followed by {compressed,
+                // uncompressed} offset pairs, all little endian uint64
+                bool loadGzi(const std::string& filename) {
+                    std::ifstream in(filename, std::ios::binary);
+                    if(!in) return false;
+
+                    auto next = [&in](uint64_t& value) {
+                        uint8_t buf[8];
+                        if(!in.read(reinterpret_cast<char *>(buf), sizeof(buf))) return false;
+                        value = 0;
+                        for(int i = 7; i >= 0; i--) value = value << 8 | buf[i];
+                        return true;
+                    };
+
+                    uint64_t n;
+                    if(!next(n)) return false;
+                    m_blocks.assign(1, std::make_pair(0, 0));
+                    for(uint64_t i = 0; i < n; i++) {
+                        uint64_t compressed, uncompressed;
+                        if(!next(compressed) || !next(uncompressed)) return false;
+                        m_blocks.emplace_back(uncompressed, compressed);
+                    }
+                    return true;
+                }
+
+                // inflate the BGZF block at a compressed offset. BSIZE sits
+                // in the BC extra field right after the fixed gzip header,
+                // and ISIZE in the last 4 bytes of the block
+                std::shared_ptr<const std::string> inflateBlock(uint64_t offset) const {
+                    if(offset + 18 > m_file.size()) return nullptr;
+
+                    auto p = bytes() + offset;
+                    if(p[0] != 0x1f || p[1] != 0x8b) return nullptr;
+                    size_t blockSize = (p[16] | p[17] << 8) + 1;
+                    if(blockSize < 26 || offset + blockSize > m_file.size()) return nullptr;
+
+                    uint32_t inflated = p[blockSize - 4] | p[blockSize - 3] << 8 | p[blockSize - 2] << 16 | static_cast<uint32_t>(p[blockSize - 1]) << 24;
+                    auto data = std::make_shared<std::string>(inflated, '\0');
+
+                    z_stream zs;
+                    memset(&zs, 0, sizeof(zs));
+                    if(inflateInit2(&zs, -15) != Z_OK) return nullptr;
+                    zs.next_in = const_cast<Bytef *>(p + 18);
+                    zs.avail_in = blockSize - 26;
+                    zs.next_out = reinterpret_cast<Bytef *>(&(*data)[0]);
+                    zs.avail_out = inflated;
+                    auto status = inflate(&zs, Z_FINISH);
+                    inflateEnd(&zs);
+
+                    if(status != Z_STREAM_END || zs.avail_out != 0) return nullptr;
+                    return data;
+                }
+
+                // a block out of the cache, inflating it on a miss. blocks
+                // are inflated outside of the lock, so threads do not wait
+                // on each other's misses
+                std::shared_ptr<const std::string> block(uint64_t offset) {
+                    {
+                        std::lock_guard<std::mutex> guard(m_lock);
+                        auto found = m_cache.find(offset);
+                        if(found != m_cache.end()) {
+                            m_recency.splice(m_recency.begin(), m_recency, found->second.recency);
+                            return found->second.data;
+                        }
+                    }
+
+                    auto data = inflateBlock(offset);
+                    if(!data) return data;
+
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    if(m_cache.find(offset) == m_cache.end()) {
+                        m_recency.push_front(offset);
+                        m_cache.emplace(offset, cached{data, m_recency.begin()});
+                        m_cacheBytes += data->size();
+
+                        while(m_cacheBytes > m_cacheCap && m_recency.size() > 1) {
+                            auto evicted = m_cache.find(m_recency.back());
+                            m_cacheBytes -= evicted->second.data->size();
+                            m_cache.erase(evicted);
+                            m_recency.pop_back();
+                        }
+                    }
+                    return data;
+                }
+
+                // append length bytes of the uncompressed file from offset
+                bool append(uint64_t offset, size_t length, std::string& out) {
+                    if(!m_compressed) {
+                        if(offset + length > m_file.size()) return false;
+                        out.append(reinterpret_cast<const char *>(bytes() + offset), length);
+                        return true;
+                    }
+
+                    while(length > 0) {
+                        auto b = std::upper_bound(m_blocks.begin(), m_blocks.end(), offset,
+                                [](uint64_t value, const std::pair<uint64_t, uint64_t>& entry) { return value < entry.first; });
+                        --b;
+
+                        auto data = block(b->second);
+                        auto skip = offset - b->first;
+                        if(!data || skip >= data->size()) return false;
+
+                        auto n = std::min<size_t>(length, data->size() - skip);
+                        out.append(*data, skip, n);
+                        offset += n;
+                        length -= n;
+                    }
+                    return true;
+                }
+
+                // the reference sequence dictionary of a header, which
+                // decides whether two CRAM files can share a refs_t
+                static std::string dictionary(const bam_hdr_t * hdr) {
+                    std::string dict;
+                    for(int32_t i = 0; i < hdr->n_targets; i++)
+                        dict.append(hdr->target_name[i]).append("\t").append(std::to_string(hdr->target_len[i])).append("\n");
+                    return dict;
+                }
+
+            public:
+                // map fasta and load its .fai, and its .gzi if it is
+                // compressed. at most cacheBytes of inflated blocks are kept
+                explicit htsReference(const std::string& fasta, size_t cacheBytes = defaultCacheBytes):
+                    m_fasta(fasta), m_file(fasta, htsMappedFile::Access::RANDOM), m_good(false), m_compressed(false),
+                    m_cacheCap(cacheBytes), m_cacheBytes(0) {
+
+                    if(!m_file.good() || !loadFai(fasta + ".fai")) return;
+                    m_compressed = m_file.size() >= 2 && bytes()[0] == 0x1f && bytes()[1] == 0x8b;
+                    m_good = !m_compressed || loadGzi(fasta + ".gzi");
+                }
+
+                htsReference(const htsReference&) = delete;
+                htsReference& operator=(const htsReference&) = delete;
+
+                // the provider of a FASTA file for the whole process. it is
+                // created on first use, and released once nobody holds it
+                static std::shared_ptr<htsReference> shared(const std::string& fasta, size_t cacheBytes = defaultCacheBytes) {
+                    static std::mutex lock;
+                    static std::unordered_map<std::string, std::weak_ptr<htsReference>> providers;
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    auto& slot = providers[fasta];
+                    auto provider = slot.lock();
+                    if(!provider) {
+                        provider = std::make_shared<htsReference>(fasta, cacheBytes);
+                        slot = provider;
+                    }
+                    return provider;
+                }
+
+                bool good() const { return m_good; }
+                bool compressed() const { return m_compressed; }
+                const std::string& filename() const { return m_fasta; }
+
+                const std::vector<contig>& contigs() const { return m_contigs; }
+
+                // the index of a contig, or -1 if there is no such contig
+                int tid(const std::string& name) const {
+                    auto found = m_ids.find(name);
+                    return found == m_ids.end() ? -1 : found->second;
+                }
+
+                // inflated blocks currently cached
+                size_t cacheBytes() const {
+                    std::lock_guard<std::mutex> guard(m_lock);
+                    return m_cacheBytes;
+                }
+
+                // the bases [beg, end) of a contig, clipped to the contig.
+                // the slice is empty if the contig does not exist or the
+                // file is damaged
+                htsReferenceSlice slice(int tid, int64_t beg, int64_t end) {
+                    if(!m_good || tid < 0 || tid >= static_cast<int>(m_contigs.size())) return htsReferenceSlice();
+
+                    const auto& c = m_contigs[tid];
+                    beg = std::max<int64_t>(beg, 0);
+                    end = std::min(end, c.length);
+                    if(beg >= end) return htsReferenceSlice();
+
+                    auto offset = [&c](int64_t pos) { return c.offset + pos / c.lineBases * c.lineWidth + pos % c.lineBases; };
+
+                    if(!m_compressed && beg / c.lineBases == (end - 1) / c.lineBases) {
+                        if(offset(end - 1) >= m_file.size()) return htsReferenceSlice();
+                        return htsReferenceSlice(reinterpret_cast<const char *>(bytes() + offset(beg)), end - beg);
+                    }
+
+                    std::string copy;
+                    copy.reserve(end - beg);
+                    for(auto pos = beg; pos < end; ) {
+                        auto lineEnd = std::min(end, (pos / c.lineBases + 1) * c.lineBases);
+                        if(!append(offset(pos), lineEnd - pos, copy)) return htsReferenceSlice();
+                        pos = lineEnd;
+                    }
+                    return htsReferenceSlice(std::move(copy));
+                }
+
+                htsReferenceSlice slice(const std::string& name, int64_t beg, int64_t end) { return slice(tid(name), beg, end); }
+
+                // Decode a CRAM file against this reference, or encode one
+                // that is being written. Has to be called before the first
+                // record is read or written, and only files being read take
+                // part in sharing, with htslib 1.10 or later. Files of other
+                // formats are left alone. Returns 0, or -1 on failure
+                int attach(htsFile& fp) {
+                    if(fp.get() == nullptr || !m_good) return -1;
+                    if(fp->format.format != cram) return 0;
+
+#if defined(HTS_VERSION) && HTS_VERSION >= 101000
+                    // the header of a CRAM file is parsed when it is opened,
+                    // and sam_hdr_read hands out a copy of it
+                    bamHeader hdr{fp->is_write ? nullptr : sam_hdr_read(fp.get())};
+                    if(hdr.get() != nullptr && fp->fn != nullptr) {
+                        std::lock_guard<std::mutex> guard(m_cramLock);
+
+                        // the shared refs_t belongs to a handle of the
+                        // provider's own, so it outlives every file it is
+                        // shared with
+                        auto& donor = m_donors[dictionary(hdr.get())];
+                        if(donor.get() == nullptr) {
+                            donor = htsOpen(fp->fn, "r");
+                            if(donor.get() != nullptr && hts_set_fai_filename(donor.get(), m_fasta.c_str()) != 0) donor.reset();
+                        }
+
+                        auto refs = donor.get() != nullptr ? cram_get_refs(donor.get()) : nullptr;
+                        if(refs != nullptr) return hts_set_opt(fp.get(), CRAM_OPT_SHARED_REF, refs) == 0 ? 0 : -1;
+                    }
+#endif
+                    return htsSetReference(fp, m_fasta) == 0 ? 0 : -1;
+                }
+        };
+
+        // open a file and attach it to a reference
+        inline auto htsOpen(const std::string& filename, const std::string& mode, htsReference& ref) {
+            auto fp = htsOpen(filename, mode);
+            if(fp.get() != nullptr && ref.attach(fp) != 0) fp.reset();
+            return fp;
+        }
+    }
+}
+
+#endif
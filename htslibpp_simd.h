@@ -0,0 +1,304 @@
+// YiCppLib::HTSLibpp::SIMD
+//
+// This file contains vectorised kernels for the byte shuffling that sits
+// at the bottom of most read-level work: decoding the 4-bit packed
+// sequence of an alignment, and reducing its base qualities.
+//
+// Every kernel has a scalar version that works everywhere, and on x86-64
+// SSE and AVX2 versions that are picked once at runtime based on what the
+// cpu supports. The vector versions are compiled with function level
+// target attributes, so no special compiler flags are needed.
+
+#include "htslibpp.h"
+#include "htslibpp_alignment.h"
+#include <stdint.h>
+#include <stddef.h>
+#ifndef YICPPLIB_HTSLIBPP_SIMD
+#define YICPPLIB_HTSLIBPP_SIMD
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HTSLIBPP_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+        namespace simd {
+
+            // Aggregates over the base qualities of a read
+            struct qualityStats {
+                uint64_t sum;
+                uint8_t min;
+                size_t count;       // number of bases
+                size_t countAbove;  // number of bases with quality >= threshold
+
+                double mean() const { return count ? static_cast<double>(sum) / count : 0.0; }
+            };
+
+            // Lookup tables from the 4-bit base codes, see seq_nt16_str.
+            //   * ascii, the IUPAC letter
+            //   * ascii of the complement, for reverse complementing
+            //   * 2-bit code, A=0 C=1 G=2 T=3, and 4 for everything else
+            struct tables {
+                static const char * ascii()      { return "=ACMGRSVTWYHKDBN"; }
+                static const char * complement() { return "=TGKCYSBAWRDMHVN"; }
+                static const uint8_t * twoBit() {
+                    static const uint8_t t[16] = { 4, 0, 1, 4, 2, 4, 4, 4, 3, 4, 4, 4, 4, 4, 4, 4 };
+                    return t;
+                }
+            };
+
+            // --- SCALAR KERNELS --- //
+            namespace scalar {
+                // map bases [from, len) through a 16 entry table
+                inline void decode(const uint8_t * packed, size_t from, size_t len, const uint8_t * lut, uint8_t * out) {
+                    for(size_t i = from; i < len; i++) out[i] = lut[bam_seqi(packed, i)];
+                }
+
+                inline void reverseComplement(const uint8_t * packed, size_t from, size_t len, char * out) {
+                    const char * lut = tables::complement();
+                    for(size_t i = from; i < len; i++) out[len - 1 - i] = lut[bam_seqi(packed, i)];
+                }
+
+                inline void qualityStats(const uint8_t * qual, size_t from, size_t len, uint8_t threshold, simd::qualityStats& stats) {
+                    for(size_t i = from; i < len; i++) {
+                        stats.sum += qual[i];
+                        if(qual[i] < stats.min) stats.min = qual[i];
+                        if(qual[i] >= threshold) stats.countAbove++;
+                    }
+                }
+            }
+
+#ifdef HTSLIBPP_SIMD_X86
+            // --- SSE KERNELS --- //
+            // The table lookups need pshufb, so decoding requires SSSE3. The
+            // quality reductions only need SSE2.
+            namespace sse {
+                // decode 16 packed bytes into 32 bases, returned as two halves
+                __attribute__((target("ssse3")))
+                inline void decode16(const uint8_t * packed, __m128i lut, __m128i& first, __m128i& second) {
+                    const __m128i nibble = _mm_set1_epi8(0x0f);
+                    __m128i p  = _mm_loadu_si128(reinterpret_cast<const __m128i *>(packed));
+                    __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(p, 4), nibble));
+                    __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(p, nibble));
+                    first  = _mm_unpacklo_epi8(hi, lo);
+                    second = _mm_unpackhi_epi8(hi, lo);
+                }
+
+                __attribute__((target("ssse3")))
+                inline void decode(const uint8_t * packed, size_t len, const uint8_t * table, uint8_t * out) {
+                    const __m128i lut = _mm_loadu_si128(reinterpret_cast<const __m128i *>(table));
+                    size_t i = 0;
+                    for(; i + 32 <= len; i += 32) {
+                        __m128i first, second;
+                        decode16(packed + (i >> 1), lut, first, second);
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), first);
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i + 16), second);
+                    }
+                    scalar::decode(packed, i, len, table, out);
+                }
+
+                __attribute__((target("ssse3")))
+                inline void reverseComplement(const uint8_t * packed, size_t len, char * out) {
+                    const __m128i lut = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables::complement()));
+                    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+                    size_t i = 0;
+                    for(; i + 32 <= len; i += 32) {
+                        __m128i first, second;
+                        decode16(packed + (i >> 1), lut, first, second);
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + len - i - 16), _mm_shuffle_epi8(first, reverse));
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + len - i - 32), _mm_shuffle_epi8(second, reverse));
+                    }
+                    scalar::reverseComplement(packed, i, len, out);
+                }
+
+                __attribute__((target("sse2")))
+                inline void qualityStats(const uint8_t * qual, size_t len, uint8_t threshold, simd::qualityStats& stats) {
+                    const __m128i zero = _mm_setzero_si128();
+                    const __m128i thresh = _mm_set1_epi8(static_cast<char>(threshold));
+                    __m128i sum = zero, above = zero, minv = _mm_set1_epi8(static_cast<char>(0xff));
+
+                    size_t i = 0;
+                    while(i + 16 <= len) {
+                        // the per-byte above counters are flushed before they can wrap
+                        __m128i counts = zero;
+                        for(size_t n = 0; n < 255 && i + 16 <= len; n++, i += 16) {
+                            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(qual + i));
+                            sum    = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+                            minv   = _mm_min_epu8(minv, v);
+                            counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_max_epu8(v, thresh), v));
+                        }
+                        above = _mm_add_epi64(above, _mm_sad_epu8(counts, zero));
+                    }
+
+                    alignas(16) uint64_t lanes[2];
+                    alignas(16) uint8_t mins[16];
+                    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sum);
+                    stats.sum += lanes[0] + lanes[1];
+                    _mm_store_si128(reinterpret_cast<__m128i *>(lanes), above);
+                    stats.countAbove += lanes[0] + lanes[1];
+                    _mm_store_si128(reinterpret_cast<__m128i *>(mins), minv);
+                    for(auto m : mins) if(m < stats.min) stats.min = m;
+
+                    scalar::qualityStats(qual, i, len, threshold, stats);
+                }
+            }
+
+            // --- AVX2 KERNELS --- //
+            namespace avx2 {
+                // decode 32 packed bytes into 64 bases, returned as two halves
+                __attribute__((target("avx2")))
+                inline void decode32(const uint8_t * packed, __m256i lut, __m256i& first, __m256i& second) {
+                    const __m256i nibble = _mm256_set1_epi8(0x0f);
+                    __m256i p  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(packed));
+                    __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(p, 4), nibble));
+                    __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(p, nibble));
+
+                    // unpacking works within 128 bit lanes, put the lanes back in order
+                    __m256i a = _mm256_unpacklo_epi8(hi, lo);
+                    __m256i b = _mm256_unpackhi_epi8(hi, lo);
+                    first  = _mm256_permute2x128_si256(a, b, 0x20);
+                    second = _mm256_permute2x128_si256(a, b, 0x31);
+                }
+
+                __attribute__((target("avx2")))
+                inline __m256i broadcast(const void * table) {
+                    return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(table)));
+                }
+
+                __attribute__((target("avx2")))
+                inline void decode(const uint8_t * packed, size_t len, const uint8_t * table, uint8_t * out) {
+                    const __m256i lut = broadcast(table);
+                    size_t i = 0;
+                    for(; i + 64 <= len; i += 64) {
+                        __m256i first, second;
+                        decode32(packed + (i >> 1), lut, first, second);
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i), first);
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i + 32), second);
+                    }
+                    scalar::decode(packed, i, len, table, out);
+                }
+
+                __attribute__((target("avx2")))
+                inline __m256i reverse32(__m256i v) {
+                    const __m256i reverse = _mm256_set_epi8(
+                            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+                    return _mm256_permute2x128_si256(_mm256_shuffle_epi8(v, reverse), _mm256_shuffle_epi8(v, reverse), 0x01);
+                }
+
+                __attribute__((target("avx2")))
+                inline void reverseComplement(const uint8_t * packed, size_t len, char * out) {
+                    const __m256i lut = broadcast(tables::complement());
+                    size_t i = 0;
+                    for(; i + 64 <= len; i += 64) {
+                        __m256i first, second;
+                        decode32(packed + (i >> 1), lut, first, second);
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + len - i - 32), reverse32(first));
+                        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + len - i - 64), reverse32(second));
+                    }
+                    scalar::reverseComplement(packed, i, len, out);
+                }
+
+                __attribute__((target("avx2")))
+                inline void qualityStats(const uint8_t * qual, size_t len, uint8_t threshold, simd::qualityStats& stats) {
+                    const __m256i zero = _mm256_setzero_si256();
+                    const __m256i thresh = _mm256_set1_epi8(static_cast<char>(threshold));
+                    __m256i sum = zero, above = zero, minv = _mm256_set1_epi8(static_cast<char>(0xff));
+
+                    size_t i = 0;
+                    while(i + 32 <= len) {
+                        __m256i counts = zero;
+                        for(size_t n = 0; n < 255 && i + 32 <= len; n++, i += 32) {
+                            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(qual + i));
+                            sum    = _mm256_add_epi64(sum, _mm256_sad_epu8(v, zero));
+                            minv   = _mm256_min_epu8(minv, v);
+                            counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(_mm256_max_epu8(v, thresh), v));
+                        }
+                        above = _mm256_add_epi64(above, _mm256_sad_epu8(counts, zero));
+                    }
+
+                    alignas(32) uint64_t lanes[4];
+                    alignas(32) uint8_t mins[32];
+                    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), sum);
+                    stats.sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                    _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), above);
+                    stats.countAbove += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                    _mm256_store_si256(reinterpret_cast<__m256i *>(mins), minv);
+                    for(auto m : mins) if(m < stats.min) stats.min = m;
+
+                    sse::qualityStats(qual + i, len - i, threshold, stats);
+                }
+            }
+#endif
+
+            // --- RUNTIME DISPATCH --- //
+
+            // the instruction sets the kernels can be run with
+            enum class Level { SCALAR, SSE, AVX2 };
+
+            // the best level supported by the cpu, detected once
+            inline Level detectedLevel() {
+                static const Level level = []() {
+#ifdef HTSLIBPP_SIMD_X86
+                    __builtin_cpu_init();
+                    if(__builtin_cpu_supports("avx2"))  return Level::AVX2;
+                    if(__builtin_cpu_supports("ssse3")) return Level::SSE;
+#endif
+                    return Level::SCALAR;
+                }();
+                return level;
+            }
+
+            // Decode n bases of a packed sequence into ascii letters. out
+            // needs room for n bytes and is not null terminated.
+            inline void decodeSequence(const uint8_t * packed, size_t n, char * out, Level level = detectedLevel()) {
+                auto table = reinterpret_cast<const uint8_t *>(tables::ascii());
+                auto dst = reinterpret_cast<uint8_t *>(out);
+#ifdef HTSLIBPP_SIMD_X86
+                if(level == Level::AVX2) return avx2::decode(packed, n, table, dst);
+                if(level == Level::SSE)  return sse::decode(packed, n, table, dst);
+#endif
+                scalar::decode(packed, 0, n, table, dst);
+            }
+
+            // Decode n bases of a packed sequence into 2-bit codes, A=0 C=1
+            // G=2 T=3, with 4 standing for N and the other ambiguity codes
+            inline void decodeSequence2Bit(const uint8_t * packed, size_t n, uint8_t * out, Level level = detectedLevel()) {
+#ifdef HTSLIBPP_SIMD_X86
+                if(level == Level::AVX2) return avx2::decode(packed, n, tables::twoBit(), out);
+                if(level == Level::SSE)  return sse::decode(packed, n, tables::twoBit(), out);
+#endif
+                scalar::decode(packed, 0, n, tables::twoBit(), out);
+            }
+
+            // Decode the reverse complement of n bases of a packed sequence
+            inline void reverseComplement(const uint8_t * packed, size_t n, char * out, Level level = detectedLevel()) {
+#ifdef HTSLIBPP_SIMD_X86
+                if(level == Level::AVX2) return avx2::reverseComplement(packed, n, out);
+                if(level == Level::SSE)  return sse::reverseComplement(packed, n, out);
+#endif
+                scalar::reverseComplement(packed, 0, n, out);
+            }
+
+            // Sum, minimum and number of bases at or above threshold
+            inline qualityStats baseQualityStats(const uint8_t * qual, size_t n, uint8_t threshold, Level level = detectedLevel()) {
+                qualityStats stats{0, 0xff, n, 0};
+#ifdef HTSLIBPP_SIMD_X86
+                if(level == Level::AVX2) { avx2::qualityStats(qual, n, threshold, stats); return stats; }
+                if(level == Level::SSE)  { sse::qualityStats(qual, n, threshold, stats); return stats; }
+#endif
+                scalar::qualityStats(qual, 0, n, threshold, stats);
+                return stats;
+            }
+
+            // convenience overloads for the views handed out by the alignment proxy
+            inline void decodeSequence(const htsSequenceView& seq, char * out) { decodeSequence(seq.packed(), seq.size(), out); }
+            inline void decodeSequence2Bit(const htsSequenceView& seq, uint8_t * out) { decodeSequence2Bit(seq.packed(), seq.size(), out); }
+            inline void reverseComplement(const htsSequenceView& seq, char * out) { reverseComplement(seq.packed(), seq.size(), out); }
+            inline auto baseQualityStats(const htsSpan<const uint8_t>& qual, uint8_t threshold) { return baseQualityStats(qual.data(), qual.size(), threshold); }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,585 @@
+// YiCppLib::HTSLibpp::Sort
+//
+// This file contains an external memory sort for bamRecords and bcfRecords,
+// and an N-way merge of inputs that are already sorted
+
+#include "htslibpp.h"
+#include "htslibpp_alignment.h"
+#include "htslibpp_variant.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_SORT
+#define YICPPLIB_HTSLIBPP_SORT
+
+// Records are sorted in chunks of bounded memory. Instead of moving records
+// around, a chunk sorts a compact array of {key, offset} entries: the key
+// is a 64 bit prefix of the sort order, so most comparisons never look at
+// the records, and the offset locates the record when two keys tie. The
+// entries of a chunk are sorted in slices on several threads, and the
+// slices are merged pairwise.
+//
+// A full chunk is written out in order as a temporary run, a BAM or BCF at
+// compression level 1. At the end of the input the runs are merged into
+// the output through a loser tree, which finds the next record with one
+// comparison per level of the tree. Input that fits in a single chunk is
+// written out directly and never touches the disk.
+//
+// The same loser tree merges inputs that are sorted already, provided
+// their headers agree. Records that compare equal keep their input order,
+// and records of different inputs that compare equal come out in the order
+// of the inputs.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        template<class RecT> class htsSorter;
+
+        // queryname is the lexicographic order of the read names, with the
+        // first read of a pair before the second
+        enum class htsSortOrder { COORDINATE, QUERYNAME };
+
+        // A tournament tree over k sources. beats(a, b) tells whether the
+        // current record of source a goes before that of source b. The
+        // winner sits at the root, and once it has moved on to its next
+        // record, replay only replays the matches on its way to the root.
+        template<class BeatsF> class htsLoserTree {
+            protected:
+                // m_tree[0] is the winner, m_tree[1..k) the losers of the
+                // inner nodes. the leaves k..2k-1 are the sources themselves
+                std::vector<size_t> m_tree;
+                BeatsF m_beats;
+
+                size_t build(size_t node) {
+                    if(node >= m_tree.size()) return node - m_tree.size();
+
+                    auto a = build(2 * node);
+                    auto b = build(2 * node + 1);
+                    if(m_beats(a, b)) { m_tree[node] = b; return a; }
+                    m_tree[node] = a;
+                    return b;
+                }
+
+            public:
+                htsLoserTree(size_t k, BeatsF beats): m_tree(k), m_beats(beats) {
+                    if(k > 0) m_tree[0] = build(1);
+                }
+
+                size_t winner() const { return m_tree[0]; }
+
+                void replay() {
+                    auto s = m_tree[0];
+                    for(auto node = (s + m_tree.size()) / 2; node > 0; node /= 2)
+                        if(m_beats(m_tree[node], s)) std::swap(m_tree[node], s);
+                    m_tree[0] = s;
+                }
+        };
+
+        // An input of a merge, which holds the current record of a file
+        template<class HeaderT, class RecT> struct htsMergeInput {
+            htsFile fp;
+            HeaderT hdr;
+            RecT rec;
+            int status;
+
+            htsMergeInput(const std::string& filename, RecT&& empty): fp(htsOpen(filename, "r")), rec(std::move(empty)), status(-2) {
+                if(fp.get() != nullptr) hdr = htsHeader<HeaderT>::read(fp);
+            }
+
+            bool good() const { return hdr.get() != nullptr && rec.get() != nullptr; }
+            bool live() const { return status >= 0; }
+            void next() { status = htsReader<RecT>::next(fp, hdr, rec.get()); }
+        };
+
+        // Merge inputs by calling emit(input) for the current record of
+        // one input after the other, in the order given by less(a, b).
+        // Every input has to hold its first record already. Returns 0, or
+        // -1 if emit or a read failed
+        template<class InputT, class LessF, class EmitF>
+        int htsMergeInputs(std::vector<InputT>& inputs, LessF&& less, EmitF&& emit) {
+            if(inputs.empty()) return 0;
+
+            // exhausted inputs lose every match, and ties go to the
+            // earlier input
+            auto beats = [&inputs, &less](size_t a, size_t b) {
+                if(!inputs[a].live()) return false;
+                if(!inputs[b].live()) return true;
+                if(less(inputs[a], inputs[b])) return true;
+                if(less(inputs[b], inputs[a])) return false;
+                return a < b;
+            };
+
+            htsLoserTree<decltype(beats)> tree(inputs.size(), beats);
+            for(auto w = tree.winner(); inputs[w].live(); w = tree.winner()) {
+                if(emit(inputs[w]) < 0) return -1;
+                inputs[w].next();
+                tree.replay();
+            }
+
+            for(auto& in : inputs) if(in.status < -1) return -1;
+            return 0;
+        }
+
+        // sort v on up to nThreads threads, each sorting a slice, then
+        // merge the slices pairwise. less has to be a strict total order
+        template<class T, class LessF> void htsParallelSort(std::vector<T>& v, LessF less, size_t nThreads) {
+            size_t n = std::max<size_t>(1, std::min(nThreads, v.size() / 4096));
+            std::vector<size_t> bounds;
+            for(size_t i = 0; i <= n; i++) bounds.push_back(v.size() * i / n);
+
+            auto slice = [&](size_t i) { return v.begin() + bounds[std::min(i, n)]; };
+
+            std::vector<std::thread> threads;
+            for(size_t i = 1; i < n; i++) threads.emplace_back([&, i]() { std::sort(slice(i), slice(i + 1), less); });
+            std::sort(slice(0), slice(1), less);
+            for(auto& t : threads) t.join();
+
+            for(size_t width = 1; width < n; width *= 2) {
+                threads.clear();
+                for(size_t i = 0; i + width < n; i += 2 * width)
+                    threads.emplace_back([&, i, width]() { std::inplace_merge(slice(i), slice(i + width), slice(i + 2 * width), less); });
+                for(auto& t : threads) t.join();
+            }
+        }
+    }
+}
+
+// --- BAM SORTER --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // A chunk keeps its records in an arena, each as its bam1_core_t,
+        // its data length and its data, padded to 8 bytes. Records are
+        // written straight from the arena, without being copied back into
+        // a bam1_t. The arena doubles as it fills, up to the memory budget,
+        // so a small input does not take the whole budget, and it keeps its
+        // capacity from one chunk to the next.
+        //
+        // The output header is a copy of the input header, with the SO tag
+        // of its @HD line set to the sort order.
+        template<> class htsSorter<bamRecord> {
+            protected:
+                struct entry { uint64_t key; uint64_t offset; };
+                using input = htsMergeInput<bamHeader, bamRecord>;
+
+                static const size_t recordHeader = (sizeof(bam1_core_t) + sizeof(uint32_t) + 7) & ~static_cast<size_t>(7);
+
+                bamHeader m_hdr;
+                htsSortOrder m_order;
+                size_t m_memory;
+                size_t m_nThreads;
+                std::string m_tmpPrefix;
+                htsThreadPool * m_pool;
+
+                std::vector<uint8_t> m_arena;
+                std::vector<entry> m_entries;
+                std::vector<std::string> m_runs;
+
+                static uint64_t coordinateKey(const bam1_t& rec) {
+                    uint64_t tid = rec.core.tid < 0 ? UINT32_MAX : static_cast<uint32_t>(rec.core.tid);
+                    uint64_t pos = rec.core.pos < 0 ? 0 : std::min<uint64_t>(rec.core.pos + 1, INT32_MAX);
+                    return tid << 32 | pos << 1 | (bam_is_rev(&rec) ? 1 : 0);
+                }
+
+                // the first 8 bytes of the name, big endian, so the keys
+                // compare like the names
+                static uint64_t nameKey(const bam1_t& rec) {
+                    const char * name = bam_get_qname(&rec);
+                    uint64_t key = 0;
+                    for(int i = 0; i < 8; i++) {
+                        key <<= 8;
+                        if(*name) key |= static_cast<uint8_t>(*name++);
+                    }
+                    return key;
+                }
+
+                uint64_t key(const bam1_t& rec) const {
+                    return m_order == htsSortOrder::COORDINATE ? coordinateKey(rec) : nameKey(rec);
+                }
+
+                bam1_t view(uint64_t offset) const {
+                    bam1_t rec;
+                    memset(&rec, 0, sizeof(rec));
+                    memcpy(&rec.core, &m_arena[offset], sizeof(bam1_core_t));
+
+                    uint32_t length;
+                    memcpy(&length, &m_arena[offset + sizeof(bam1_core_t)], sizeof(length));
+                    rec.l_data = length;
+                    rec.m_data = length;
+                    rec.data = const_cast<uint8_t *>(&m_arena[offset + recordHeader]);
+                    return rec;
+                }
+
+                bool less(const entry& a, const entry& b) const {
+                    if(a.key != b.key) return a.key < b.key;
+                    if(m_order == htsSortOrder::QUERYNAME) {
+                        auto c = compare(m_order, view(a.offset), view(b.offset));
+                        if(c != 0) return c < 0;
+                    }
+                    return a.offset < b.offset;
+                }
+
+                size_t used() const { return m_arena.size() + m_entries.size() * sizeof(entry); }
+
+                htsFile openOutput(const std::string& filename, htsOutputFormat format, int level) {
+                    if(m_pool != nullptr) return htsWriter<bamRecord>::open(filename, format, level, *m_pool);
+                    return htsWriter<bamRecord>::open(filename, format, level);
+                }
+
+                // sort the current chunk, write it out and empty it
+                int writeChunk(htsFile& fp) {
+                    htsParallelSort(m_entries, [this](const entry& a, const entry& b) { return less(a, b); }, m_nThreads);
+
+                    int retVal = 0;
+                    for(auto& e : m_entries) {
+                        auto rec = view(e.offset);
+                        if(htsWriter<bamRecord>::write(fp, m_hdr, rec) < 0) { retVal = -1; break; }
+                    }
+                    m_arena.clear();
+                    m_entries.clear();
+                    return retVal;
+                }
+
+                int spill() {
+                    m_runs.push_back(m_tmpPrefix + std::to_string(m_runs.size()) + ".bam");
+                    auto fp = openOutput(m_runs.back(), htsOutputFormat::BAM, 1);
+                    if(fp.get() == nullptr || htsWriter<bamRecord>::writeHeader(fp, m_hdr) < 0) return -1;
+                    return writeChunk(fp);
+                }
+
+                void removeRuns() {
+                    for(auto& run : m_runs) unlink(run.c_str());
+                    m_runs.clear();
+                }
+
+                static bool compatible(const bamHeader& a, const bamHeader& b) {
+                    if(a->n_targets != b->n_targets) return false;
+                    for(int32_t i = 0; i < a->n_targets; i++)
+                        if(a->target_len[i] != b->target_len[i] || strcmp(a->target_name[i], b->target_name[i]) != 0) return false;
+                    return true;
+                }
+
+            public:
+                static const size_t defaultMemory = static_cast<size_t>(512) << 20;
+
+                // the sort order on whole records. returns a negative
+                // number, zero or a positive number, like strcmp
+                static int compare(htsSortOrder order, const bam1_t& a, const bam1_t& b) {
+                    if(order == htsSortOrder::COORDINATE) {
+                        auto ka = coordinateKey(a), kb = coordinateKey(b);
+                        return ka < kb ? -1 : ka > kb;
+                    }
+
+                    auto c = strcmp(bam_get_qname(&a), bam_get_qname(&b));
+                    if(c != 0) return c;
+                    auto fa = a.core.flag & (BAM_FREAD1 | BAM_FREAD2), fb = b.core.flag & (BAM_FREAD1 | BAM_FREAD2);
+                    return fa < fb ? -1 : fa > fb;
+                }
+
+                // a copy of hdr with the SO tag of the @HD line set to
+                // order, adding an @HD line if there is none
+                static bamHeader sortedHeader(const bamHeader& hdr, htsSortOrder order) {
+                    bamHeader out{bam_hdr_dup(hdr.get())};
+                    if(out.get() == nullptr) return out;
+
+                    std::string text(out->text != nullptr ? out->text : "", out->l_text);
+                    std::string so = order == htsSortOrder::COORDINATE ? "coordinate" : "queryname";
+                    if(text.compare(0, 4, "@HD\t") == 0) {
+                        auto eol = std::min(text.find('\n'), text.size());
+                        auto tag = text.find("\tSO:");
+                        if(tag < eol) {
+                            auto end = std::min(text.find_first_of("\t\n", tag + 1), text.size());
+                            text.replace(tag + 4, end - tag - 4, so);
+                        }
+                        else text.insert(eol, "\tSO:" + so);
+                    }
+                    else text.insert(0, "@HD\tVN:1.4\tSO:" + so + "\n");
+
+                    auto buffer = static_cast<char *>(malloc(text.size() + 1));
+                    if(buffer == nullptr) return bamHeader{};
+                    memcpy(buffer, text.c_str(), text.size() + 1);
+                    free(out->text);
+                    out->text = buffer;
+                    out->l_text = text.size();
+                    return out;
+                }
+
+                // a chunk holds at most about memory bytes of records and
+                // entries, and is sorted on nThreads threads. temporary
+                // runs are named after tmpPrefix, which defaults to a name
+                // in $TMPDIR. the runs and the output are compressed on
+                // the thread pool if one is given
+                htsSorter(const bamHeader& hdr, htsSortOrder order = htsSortOrder::COORDINATE, size_t memory = defaultMemory,
+                        size_t nThreads = 1, const std::string& tmpPrefix = "", htsThreadPool * pool = nullptr):
+                    m_hdr(sortedHeader(hdr, order)), m_order(order), m_memory(memory), m_nThreads(std::max<size_t>(1, nThreads)),
+                    m_tmpPrefix(tmpPrefix.empty() ? htsTempPrefix("sort", this) : tmpPrefix), m_pool(pool) {}
+
+                htsSorter(const htsSorter&) = delete;
+                htsSorter& operator=(const htsSorter&) = delete;
+
+                ~htsSorter() { removeRuns(); }
+
+                const bamHeader& header() const { return m_hdr; }
+                size_t runs() const { return m_runs.size(); }
+
+                // add a record, spilling the current chunk first if the
+                // record does not fit. returns 0, or -1 if the spill failed
+                int push(const bam1_t& rec) {
+                    auto size = (recordHeader + rec.l_data + 7) & ~static_cast<size_t>(7);
+                    if(!m_entries.empty() && used() + size + sizeof(entry) > m_memory && spill() < 0) return -1;
+                    auto offset = m_arena.size();
+                    if(offset + size > m_arena.capacity()) {
+                        auto capacity = std::min(std::max<size_t>(2 * m_arena.capacity(), 1 << 16), m_memory);
+                        m_arena.reserve(std::max(capacity, offset + size));
+                    }
+                    m_arena.resize(offset + size);
+                    uint32_t length = rec.l_data;
+                    memcpy(&m_arena[offset], &rec.core, sizeof(bam1_core_t));
+                    memcpy(&m_arena[offset + sizeof(bam1_core_t)], &length, sizeof(length));
+                    memcpy(&m_arena[offset + recordHeader], rec.data, length);
+
+                    m_entries.push_back(entry{key(rec), offset});
+                    return 0;
+                }
+
+                int push(const bamRecord& rec) { return push(*rec); }
+
+                // add every record of a range, such as htsReader<bamRecord>::range
+                template<class RangeT> int consume(RangeT&& range) {
+                    for(auto& rec : range) if(push(rec) < 0) return -1;
+                    return 0;
+                }
+
+                // write every record pushed so far to filename, in order,
+                // and start over. returns 0, or -1 on failure
+                int finish(const std::string& filename, htsOutputFormat format = htsOutputFormat::BAM, int level = -1) {
+                    if(!m_runs.empty() && !m_entries.empty() && spill() < 0) { removeRuns(); return -1; }
+
+                    auto fp = openOutput(filename, format, level);
+                    if(fp.get() == nullptr || htsWriter<bamRecord>::writeHeader(fp, m_hdr) < 0) { removeRuns(); return -1; }
+                    if(m_runs.empty()) return writeChunk(fp);
+
+                    std::vector<input> inputs;
+                    for(auto& run : m_runs) {
+                        inputs.emplace_back(run, bamRecord{bam_init1()});
+                        if(!inputs.back().good()) { removeRuns(); return -1; }
+                        inputs.back().next();
+                    }
+
+                    auto order = m_order;
+                    auto retVal = htsMergeInputs(inputs,
+                            [order](const input& a, const input& b) { return compare(order, *a.rec, *b.rec) < 0; },
+                            [&](const input& in) { return htsWriter<bamRecord>::write(fp, m_hdr, in.rec); });
+                    removeRuns();
+                    return retVal;
+                }
+
+                // --- N-WAY MERGE --- //
+
+                // merge BAM files that are each sorted in order into
+                // output. all inputs have to share the same reference
+                // sequences, and the output takes the header of the first
+                // input. returns 0, or -1 if the headers disagree or on
+                // failure
+                static int merge(const std::vector<std::string>& filenames, const std::string& output,
+                        htsSortOrder order = htsSortOrder::COORDINATE, htsOutputFormat format = htsOutputFormat::BAM, int level = -1,
+                        htsThreadPool * pool = nullptr) {
+
+                    std::vector<input> inputs;
+                    for(auto& filename : filenames) {
+                        inputs.emplace_back(filename, bamRecord{bam_init1()});
+                        if(!inputs.back().good() || !compatible(inputs.front().hdr, inputs.back().hdr)) return -1;
+                        inputs.back().next();
+                    }
+                    if(inputs.empty()) return -1;
+
+                    auto hdr = sortedHeader(inputs.front().hdr, order);
+                    auto fp = pool != nullptr ? htsWriter<bamRecord>::open(output, format, level, *pool) : htsWriter<bamRecord>::open(output, format, level);
+                    if(hdr.get() == nullptr || fp.get() == nullptr || htsWriter<bamRecord>::writeHeader(fp, hdr) < 0) return -1;
+
+                    return htsMergeInputs(inputs,
+                            [order](const input& a, const input& b) { return compare(order, *a.rec, *b.rec) < 0; },
+                            [&](const input& in) { return htsWriter<bamRecord>::write(fp, hdr, in.rec); });
+                }
+        };
+    }
+}
+
+// --- BCF SORTER --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // Variants are only ever sorted by position. A chunk keeps its
+        // records as pooled copies, and the offset of an entry is the slot
+        // of its record. Copies are packed, so a record costs about the
+        // size of its shared and per-sample buffers.
+        //
+        // htslib adds contigs that are missing from the header while it
+        // reads, so the sorter refers to the header of the input rather
+        // than copying it, and the header has to outlive the sorter.
+        template<> class htsSorter<bcfRecord> {
+            protected:
+                struct entry { uint64_t key; uint64_t offset; };
+                using input = htsMergeInput<bcfHeader, bcfRecord>;
+
+                const bcfHeader& m_hdr;
+                size_t m_memory;
+                size_t m_nThreads;
+                std::string m_tmpPrefix;
+                htsThreadPool * m_pool;
+
+                std::vector<bcfPooledRecord> m_records;
+                std::vector<entry> m_entries;
+                size_t m_used;
+                std::vector<std::string> m_runs;
+
+                static uint64_t key(const bcf1_t& rec) {
+                    return static_cast<uint64_t>(static_cast<uint32_t>(rec.rid)) << 32 | static_cast<uint32_t>(rec.pos);
+                }
+
+                static size_t footprint(const bcf1_t& rec) {
+                    return sizeof(bcf1_t) + sizeof(entry) + rec.shared.m + rec.indiv.m;
+                }
+
+                htsFile openOutput(const std::string& filename, htsOutputFormat format, int level) {
+                    if(m_pool != nullptr) return htsWriter<bcfRecord>::open(filename, format, level, *m_pool);
+                    return htsWriter<bcfRecord>::open(filename, format, level);
+                }
+
+                int writeChunk(htsFile& fp) {
+                    htsParallelSort(m_entries, [](const entry& a, const entry& b) {
+                        return a.key != b.key ? a.key < b.key : a.offset < b.offset;
+                    }, m_nThreads);
+
+                    int retVal = 0;
+                    for(auto& e : m_entries)
+                        if(htsWriter<bcfRecord>::write(fp, m_hdr, *m_records[e.offset]) < 0) { retVal = -1; break; }
+                    m_records.clear();
+                    m_entries.clear();
+                    m_used = 0;
+                    return retVal;
+                }
+
+                int spill() {
+                    m_runs.push_back(m_tmpPrefix + std::to_string(m_runs.size()) + ".bcf");
+                    auto fp = openOutput(m_runs.back(), htsOutputFormat::BCF, 1);
+                    if(fp.get() == nullptr || htsWriter<bcfRecord>::writeHeader(fp, m_hdr) < 0) return -1;
+                    return writeChunk(fp);
+                }
+
+                void removeRuns() {
+                    for(auto& run : m_runs) unlink(run.c_str());
+                    m_runs.clear();
+                }
+
+                // records are stored with the numeric ids of their header,
+                // so the ids of contigs, samples and of INFO, FORMAT and
+                // FILTER fields all have to agree
+                static bool compatible(const bcfHeader& a, const bcfHeader& b) {
+                    for(int type : {BCF_DT_ID, BCF_DT_CTG, BCF_DT_SAMPLE}) {
+                        if(a->n[type] != b->n[type]) return false;
+                        for(int32_t i = 0; i < a->n[type]; i++) {
+                            auto ka = bcf_hdr_int2id(a.get(), type, i), kb = bcf_hdr_int2id(b.get(), type, i);
+                            if((ka == nullptr) != (kb == nullptr) || (ka != nullptr && strcmp(ka, kb) != 0)) return false;
+                        }
+                    }
+                    return true;
+                }
+
+            public:
+                static const size_t defaultMemory = static_cast<size_t>(512) << 20;
+
+                static int compare(const bcf1_t& a, const bcf1_t& b) {
+                    auto ka = key(a), kb = key(b);
+                    return ka < kb ? -1 : ka > kb;
+                }
+
+                htsSorter(const bcfHeader& hdr, size_t memory = defaultMemory, size_t nThreads = 1,
+                        const std::string& tmpPrefix = "", htsThreadPool * pool = nullptr):
+                    m_hdr(hdr), m_memory(memory), m_nThreads(std::max<size_t>(1, nThreads)),
+                    m_tmpPrefix(tmpPrefix.empty() ? htsTempPrefix("sort", this) : tmpPrefix), m_pool(pool), m_used(0) {}
+
+                htsSorter(const htsSorter&) = delete;
+                htsSorter& operator=(const htsSorter&) = delete;
+
+                ~htsSorter() { removeRuns(); }
+
+                size_t runs() const { return m_runs.size(); }
+
+                int push(const bcf1_t& rec) {
+                    auto copy = htsRecordPool<bcfRecord>::dup(rec);
+                    if(!copy) return -1;
+
+                    auto size = footprint(*copy);
+                    if(!m_entries.empty() && m_used + size > m_memory && spill() < 0) return -1;
+
+                    m_entries.push_back(entry{key(*copy), m_records.size()});
+                    m_records.push_back(std::move(copy));
+                    m_used += size;
+                    return 0;
+                }
+
+                int push(const bcfRecord& rec) { return push(*rec); }
+
+                template<class RangeT> int consume(RangeT&& range) {
+                    for(auto& rec : range) if(push(rec) < 0) return -1;
+                    return 0;
+                }
+
+                int finish(const std::string& filename, htsOutputFormat format = htsOutputFormat::BCF, int level = -1) {
+                    if(!m_runs.empty() && !m_entries.empty() && spill() < 0) { removeRuns(); return -1; }
+
+                    auto fp = openOutput(filename, format, level);
+                    if(fp.get() == nullptr || htsWriter<bcfRecord>::writeHeader(fp, m_hdr) < 0) { removeRuns(); return -1; }
+                    if(m_runs.empty()) return writeChunk(fp);
+
+                    std::vector<input> inputs;
+                    for(auto& run : m_runs) {
+                        inputs.emplace_back(run, bcfRecord{bcf_init()});
+                        if(!inputs.back().good()) { removeRuns(); return -1; }
+                        inputs.back().next();
+                    }
+
+                    auto retVal = htsMergeInputs(inputs,
+                            [](const input& a, const input& b) { return compare(*a.rec, *b.rec) < 0; },
+                            [&](input& in) { return htsWriter<bcfRecord>::write(fp, m_hdr, in.rec); });
+                    removeRuns();
+                    return retVal;
+                }
+
+                // --- N-WAY MERGE --- //
+
+                // merge position sorted VCF or BCF files into output. the
+                // output takes the header of the first input. the headers
+                // are compared once the first record of every input has
+                // been read, since reading it may add its contig to the
+                // header
+                static int merge(const std::vector<std::string>& filenames, const std::string& output,
+                        htsOutputFormat format = htsOutputFormat::BCF, int level = -1, htsThreadPool * pool = nullptr) {
+
+                    std::vector<input> inputs;
+                    for(auto& filename : filenames) {
+                        inputs.emplace_back(filename, bcfRecord{bcf_init()});
+                        if(!inputs.back().good()) return -1;
+                        inputs.back().next();
+                    }
+                    if(inputs.empty()) return -1;
+                    for(auto& in : inputs) if(!compatible(inputs.front().hdr, in.hdr)) return -1;
+
+                    auto& hdr = inputs.front().hdr;
+                    auto fp = pool != nullptr ? htsWriter<bcfRecord>::open(output, format, level, *pool) : htsWriter<bcfRecord>::open(output, format, level);
+                    if(fp.get() == nullptr || htsWriter<bcfRecord>::writeHeader(fp, hdr) < 0) return -1;
+
+                    return htsMergeInputs(inputs,
+                            [](const input& a, const input& b) { return compare(*a.rec, *b.rec) < 0; },
+                            [&](input& in) { return htsWriter<bcfRecord>::write(fp, hdr, in.rec); });
+                }
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,224 @@
+// YiCppLib::HTSLibpp::Sweep
+//
+// This file contains a sweep-join engine, which walks a position sorted
+// stream of variant sites and a position sorted stream of alignments
+// together, and hands every site over with the reads that overlap it
+
+#include "htslibpp.h"
+#include "htslibpp_alignment.h"
+#include "htslibpp_variant.h"
+#include "htslibpp_pileup.h"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_SWEEP
+#define YICPPLIB_HTSLIBPP_SWEEP
+
+// Reads are pulled from the alignment stream only as far as the end of the
+// current site, and held in a window of pooled copies until the sites move
+// past their end. Each read is therefore read and decoded once, however
+// many sites it overlaps, instead of once per region query.
+//
+// Sites are placed on the alignment stream by contig name, looked up in the
+// alignment header the first time a contig comes by. A name that is not
+// found is tried again with its "chr" prefix added or removed. Sites on
+// contigs the alignments do not have are handed over with no reads.
+//
+// With an index the engine seeks instead of reading through a gap, when the
+// next site lies more than seekGap bases beyond the stream, or on a later
+// contig. It also seeks back when the sites visit the contigs in another
+// order than the alignments do. Without an index the two orders have to
+// agree, and a site that the alignment stream has already passed is an
+// error. Sites have to be sorted by position within a contig either way.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        class htsSweepJoin {
+            protected:
+                using recordPool = htsRecordPool<bamRecord>;
+
+                struct active {
+                    int64_t end;
+                    bamPooledRecord rec;
+                };
+
+                static const int32_t unmapped = -2;
+
+                htsFile& m_fp;
+                const bamHeader& m_hdr;
+                htsIndex * m_idx;
+                htsPileupFilter m_filter;
+                int64_t m_seekGap;
+
+                htsIterator m_iter;
+                bamPooledRecord m_ahead;
+                bool m_started;
+                bool m_exhausted;
+
+                // the window holds reads of m_tid in position order
+                std::vector<active> m_window;
+                std::vector<const bam1_t *> m_overlaps;
+                int32_t m_tid;
+                int64_t m_pos;
+
+                // vcf rid to bam tid, unmapped until looked up
+                std::vector<int32_t> m_contigs;
+
+                size_t m_seeks;
+                size_t m_loaded;
+
+                static int64_t position(int32_t tid, int64_t pos) { return (static_cast<int64_t>(tid) << 32) + pos; }
+                static int64_t position(const bam1_t& rec) { return position(rec.core.tid, rec.core.pos); }
+
+                int32_t target(const bcfHeader& hdr, int rid) {
+                    if(rid < 0) return -1;
+                    if(static_cast<size_t>(rid) >= m_contigs.size()) m_contigs.resize(rid + 1, unmapped);
+                    if(m_contigs[rid] != unmapped) return m_contigs[rid];
+
+                    const char * name = bcf_hdr_id2name(hdr.get(), rid);
+                    int32_t tid = bam_name2id(m_hdr.get(), name);
+                    if(tid < 0) {
+                        std::string alias = strncmp(name, "chr", 3) == 0 ? std::string(name + 3) : "chr" + std::string(name);
+                        tid = bam_name2id(m_hdr.get(), alias.c_str());
+                    }
+                    return m_contigs[rid] = tid < 0 ? -1 : tid;
+                }
+
+                // the next read that passes the filter into m_ahead. reads
+                // without a reference end the stream
+                void advance() {
+                    m_ahead.reset();
+                    while(!m_exhausted) {
+                        auto rec = recordPool::acquire();
+                        int retVal = m_iter.get() != nullptr ?
+                            htsReader<bamRecord>::next(m_fp, m_iter.get(), rec.get()) :
+                            htsReader<bamRecord>::next(m_fp, m_hdr, rec.get());
+
+                        if(retVal < 0 || rec->core.tid < 0) { m_exhausted = true; return; }
+                        if(!m_filter.pass(*rec)) continue;
+
+                        m_ahead = std::move(rec);
+                        return;
+                    }
+                }
+
+                // restart the stream at the reads overlapping pos onwards
+                bool seek(int32_t tid, int64_t pos) {
+                    m_window.clear();
+                    m_iter.reset(sam_itr_queryi(m_idx->get(), tid, pos, m_hdr->target_len[tid]));
+                    m_exhausted = m_iter.get() == nullptr;
+                    m_seeks++;
+                    advance();
+                    return m_iter.get() != nullptr;
+                }
+
+                // move onto the site at [pos, end) of tid. returns false if
+                // the stream cannot get there
+                bool reach(int32_t tid, int64_t pos, int64_t end) {
+                    if(!m_started) {
+                        m_started = true;
+                        advance();
+                    }
+
+                    if(tid != m_tid) {
+                        bool behind = m_tid >= 0 && tid < m_tid;
+                        m_window.clear();
+                        m_tid = tid;
+                        m_pos = pos;
+
+                        // the contig was passed, or an iterator only covers
+                        // the previous one
+                        if(behind || m_iter.get() != nullptr) {
+                            if(m_idx == nullptr) return false;
+                            if(!seek(tid, pos)) return false;
+                        }
+                    }
+                    else if(pos < m_pos) return false;
+                    m_pos = pos;
+
+                    if(m_idx != nullptr && m_ahead && position(*m_ahead) + m_seekGap < position(tid, pos))
+                        if(!seek(tid, pos)) return false;
+
+                    // retire the reads the sites have moved past. the window
+                    // is sorted by start, not by end, so all of it is checked
+                    m_window.erase(std::remove_if(m_window.begin(), m_window.end(), [=](const active& a) { return a.end <= pos; }), m_window.end());
+
+                    // reads on earlier contigs belong to no site
+                    while(m_ahead && position(*m_ahead) < position(tid, end)) {
+                        if(m_ahead->core.tid == tid) {
+                            int64_t readEnd = bam_endpos(m_ahead.get());
+                            if(readEnd > pos) {
+                                m_window.push_back(active{readEnd, std::move(m_ahead)});
+                                m_loaded++;
+                            }
+                        }
+                        advance();
+                    }
+                    return true;
+                }
+
+            public:
+                static const int64_t defaultSeekGap = 1 << 20;
+
+                // idx may be null, in which case the alignments are read
+                // through from the current position of fp
+                htsSweepJoin(htsFile& fp, const bamHeader& hdr, htsIndex * idx = nullptr,
+                        const htsPileupFilter& filter = htsPileupFilter{}, int64_t seekGap = defaultSeekGap):
+                    m_fp(fp), m_hdr(hdr), m_idx(idx), m_filter(filter), m_seekGap(seekGap),
+                    m_started(false), m_exhausted(false), m_tid(-1), m_pos(0), m_seeks(0), m_loaded(0) {}
+
+                htsSweepJoin(const htsSweepJoin&) = delete;
+                htsSweepJoin& operator=(const htsSweepJoin&) = delete;
+
+                const htsPileupFilter& filter() const { return m_filter; }
+                size_t window() const { return m_window.size(); }
+                size_t seeks() const  { return m_seeks; }
+
+                // reads that made it into the window, over all sites
+                size_t loaded() const { return m_loaded; }
+
+                // join the next site. emit(site, reads) receives the site and
+                // the reads overlapping its reference alleles, in position
+                // order; the reads are only valid during the call. returns
+                // the number of reads, or -1 if the site is out of order
+                template<class EmitF> int push(const bcf1_t& site, const bcfHeader& hdr, EmitF&& emit) {
+                    m_overlaps.clear();
+
+                    auto tid = target(hdr, site.rid);
+                    int64_t beg = site.pos;
+                    int64_t end = beg + (site.rlen > 0 ? site.rlen : 1);
+
+                    if(tid >= 0) {
+                        if(!reach(tid, beg, end)) return -1;
+                        for(auto& a : m_window)
+                            if(a.rec->core.pos < end) m_overlaps.push_back(a.rec.get());
+                    }
+
+                    emit(site, htsSpan<const bam1_t * const>(m_overlaps.data(), m_overlaps.size()));
+                    return static_cast<int>(m_overlaps.size());
+                }
+
+                template<class EmitF> int push(const bcfRecord& site, const bcfHeader& hdr, EmitF&& emit) {
+                    return push(*site, hdr, std::forward<EmitF>(emit));
+                }
+
+                // join every site of a variant file. returns the number of
+                // sites, or -1 if one was out of order
+                template<class EmitF> int64_t run(htsFile& fp, const bcfHeader& hdr, EmitF&& emit) {
+                    bcfRecord site{bcf_init()};
+                    int64_t sites = 0;
+                    while(htsReader<bcfRecord>::next(fp, hdr, site.get()) >= 0) {
+                        if(push(*site, hdr, emit) < 0) return -1;
+                        sites++;
+                    }
+                    return sites;
+                }
+        };
+    }
+}
+
+#endif
@@ -4,6 +4,13 @@
 // in htslib
 
 #include "htslibpp.h"
+#include <htslib/tbx.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
 
 #ifndef YICPPLIB_HTSLIBPP_BCF
 #define YICPPLIB_HTSLIBPP_BCF
@@ -89,6 +96,24 @@ namespace YiCppLib {
                         return static_cast<bcf_idpair_t *>(nullptr);
                 }
             }
+
+            // INFO and FORMAT tags share one dictionary. Looking a tag up by
+            // its name is a hash lookup, so hot loops should resolve the
+            // numeric id once and use that with the record proxy. Returns -1
+            // if the tag is not defined in the header
+            static inline int tagID(const bcfHeader& hdr, const std::string& key) {
+                return bcf_hdr_id2int(hdr.get(), BCF_DT_ID, key.c_str());
+            }
+
+            // Restrict the samples that records are decoded for. This has to
+            // happen before any record is read, and the sample dictionary of
+            // the header shrinks to the subset. Returns 0 on success, or the
+            // 1-based position of the first sample not in the header
+            static inline int setSamples(bcfHeader& hdr, const std::vector<std::string>& samples) {
+                std::string list;
+                for(const auto& sample : samples) list += (list.empty() ? "" : ",") + sample;
+                return bcf_hdr_set_samples(hdr.get(), list.c_str(), 0);
+            }
         };
    
         // Now let's get to actually reading records from a bcf / vcf file.
@@ -98,10 +123,27 @@ namespace YiCppLib {
         // being freshly allocated or not, is provided to the read function.
         using bcfRecord = HTS_UPTR(::bcf1_t, bcf_destroy);
 
+        // Records can be looked up by region once the file is indexed. BCF
+        // files carry a .csi index, which is opened as a htsIndex, and
+        // bgzipped VCF files carry a tabix index
+        using tbxIndex = HTS_UPTR(::tbx_t, tbx_destroy);
+
+        inline auto bcfIndexOpen(const std::string& filename) { return htsIndex(bcf_index_load(filename.c_str())); }
+        inline auto tbxIndexOpen(const std::string& filename) { return tbxIndex(tbx_index_load(filename.c_str())); }
+
         template<> struct htsReader<bcfRecord> {
+            // the htslib read call that every iterator and batch goes
+            // through, so that it can be probed when instrumented
+            static inline int next(htsFile& fp, const bcfHeader& hdr, bcf1_t * rec) {
+                htsProbe probe(fp.get());
+                auto retVal = bcf_read(fp.get(), hdr.get(), rec);
+                probe.read(retVal, rec->shared.l + rec->indiv.l);
+                return retVal;
+            }
+
             // Read the next bcf record form the file.
             static inline void read(htsFile& fp, const bcfHeader& hdr, bcfRecord& rec) {
-                auto retVal = bcf_read(fp.get(), hdr.get(), rec.get());
+                auto retVal = next(fp, hdr, rec.get());
                 if(retVal == -1) rec.reset(nullptr);
             }
 
@@ -126,10 +168,484 @@ namespace YiCppLib {
 
             static iterator begin(htsFile& fp, const bcfHeader& hdr) { return iterator{fp, hdr}; }
             static iterator end(htsFile& fp, const bcfHeader& hdr)   { return iterator{fp, hdr, std::move(bcfRecord{nullptr})}; }
+
+            // --- INDEXED QUERIES --- //
+
+            // A BCF file is indexed by a .csi, whose reference ids are the
+            // same as the contig ids of the header. A bgzipped VCF file is
+            // indexed by tabix, which keeps its own dictionary of names.
+            // Each of them is wrapped up in a query source, which knows how to
+            // look up a contig, start a query, and read the next record.
+            struct bcf_index_source {
+                htsIndex& idx;
+                const bcfHeader& hdr;
+
+                bcf_index_source(htsIndex& idx, const bcfHeader& hdr): idx(idx), hdr(hdr) {}
+
+                int tid(const char * name) { return bcf_hdr_name2id(hdr.get(), name); }
+                hts_itr_t * query(const htsRegion& r) { return bcf_itr_queryi(idx.get(), r.tid, r.beg, r.end); }
+                int next(htsFile& fp, hts_itr_t * iter, bcf1_t * rec) {
+                    htsProbe probe(fp.get(), iter);
+                    auto retVal = bcf_itr_next(fp.get(), iter, rec);
+                    probe.read(retVal, rec->shared.l + rec->indiv.l);
+                    // unlike bcf_read, reading through an index does not subset samples
+                    if(retVal >= 0 && hdr->keep_samples != nullptr) bcf_subset_format(hdr.get(), rec);
+                    return retVal;
+                }
+            };
+
+            struct tbx_index_source {
+                tbxIndex& tbx;
+                const bcfHeader& hdr;
+                kstring_t line;
+
+                tbx_index_source(tbxIndex& tbx, const bcfHeader& hdr): tbx(tbx), hdr(hdr), line{0, 0, nullptr} {}
+                tbx_index_source(tbx_index_source&& other): tbx(other.tbx), hdr(other.hdr), line(other.line) { other.line = kstring_t{0, 0, nullptr}; }
+                tbx_index_source(const tbx_index_source&) = delete;
+                ~tbx_index_source() { free(line.s); }
+
+                int tid(const char * name) { return tbx_name2id(tbx.get(), name); }
+                hts_itr_t * query(const htsRegion& r) { return tbx_itr_queryi(tbx.get(), r.tid, r.beg, r.end); }
+                int next(htsFile& fp, hts_itr_t * iter, bcf1_t * rec) {
+                    htsProbe probe(fp.get(), iter);
+                    auto retVal = tbx_itr_next(fp.get(), tbx.get(), iter, &line);
+                    if(retVal >= 0) retVal = vcf_parse(&line, hdr.get(), rec);
+                    probe.read(retVal, line.l);
+                    return retVal;
+                }
+            };
+
+            // resolve region strings against the dictionary of a query source
+            template<class SourceT>
+            static auto regions(SourceT&& source, const std::vector<std::string>& regions_s) {
+                std::vector<htsRegion> resolved;
+                for(const auto& r : regions_s) {
+                    int beg = 0, end = 0;
+                    const char * name_end = hts_parse_reg(r.c_str(), &beg, &end);
+                    if(name_end == nullptr) continue;
+
+                    std::string name(r.c_str(), name_end);
+                    resolved.push_back(htsRegion{source.tid(name.c_str()), beg, end});
+                }
+                return htsMergeRegions(std::move(resolved));
+            }
+
+            // region iterator
+            //
+            // Walks a sorted list of regions with a single bcf1_t. Regions that
+            // are close to each other share one index query, records that only
+            // fall between regions are skipped, and a record that overlaps
+            // several regions is yielded only once.
+            template<class SourceT>
+            struct iterator_r : public bcf_iterator_base {
+                protected:
+                    SourceT source;
+                    const std::vector<htsRegion>& targets;
+                    const std::vector<htsRegion>& queries;
+                    size_t nextQuery;
+                    size_t target;
+                    htsIterator bcf_iter;
+
+                    // a record already returned by the previous query
+                    bool seen() const {
+                        if(nextQuery < 2) return false;
+                        const auto& prev = queries[nextQuery - 2];
+                        return prev.tid == queries[nextQuery - 1].tid && rec->pos < prev.end;
+                    }
+
+                    // does the record overlap any region. reference ids of the
+                    // tabix dictionary may differ from those of the header, so
+                    // the id of the current query is used
+                    bool wanted() {
+                        int tid = queries[nextQuery - 1].tid;
+                        while(target < targets.size() && (targets[target].tid < tid ||
+                                    (targets[target].tid == tid && targets[target].end <= rec->pos))) target++;
+
+                        return target < targets.size() && targets[target].tid == tid && targets[target].beg < rec->pos + std::max(rec->rlen, 1);
+                    }
+
+                    virtual void advance() {
+                        if(rec.get() == nullptr) return;
+
+                        while(true) {
+                            if(bcf_iter.get() != nullptr && source.next(fp, bcf_iter.get(), rec.get()) >= 0) {
+                                if(!seen() && wanted()) return;
+                                continue;
+                            }
+
+                            if(nextQuery >= queries.size()) { rec.reset(nullptr); return; }
+                            bcf_iter.reset(source.query(queries[nextQuery++]));
+                        }
+                    }
+
+                public:
+                    iterator_r(htsFile& fp, SourceT&& source, const std::vector<htsRegion>& targets, const std::vector<htsRegion>& queries, bcfRecord&& rec):
+                        bcf_iterator_base(fp, std::move(rec)), source(std::move(source)), targets(targets), queries(queries), nextQuery(0), target(0), bcf_iter(nullptr) { advance(); }
+            };
+
+            // --- RANGE EXPRESSIONS --- //
+            struct bcf_range_s {
+                protected:
+                    htsFile& fp;
+                    const bcfHeader& hdr;
+                public:
+                    bcf_range_s(htsFile& fp, const bcfHeader& hdr): fp(fp), hdr(hdr) {}
+                    auto begin() { return htsReader<bcfRecord>::begin(fp, hdr); }
+                    auto end()   { return htsReader<bcfRecord>::end(fp, hdr); }
+            };
+
+            template<class IndexT, class SourceT>
+            struct bcf_range_r {
+                protected:
+                    htsFile& fp;
+                    const bcfHeader& hdr;
+                    IndexT& idx;
+                    std::vector<htsRegion> targets;
+                    std::vector<htsRegion> queries;
+
+                public:
+                    // regions closer than mergeGap bases share one index query
+                    static const int defaultMergeGap = 1024;
+
+                    bcf_range_r(htsFile& fp, const bcfHeader& hdr, IndexT& idx, const std::vector<std::string>& regions, int mergeGap = defaultMergeGap):
+                        fp(fp), hdr(hdr), idx(idx), targets(htsReader<bcfRecord>::regions(SourceT(idx, hdr), regions)), queries(htsMergeRegions(targets, mergeGap)) {}
+
+                    auto begin() { return iterator_r<SourceT>(fp, SourceT(idx, hdr), targets, queries, bcfRecord{bcf_init()}); }
+                    auto end()   { return iterator_r<SourceT>(fp, SourceT(idx, hdr), targets, queries, bcfRecord{nullptr}); }
+            };
+
+            static inline auto range(htsFile& fp, const bcfHeader& hdr) { return bcf_range_s(fp, hdr); }
+
+            static inline auto range(htsFile& fp, const bcfHeader& hdr, htsIndex& idx, const std::vector<std::string>& regions) {
+                return bcf_range_r<htsIndex, bcf_index_source>(fp, hdr, idx, regions);
+            }
+            static inline auto range(htsFile& fp, const bcfHeader& hdr, htsIndex& idx, const std::string& region) {
+                return range(fp, hdr, idx, std::vector<std::string>{region});
+            }
+            static inline auto range(htsFile& fp, const bcfHeader& hdr, tbxIndex& tbx, const std::vector<std::string>& regions) {
+                return bcf_range_r<tbxIndex, tbx_index_source>(fp, hdr, tbx, regions);
+            }
+            static inline auto range(htsFile& fp, const bcfHeader& hdr, tbxIndex& tbx, const std::string& region) {
+                return range(fp, hdr, tbx, std::vector<std::string>{region});
+            }
+
+            // --- PROJECTED READS --- //
+
+            // The unpack level of a projection. VCF text is parsed no
+            // further than the last column of that level, so that e.g. the
+            // per-sample columns are skipped unless htsField::Format is
+            // projected. QUAL sits behind ALT, which is why FILTER is always
+            // parsed along with the alleles. Without htsField::Info, the
+            // reference length comes from REF alone, not from INFO/END
+            template<class FieldsT> static constexpr int unpackLevel() {
+                return BCF_UN_STR | BCF_UN_FLT |
+                       (FieldsT::template has<htsField::Info>()   ? BCF_UN_INFO : 0) |
+                       (FieldsT::template has<htsField::Format>() ? BCF_UN_FMT : 0);
+            }
+
+            // read the whole file under a projection. the range yields
+            // HTSProjection<const bcf1_t &, FieldsT>. A sample list
+            // restricts FORMAT to those samples, as setSamples does; if a
+            // sample is not in the header, the range is empty
+            template<class FieldsT> static inline auto projected(htsFile& fp, bcfHeader& hdr, const std::vector<std::string>& samples = {}) {
+                bcfRecord rec{bcf_init()};
+                if(rec.get() != nullptr) rec->max_unpack = unpackLevel<FieldsT>();
+                if(!samples.empty() && htsHeader<bcfHeader>::setSamples(hdr, samples) != 0) rec.reset(nullptr);
+
+                auto next = [&fp, &hdr](bcf1_t * rec) { return htsReader<bcfRecord>::next(fp, hdr, rec); };
+                return htsProjectedRange<bcfRecord, HTSProjection<const bcf1_t &, FieldsT>, decltype(next)>(std::move(rec), std::move(next));
+            }
+        };
+    }
+}
+
+// --- BCF HEADER INDEX --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // An immutable, pre-parsed view of a bcfHeader. Contigs, the
+        // INFO / FORMAT / FILTER tags and samples are resolved by name with
+        // a hash lookup, and the header lines are formatted once up front.
+        // It is meant to be shared read-only between threads through the
+        // shared_ptr build returns.
+        //
+        // Note that htslib adds contigs and tags to the header when it meets
+        // undeclared ones while parsing VCF text; an index built before that
+        // does not see them.
+        template<> struct htsHeaderIndex<bcfHeader> {
+            using LineType  = htsHeader<bcfHeader>::LineType;
+            using DataType  = htsHeader<bcfHeader>::DataType;
+            using VarLength = htsHeader<bcfHeader>::VarLength;
+
+            struct contig {
+                int rid;
+                uint32_t length;
+            };
+
+            struct tag {
+                int id;             // the tag id used by the record proxy
+                DataType type;
+                VarLength length;
+                int number;         // the count for VarLength::FIXED
+            };
+
+            protected:
+                std::unordered_map<std::string, contig> m_contigs;
+                std::unordered_map<std::string, tag> m_tags[3];
+                std::unordered_map<std::string, int> m_samples;
+                std::vector<std::string> m_lines;
+
+                // the tag table of a line type, -1 for the types that do not
+                // declare tags
+                static inline int slot(LineType type) {
+                    switch(type) {
+                        case LineType::FILTER: return BCF_HL_FLT;
+                        case LineType::INFO:   return BCF_HL_INFO;
+                        case LineType::FORMAT: return BCF_HL_FMT;
+                        default:               return -1;
+                    }
+                }
+
+                static inline DataType dataType(int type) {
+                    switch(type) {
+                        case BCF_HT_FLAG: return DataType::FLAG;
+                        case BCF_HT_INT:  return DataType::INT;
+                        case BCF_HT_REAL: return DataType::REAL;
+                        default:          return DataType::STRING;
+                    }
+                }
+
+                static inline VarLength varLength(int length) {
+                    switch(length) {
+                        case BCF_VL_FIXED: return VarLength::FIXED;
+                        case BCF_VL_A:     return VarLength::A;
+                        case BCF_VL_G:     return VarLength::G;
+                        case BCF_VL_R:     return VarLength::R;
+                        default:           return VarLength::VARIABLE;
+                    }
+                }
+
+                htsHeaderIndex(const bcfHeader& header) {
+                    const bcf_hdr_t * hdr = header.get();
+
+                    for(int i = 0; i < hdr->n[BCF_DT_CTG]; i++) {
+                        const auto& pair = hdr->id[BCF_DT_CTG][i];
+                        if(pair.key != nullptr) m_contigs.emplace(pair.key, contig{i, pair.val->info[0]});
+                    }
+
+                    for(int i = 0; i < hdr->n[BCF_DT_ID]; i++) {
+                        const auto& pair = hdr->id[BCF_DT_ID][i];
+                        if(pair.key == nullptr) continue;
+                        for(int hl : {BCF_HL_FLT, BCF_HL_INFO, BCF_HL_FMT}) {
+                            if(pair.val->hrec[hl] == nullptr) continue;
+                            m_tags[hl].emplace(pair.key, tag{i,
+                                    dataType(bcf_hdr_id2type(hdr, hl, i)),
+                                    varLength(bcf_hdr_id2length(hdr, hl, i)),
+                                    static_cast<int>(bcf_hdr_id2number(hdr, hl, i))});
+                        }
+                    }
+
+                    for(int i = 0; i < hdr->n[BCF_DT_SAMPLE]; i++)
+                        m_samples.emplace(hdr->id[BCF_DT_SAMPLE][i].key, i);
+
+                    kstring_t line{0, 0, nullptr};
+                    for(int i = 0; i < hdr->nhrec; i++) {
+                        line.l = 0;
+                        bcf_hrec_format(hdr->hrec[i], &line);
+                        if(line.l > 0 && line.s[line.l - 1] == '\n') line.l--;
+                        m_lines.emplace_back(line.s, line.l);
+                    }
+                    free(line.s);
+                }
+
+            public:
+                static std::shared_ptr<const htsHeaderIndex> build(const bcfHeader& header) {
+                    return std::shared_ptr<const htsHeaderIndex>(new htsHeaderIndex(header));
+                }
+
+                // the contig of a given name, nullptr if there is none
+                const contig * findContig(const std::string& name) const {
+                    auto it = m_contigs.find(name);
+                    return it != m_contigs.end() ? &it->second : nullptr;
+                }
+
+                int rid(const std::string& name) const {
+                    auto c = findContig(name);
+                    return c != nullptr ? c->rid : -1;
+                }
+
+                // the FILTER, INFO or FORMAT tag of a given name, nullptr if
+                // there is none or type is another line type
+                const tag * findTag(LineType type, const std::string& name) const {
+                    auto hl = slot(type);
+                    if(hl < 0) return nullptr;
+                    const auto& tags = m_tags[hl];
+                    auto it = tags.find(name);
+                    return it != tags.end() ? &it->second : nullptr;
+                }
+
+                // the column of a sample, -1 if there is none
+                int sample(const std::string& name) const {
+                    auto it = m_samples.find(name);
+                    return it != m_samples.end() ? it->second : -1;
+                }
+
+                size_t contigCount() const { return m_contigs.size(); }
+                size_t tagCount(LineType type) const { return slot(type) < 0 ? 0 : m_tags[slot(type)].size(); }
+                size_t sampleCount() const { return m_samples.size(); }
+
+                // the formatted header lines, without the #CHROM line
+                const std::vector<std::string>& lines() const { return m_lines; }
         };
     }
 }
 
+// --- BCF RECORD BATCHES --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // Same as htsBatch<bamRecord>, a fixed-capacity slab of bcf1_t
+        // structs whose internal buffers are kept between refills.
+        template<> struct htsBatch<bcfRecord> {
+            protected:
+                std::vector<bcf1_t> m_slab;
+                size_t m_size;
+
+            public:
+                htsBatch(size_t capacity = 4096): m_slab(capacity), m_size(0) {}
+                ~htsBatch() { for(auto& v : m_slab) bcf_empty(&v); }
+
+                htsBatch(const htsBatch&) = delete;
+                htsBatch& operator=(const htsBatch&) = delete;
+                htsBatch(htsBatch&& other): m_slab(std::move(other.m_slab)), m_size(other.m_size) { other.m_size = 0; }
+                htsBatch& operator=(htsBatch&& other) { std::swap(m_slab, other.m_slab); std::swap(m_size, other.m_size); return *this; }
+
+                // refill the batch sequentially from the file. returns the
+                // number of records read, which is 0 at the end of the file,
+                // or -1 on a read error
+                ssize_t fill(htsFile& fp, const bcfHeader& hdr) {
+                    for(m_size = 0; m_size < m_slab.size(); m_size++) {
+                        auto retVal = htsReader<bcfRecord>::next(fp, hdr, &m_slab[m_size]);
+                        if(retVal < -1) return -1;
+                        if(retVal < 0) break;
+                    }
+                    return m_size;
+                }
+
+                size_t size() const     { return m_size; }
+                size_t capacity() const { return m_slab.size(); }
+                bool empty() const      { return m_size == 0; }
+
+                bcf1_t * begin() { return m_slab.data(); }
+                bcf1_t * end()   { return m_slab.data() + m_size; }
+                bcf1_t& operator[](size_t i) { return m_slab[i]; }
+
+                auto span() { return htsSpan<bcf1_t>(m_slab.data(), m_size); }
+        };
+    }
+}
+
+// --- BCF WRITER --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // The writing counterpart of htsReader<bcfRecord>, see
+        // htsWriter<bamRecord> for how the pieces fit together. BCF files
+        // are indexed with a .csi, so minShift defaults to 14 here. Bgzipped
+        // VCF files get a .tbi from buildIndex by default, and a .csi when
+        // given a minShift other than 0.
+        template<> struct htsWriter<bcfRecord> {
+            static inline auto open(const std::string& filename, htsOutputFormat format = htsOutputFormat::BCF, int level = -1) {
+                return htsOpen(filename, htsWriteMode(format, level));
+            }
+
+            static inline auto open(const std::string& filename, htsOutputFormat format, int level, htsThreadPool& pool) {
+                return htsOpen(filename, htsWriteMode(format, level), pool);
+            }
+
+            static inline int writeHeader(htsFile& fp, const bcfHeader& hdr) {
+                return bcf_hdr_write(fp.get(), hdr.get());
+            }
+
+            // writing may pack pending edits of the record, hence non-const
+            static inline int write(htsFile& fp, const bcfHeader& hdr, bcf1_t& rec) {
+                return bcf_write(fp.get(), hdr.get(), &rec);
+            }
+
+            static inline int write(htsFile& fp, const bcfHeader& hdr, bcfRecord& rec) {
+                return write(fp, hdr, *rec);
+            }
+
+            // write every record of a batch. returns the number of records
+            // written, or -1 on the first failure
+            static inline int write(htsFile& fp, const bcfHeader& hdr, htsBatch<bcfRecord>& batch) {
+                for(auto& rec : batch) if(write(fp, hdr, rec) < 0) return -1;
+                return static_cast<int>(batch.size());
+            }
+
+            // start building a .csi index on the fly. htslib keeps a pointer
+            // to the index filename, so the string has to outlive the call to
+            // indexSave. needs htslib 1.10 or later; with older versions this
+            // and indexSave return -1, and the file has to be indexed with
+            // buildIndex once it is closed
+            static inline int indexInit(htsFile& fp, const bcfHeader& hdr, const std::string& indexFilename, int minShift = 14) {
+#if defined(HTS_VERSION) && HTS_VERSION >= 101000
+                return bcf_idx_init(fp.get(), hdr.get(), minShift, indexFilename.c_str());
+#else
+                return -1;
+#endif
+            }
+
+            static inline int indexSave(htsFile& fp) {
+#if defined(HTS_VERSION) && HTS_VERSION >= 101000
+                return bcf_idx_save(fp.get());
+#else
+                return -1;
+#endif
+            }
+
+            // index a closed file. a negative minShift picks the usual index
+            // of the format, a .tbi for VCF_GZ and a .csi with a minShift of
+            // 14 for BCF
+            static inline int buildIndex(const std::string& filename, htsOutputFormat format = htsOutputFormat::BCF, int minShift = -1) {
+                if(format == htsOutputFormat::VCF_GZ) return tbx_index_build(filename.c_str(), minShift < 0 ? 0 : minShift, &tbx_conf_vcf);
+                return bcf_index_build(filename.c_str(), minShift < 0 ? 14 : minShift);
+            }
+        };
+    }
+}
+
+// --- BCF RECORD POOL --- //
+namespace YiCppLib {
+    namespace HTSLibpp {
+        // bcf_clear keeps the shared and indiv buffers of a record while
+        // dropping its unpacked state
+        template<> struct htsPoolTraits<bcf1_t> {
+            static bcf1_t * init() { return bcf_init(); }
+            static void destroy(bcf1_t * v) { bcf_destroy(v); }
+            static void recycle(bcf1_t * v) { bcf_clear(v); }
+        };
+
+        template<> struct htsRecordPool<bcfRecord> : public htsRawPool<bcf1_t> {
+            // a pooled deep copy of a record. bcf_copy first calls bcf1_sync
+            // on the source, which re-encodes a record whose unpacked fields
+            // were modified, so src is written to despite being const here.
+            // dup must not run on a record that another thread is reading
+            static pointer dup(const bcf1_t& src) {
+                auto rec = acquire();
+                if(rec) bcf_copy(rec.get(), const_cast<bcf1_t *>(&src));
+                return rec;
+            }
+
+            // the next record of the file, or an empty pointer at the end
+            static pointer read(htsFile& fp, const bcfHeader& hdr) {
+                auto rec = acquire();
+                if(rec && htsReader<bcfRecord>::next(fp, hdr, rec.get()) < 0) rec.reset();
+                return rec;
+            }
+        };
+
+        using bcfPooledRecord = htsRecordPool<bcfRecord>::pointer;
+    }
+}
+
 namespace std {
     // iterator helper functions for bcfHeader
     auto inline begin(YiCppLib::HTSLibpp::bcfHeader& hdr) { return YiCppLib::HTSLibpp::htsHeader<YiCppLib::HTSLibpp::bcfHeader>::begin(hdr); }
@@ -188,4 +704,186 @@ namespace YiCppLib {
         };
     }
 }
+// record proxy classes
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        /* The proxy around a raw bcf1_t, which describes a variant site.
+         *
+         * A bcf1_t is read with only its fixed fields decoded. Each accessor
+         * unpacks the smallest part of the record it needs the first time it
+         * is called, so looking at POS and one INFO field never touches the
+         * per-sample FORMAT block. Unpacking is cached in the record itself,
+         * which is why the proxy casts away the const-ness of the record.
+         *
+         * The typed INFO and FORMAT accessors take a tag id from
+         * htsHeader<bcfHeader>::tagID. Their values are converted into a
+         * per-thread scratch buffer that is reused from call to call, so the
+         * returned span is only valid until the same accessor is called again
+         * on the same thread. Missing values and vector ends keep their
+         * htslib encodings, e.g. bcf_int32_missing and bcf_int32_vector_end.
+         */
+        template<> struct HTSProxy<const bcf1_t &> {
+            protected:
+                bcf1_t& m_actual;
+
+                inline void unpack(int which) const {
+                    if((m_actual.unpacked & which) != which) bcf_unpack(&m_actual, which);
+                }
+
+                // widen htslib's packed integer encodings to int32
+                static inline void toInt32(const uint8_t * p, int type, size_t n, std::vector<int32_t>& out) {
+                    out.resize(n);
+                    for(size_t i = 0; i < n; i++) {
+                        switch(type) {
+                            case BCF_BT_INT8: {
+                                int8_t v = static_cast<int8_t>(p[i]);
+                                out[i] = v == bcf_int8_vector_end ? bcf_int32_vector_end : v == bcf_int8_missing ? bcf_int32_missing : v;
+                                break;
+                            }
+                            case BCF_BT_INT16: {
+                                int16_t v; memcpy(&v, p + i * sizeof(v), sizeof(v));
+                                out[i] = v == bcf_int16_vector_end ? bcf_int32_vector_end : v == bcf_int16_missing ? bcf_int32_missing : v;
+                                break;
+                            }
+                            case BCF_BT_INT32:
+                                memcpy(&out[i], p + i * sizeof(int32_t), sizeof(int32_t));
+                                break;
+                            default:
+                                out.clear();
+                                return;
+                        }
+                    }
+                }
+
+                static inline void toFloat(const uint8_t * p, int type, size_t n, std::vector<float>& out) {
+                    if(type != BCF_BT_FLOAT) { out.clear(); return; }
+                    out.resize(n);
+                    if(n) memcpy(out.data(), p, n * sizeof(float));
+                }
+
+            public:
+                HTSProxy(const bcf1_t& actual): m_actual(const_cast<bcf1_t&>(actual)) {}
+
+                // fixed fields, available without unpacking
+                inline auto chrID() const       { return m_actual.rid;  }
+                inline auto pos() const         { return m_actual.pos;  }
+                inline auto refLength() const   { return m_actual.rlen; }
+                inline auto qual() const        { return m_actual.qual; }
+                inline auto alleleCount() const { return m_actual.n_allele; }
+                inline auto sampleCount() const { return m_actual.n_sample; }
+
+                // BCF_UN_STR: ID and alleles
+                inline auto id() const { unpack(BCF_UN_STR); return htsStringView(m_actual.d.id, strlen(m_actual.d.id)); }
+                inline auto allele(size_t i) const { unpack(BCF_UN_STR); return htsStringView(m_actual.d.allele[i], strlen(m_actual.d.allele[i])); }
+                inline auto ref() const { return allele(0); }
+
+                // BCF_UN_FLT: FILTER, as ids into the header dictionary
+                inline auto filters() const { unpack(BCF_UN_FLT); return htsSpan<const int>(m_actual.d.flt, m_actual.d.n_flt); }
+                inline auto hasFilter(int filterID) const {
+                    auto flt = filters();
+                    return std::find(flt.begin(), flt.end(), filterID) != flt.end();
+                }
+
+                // BCF_UN_INFO: INFO fields
+                inline auto infoFlag(int tagID) const { unpack(BCF_UN_INFO); return bcf_get_info_id(&m_actual, tagID) != nullptr; }
+
+                inline auto infoInt(int tagID) const {
+                    static thread_local std::vector<int32_t> scratch;
+                    unpack(BCF_UN_INFO);
+                    auto info = bcf_get_info_id(&m_actual, tagID);
+                    if(info == nullptr) return htsSpan<const int32_t>();
+                    toInt32(info->vptr, info->type, info->len, scratch);
+                    return htsSpan<const int32_t>(scratch.data(), scratch.size());
+                }
+
+                inline auto infoFloat(int tagID) const {
+                    static thread_local std::vector<float> scratch;
+                    unpack(BCF_UN_INFO);
+                    auto info = bcf_get_info_id(&m_actual, tagID);
+                    if(info == nullptr) return htsSpan<const float>();
+                    toFloat(info->vptr, info->type, info->len, scratch);
+                    return htsSpan<const float>(scratch.data(), scratch.size());
+                }
+
+                // string values point straight into the record, no scratch needed
+                inline auto infoString(int tagID) const {
+                    unpack(BCF_UN_INFO);
+                    auto info = bcf_get_info_id(&m_actual, tagID);
+                    if(info == nullptr || info->type != BCF_BT_CHAR) return htsStringView();
+                    auto str = reinterpret_cast<const char *>(info->vptr);
+                    return htsStringView(str, strnlen(str, info->len));
+                }
+
+                // BCF_UN_FMT: FORMAT fields, sample-major, valuesPerSample() values each
+                inline auto formatInt(int tagID) const {
+                    static thread_local std::vector<int32_t> scratch;
+                    unpack(BCF_UN_FMT);
+                    auto fmt = bcf_get_fmt_id(&m_actual, tagID);
+                    if(fmt == nullptr) return htsSpan<const int32_t>();
+                    toInt32(fmt->p, fmt->type, static_cast<size_t>(fmt->n) * m_actual.n_sample, scratch);
+                    return htsSpan<const int32_t>(scratch.data(), scratch.size());
+                }
+
+                inline auto formatFloat(int tagID) const {
+                    static thread_local std::vector<float> scratch;
+                    unpack(BCF_UN_FMT);
+                    auto fmt = bcf_get_fmt_id(&m_actual, tagID);
+                    if(fmt == nullptr) return htsSpan<const float>();
+                    toFloat(fmt->p, fmt->type, static_cast<size_t>(fmt->n) * m_actual.n_sample, scratch);
+                    return htsSpan<const float>(scratch.data(), scratch.size());
+                }
+
+                inline int valuesPerSample(int tagID) const {
+                    unpack(BCF_UN_FMT);
+                    auto fmt = bcf_get_fmt_id(&m_actual, tagID);
+                    return fmt == nullptr ? 0 : fmt->n;
+                }
+        };
+
+        // the proxy around bcfRecord, which is the same as the one around
+        // the bcf1_t it owns
+        template<> struct HTSProxy<const bcfRecord &> : HTSProxy<const bcf1_t &> {
+            HTSProxy(const bcfRecord& actual): HTSProxy<const bcf1_t &>(*actual) {}
+        };
+
+        // the proxy around a bcf1_t that was read under a projection, with
+        // the accessors of HTSProxy<const bcf1_t &> for the projected
+        // fields only
+        template<class FieldsT> struct HTSProjection<const bcf1_t &, FieldsT> : protected HTSProxy<const bcf1_t &> {
+            protected:
+                using proxy = HTSProxy<const bcf1_t &>;
+                template<class F> static constexpr bool has() { return FieldsT::template has<F>(); }
+
+            public:
+                HTSProjection(const bcf1_t& actual): proxy(actual) {}
+                HTSProjection(const bcfRecord& actual): proxy(*actual) {}
+
+                inline auto chrID() const       { static_assert(has<htsField::Core>(), "chrID() needs htsField::Core");       return proxy::chrID(); }
+                inline auto pos() const         { static_assert(has<htsField::Core>(), "pos() needs htsField::Core");         return proxy::pos(); }
+                inline auto refLength() const   { static_assert(has<htsField::Core>(), "refLength() needs htsField::Core");   return proxy::refLength(); }
+                inline auto qual() const        { static_assert(has<htsField::Core>(), "qual() needs htsField::Core");        return proxy::qual(); }
+                inline auto alleleCount() const { static_assert(has<htsField::Core>(), "alleleCount() needs htsField::Core"); return proxy::alleleCount(); }
+
+                inline auto id() const              { static_assert(has<htsField::Alleles>(), "id() needs htsField::Alleles");     return proxy::id(); }
+                inline auto allele(size_t i) const  { static_assert(has<htsField::Alleles>(), "allele() needs htsField::Alleles"); return proxy::allele(i); }
+                inline auto ref() const             { static_assert(has<htsField::Alleles>(), "ref() needs htsField::Alleles");    return proxy::ref(); }
+
+                inline auto filters() const            { static_assert(has<htsField::Filter>(), "filters() needs htsField::Filter");   return proxy::filters(); }
+                inline auto hasFilter(int filterID) const { static_assert(has<htsField::Filter>(), "hasFilter() needs htsField::Filter"); return proxy::hasFilter(filterID); }
+
+                inline auto infoFlag(int tagID) const   { static_assert(has<htsField::Info>(), "infoFlag() needs htsField::Info");   return proxy::infoFlag(tagID); }
+                inline auto infoInt(int tagID) const    { static_assert(has<htsField::Info>(), "infoInt() needs htsField::Info");    return proxy::infoInt(tagID); }
+                inline auto infoFloat(int tagID) const  { static_assert(has<htsField::Info>(), "infoFloat() needs htsField::Info");  return proxy::infoFloat(tagID); }
+                inline auto infoString(int tagID) const { static_assert(has<htsField::Info>(), "infoString() needs htsField::Info"); return proxy::infoString(tagID); }
+
+                // the sample count is only known once FORMAT has been parsed
+                inline auto sampleCount() const             { static_assert(has<htsField::Format>(), "sampleCount() needs htsField::Format");     return proxy::sampleCount(); }
+                inline auto formatInt(int tagID) const      { static_assert(has<htsField::Format>(), "formatInt() needs htsField::Format");       return proxy::formatInt(tagID); }
+                inline auto formatFloat(int tagID) const    { static_assert(has<htsField::Format>(), "formatFloat() needs htsField::Format");     return proxy::formatFloat(tagID); }
+                inline int valuesPerSample(int tagID) const { static_assert(has<htsField::Format>(), "valuesPerSample() needs htsField::Format"); return proxy::valuesPerSample(tagID); }
+        };
+    }
+}
+
 #endif
@@ -0,0 +1,369 @@
+// YiCppLib::HTSLibpp::VcfParse
+//
+// This file contains a pipelined reader for text VCF files, which splits
+// the input into chunks of lines on one thread, parses the chunks on a
+// number of worker threads, and hands the records out in file order
+
+#include "htslibpp.h"
+#include "htslibpp_variant.h"
+#include <htslib/kseq.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#ifndef YICPPLIB_HTSLIBPP_VCFPARSE
+#define YICPPLIB_HTSLIBPP_VCFPARSE
+
+// The reader owns a fixed set of chunks, which circulate between three
+// stages
+//
+//   splitter: take a free chunk -> read lines into it -> queue it for parsing
+//   workers:  take a queued chunk -> vcf_parse every line -> mark it done
+//   consumer: take the done chunk next in file order -> iterate it -> free it
+//
+// Chunks are numbered by the splitter, and the consumer waits for each
+// number in turn, so records come out in file order however the workers
+// are scheduled. The number of chunks bounds how far the splitter runs
+// ahead. The records of a chunk are pooled bcf1_t's that stay with the
+// chunk as it is reused, so a pass does not allocate once it has warmed up.
+//
+// vcf_parse adds contigs, FILTER, INFO and FORMAT tags that are missing
+// from the header as it comes across them, which would race between
+// workers. A worker therefore first looks the names of each line up in the
+// header, and leaves lines that use undeclared names to the consumer. The
+// consumer parses them in file order, under an exclusive lock on the
+// header, so the header grows exactly as it does under bcf_read. The
+// workers hold a shared lock while they parse a chunk.
+//
+// Files that are not text VCF, i.e. BCF, are read with bcf_read on the
+// splitter thread and skip the workers. Either way the splitter is the only
+// user of the htsFile while the reader is alive, and the header must not
+// be changed by anyone else.
+
+namespace YiCppLib {
+    namespace HTSLibpp {
+
+        class htsVcfParser {
+            protected:
+                using recordPool = htsRecordPool<bcfRecord>;
+
+                struct chunk {
+                    size_t seq;
+                    std::string text;                               // every line followed by a NUL
+                    std::vector<std::pair<size_t, size_t>> lines;   // offset and length of every line
+                    std::vector<size_t> deferred;                   // lines left to the consumer
+                    std::vector<bcfPooledRecord> records;
+                    size_t size;                                    // records ready to hand out
+                    bool failed;                                    // size stopped at a bad line
+
+                    void reserve(size_t n) {
+                        while(records.size() < n) records.push_back(recordPool::acquire());
+                    }
+                };
+
+                htsFile& m_fp;
+                bcfHeader& m_hdr;
+                bool m_text;
+                size_t m_linesPerChunk;
+
+                std::vector<std::unique_ptr<chunk>> m_chunks;
+                std::vector<chunk *> m_free;
+                // chunks waiting to be parsed, taken in reading order so the
+                // oldest chunk, which the consumer waits on next, goes first
+                std::deque<chunk *> m_todo;
+                std::map<size_t, chunk *> m_done;
+
+                std::mutex m_mutex;
+                std::condition_variable m_freeReady;
+                std::condition_variable m_todoReady;
+                std::condition_variable m_doneReady;
+
+                std::shared_timed_mutex m_header;
+
+                bool m_stop;
+                bool m_eof;
+                bool m_readFailed;      // m_eof was reached through a read error
+                size_t m_total;         // the number of chunks, once m_eof is set
+                size_t m_next;          // the number of the chunk the consumer waits for
+                int m_status;
+
+                std::thread m_splitter;
+                std::vector<std::thread> m_workers;
+
+                // --- NAME LOOKUPS --- //
+
+                // look up the NUL-terminated name at s, which ends at end
+                static bool declared(const bcf_hdr_t * hdr, char * s, char * end, int type) {
+                    auto saved = *end;
+                    *end = '\0';
+                    int id = type == BCF_DT_CTG ? bcf_hdr_id2int(hdr, BCF_DT_CTG, s) : bcf_hdr_id2int(hdr, BCF_DT_ID, s);
+                    *end = saved;
+                    return type == BCF_DT_CTG ? id >= 0 : bcf_hdr_idinfo_exists(hdr, type, id);
+                }
+
+                // look up every name of a list such as a;b=1;c. lists that
+                // are only "." have no names
+                static bool declaredList(const bcf_hdr_t * hdr, char * s, char * end, char sep, int type) {
+                    if(end - s == 1 && *s == '.') return true;
+                    while(s < end) {
+                        auto next = static_cast<char *>(memchr(s, sep, end - s));
+                        if(next == nullptr) next = end;
+                        auto key = static_cast<char *>(memchr(s, '=', next - s));
+                        if(!declared(hdr, s, key != nullptr ? key : next, type)) return false;
+                        s = next + 1;
+                    }
+                    return true;
+                }
+
+                // can vcf_parse read the line without adding to the header
+                static bool declared(const bcf_hdr_t * hdr, char * s, size_t l) {
+                    char * fields[10];
+                    char * end = s + l;
+                    int n = 0;
+                    for(char * p = s; n < 10; n++) {
+                        fields[n] = p;
+                        auto tab = static_cast<char *>(memchr(p, '\t', end - p));
+                        if(tab == nullptr) { n++; break; }
+                        p = tab + 1;
+                    }
+                    auto fieldEnd = [&](int i) { return i + 1 < n ? fields[i + 1] - 1 : end; };
+
+                    if(n < 8) return true;  // malformed, vcf_parse reports it
+                    if(!declared(hdr, fields[0], fieldEnd(0), BCF_DT_CTG)) return false;
+                    if(!declaredList(hdr, fields[6], fieldEnd(6), ';', BCF_HL_FLT)) return false;
+                    if(!declaredList(hdr, fields[7], fieldEnd(7), ';', BCF_HL_INFO)) return false;
+                    if(n > 8 && !declaredList(hdr, fields[8], fieldEnd(8), ':', BCF_HL_FMT)) return false;
+                    return true;
+                }
+
+                static int parse(chunk& c, size_t i, const bcf_hdr_t * hdr) {
+                    kstring_t line{c.lines[i].second, c.lines[i].second + 1, &c.text[c.lines[i].first]};
+                    return vcf_parse(&line, hdr, c.records[i].get());
+                }
+
+                // --- STAGES --- //
+
+                template<class ReadyF> bool wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cv, ReadyF&& ready) {
+                    cv.wait(lock, [&]() { return m_stop || ready(); });
+                    return !m_stop;
+                }
+
+                void split() {
+                    for(size_t seq = 0; ; seq++) {
+                        chunk * c = nullptr;
+                        {
+                            std::unique_lock<std::mutex> lock(m_mutex);
+                            if(!wait(lock, m_freeReady, [&]() { return !m_free.empty(); })) return;
+                            c = m_free.back();
+                            m_free.pop_back();
+                        }
+
+                        c->seq = seq;
+                        c->text.clear();
+                        c->lines.clear();
+                        c->deferred.clear();
+                        c->size = 0;
+                        c->failed = false;
+
+                        // -1 is the end of the input, anything below an error
+                        bool eof = false;
+                        bool readFailed = false;
+                        if(m_text) {
+                            auto& line = m_fp->line;
+                            while(c->lines.size() < m_linesPerChunk) {
+                                htsProbe probe(m_fp.get());
+                                int retVal = hts_getline(m_fp.get(), KS_SEP_LINE, &line);
+                                probe.read(retVal, line.l);
+                                if(retVal < 0) { eof = true; readFailed = retVal < -1; break; }
+
+                                c->lines.emplace_back(c->text.size(), line.l);
+                                c->text.append(line.s, line.l);
+                                c->text.push_back('\0');
+                            }
+                        }
+                        else {
+                            c->reserve(m_linesPerChunk);
+                            for(; c->size < m_linesPerChunk; c->size++) {
+                                int retVal = htsReader<bcfRecord>::next(m_fp, m_hdr, c->records[c->size].get());
+                                if(retVal < 0) { eof = true; readFailed = retVal < -1; break; }
+                            }
+                        }
+
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        if(c->lines.empty() && c->size == 0) {
+                            m_free.push_back(c);
+                            m_total = seq;
+                        }
+                        else {
+                            if(m_text) { m_todo.push_back(c); m_todoReady.notify_one(); }
+                            else { m_done.emplace(seq, c); m_doneReady.notify_all(); }
+                            m_total = seq + 1;
+                            if(!eof) continue;
+                        }
+
+                        m_eof = true;
+                        m_readFailed = readFailed;
+                        m_doneReady.notify_all();
+                        m_todoReady.notify_all();
+                        return;
+                    }
+                }
+
+                void work() {
+                    while(true) {
+                        chunk * c = nullptr;
+                        {
+                            std::unique_lock<std::mutex> lock(m_mutex);
+                            if(!wait(lock, m_todoReady, [&]() { return !m_todo.empty() || m_eof; })) return;
+                            if(m_todo.empty()) return;
+                            c = m_todo.front();
+                            m_todo.pop_front();
+                        }
+
+                        c->reserve(c->lines.size());
+                        c->size = c->lines.size();
+                        {
+                            std::shared_lock<std::shared_timed_mutex> lock(m_header);
+                            for(size_t i = 0; i < c->lines.size(); i++) {
+                                if(!declared(m_hdr.get(), &c->text[c->lines[i].first], c->lines[i].second)) c->deferred.push_back(i);
+                                else if(parse(*c, i, m_hdr.get()) < 0) { c->size = i; c->failed = true; break; }
+                            }
+                        }
+
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_done.emplace(c->seq, c);
+                        m_doneReady.notify_all();
+                    }
+                }
+
+            public:
+                // nThreads workers parse chunks of linesPerChunk lines. depth
+                // chunks are in flight, by default two per worker and two more
+                // for the splitter and the consumer. the header has to be read
+                // from fp already
+                htsVcfParser(htsFile& fp, bcfHeader& hdr, size_t nThreads = 4, size_t linesPerChunk = 1024, size_t depth = 0):
+                    m_fp(fp), m_hdr(hdr), m_text(fp->format.format == vcf),
+                    m_linesPerChunk(std::max<size_t>(linesPerChunk, 1)),
+                    m_stop(false), m_eof(false), m_readFailed(false), m_total(0), m_next(0), m_status(0) {
+
+                    nThreads = std::max<size_t>(nThreads, 1);
+                    if(depth == 0) depth = 2 * nThreads + 2;
+                    for(size_t i = 0; i < depth; i++) {
+                        m_chunks.emplace_back(new chunk());
+                        m_free.push_back(m_chunks.back().get());
+                    }
+
+                    m_splitter = std::thread(&htsVcfParser::split, this);
+                    if(m_text) for(size_t i = 0; i < nThreads; i++) m_workers.emplace_back(&htsVcfParser::work, this);
+                }
+
+                htsVcfParser(const htsVcfParser&) = delete;
+                htsVcfParser& operator=(const htsVcfParser&) = delete;
+
+                // stops every stage, also when the input was not read to the end
+                ~htsVcfParser() {
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_stop = true;
+                    }
+                    m_freeReady.notify_all();
+                    m_todoReady.notify_all();
+                    m_doneReady.notify_all();
+                    if(m_splitter.joinable()) m_splitter.join();
+                    for(auto& w : m_workers) w.join();
+                }
+
+                // whether the input is parsed by the workers
+                bool parallel() const { return m_text; }
+
+                // 0, or -1 once a line failed to parse or the input failed
+                // to read. reading stops at the record before it
+                int status() const { return m_status; }
+
+                // take the chunk next in file order, nullptr at the end of
+                // the input. every chunk taken has to be given back with
+                // recycle
+                chunk * next() {
+                    chunk * c = nullptr;
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        if(m_status < 0) return nullptr;
+                        if(!wait(lock, m_doneReady, [&]() { return m_done.count(m_next) > 0 || (m_eof && m_next >= m_total); })) return nullptr;
+                        auto found = m_done.find(m_next);
+                        if(found == m_done.end()) {
+                            if(m_readFailed) m_status = -1;
+                            return nullptr;
+                        }
+                        c = found->second;
+                        m_done.erase(found);
+                        m_next++;
+                    }
+
+                    if(!c->deferred.empty()) {
+                        std::lock_guard<std::shared_timed_mutex> lock(m_header);
+                        for(auto i : c->deferred) {
+                            if(i >= c->size) break;
+                            if(parse(*c, i, m_hdr.get()) < 0) { c->size = i; c->failed = true; break; }
+                        }
+                    }
+                    if(c->failed) m_status = -1;
+                    return c;
+                }
+
+                void recycle(chunk * c) {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_free.push_back(c);
+                    m_freeReady.notify_one();
+                }
+
+                // --- RANGE EXPRESSION --- //
+
+                // A single pass input iterator over the records of every
+                // chunk, handed out as bcfPooledRecords so that loops written
+                // against htsReader<bcfRecord>::range read the same. A record
+                // stays valid until the iterator moves past the end of its chunk
+                struct iterator : public std::iterator<std::input_iterator_tag, bcfPooledRecord> {
+                    protected:
+                        htsVcfParser * m_reader;
+                        chunk * m_chunk;
+                        size_t m_index;
+
+                        void load() {
+                            m_index = 0;
+                            while((m_chunk = m_reader->next()) != nullptr && m_chunk->size == 0) m_reader->recycle(m_chunk);
+                        }
+
+                    public:
+                        iterator(htsVcfParser * reader): m_reader(reader), m_chunk(nullptr), m_index(0) { if(m_reader) load(); }
+
+                        bcfPooledRecord& operator*() { return m_chunk->records[m_index]; }
+                        bcfPooledRecord * operator->() { return &m_chunk->records[m_index]; }
+
+                        iterator& operator++() {
+                            if(m_chunk != nullptr && ++m_index == m_chunk->size) {
+                                m_reader->recycle(m_chunk);
+                                load();
+                            }
+                            return *this;
+                        }
+
+                        bool operator==(const iterator& rhs) const { return m_chunk == rhs.m_chunk; }
+                        bool operator!=(const iterator& rhs) const { return !(*this == rhs); }
+                };
+
+                iterator begin() { return iterator(this); }
+                iterator end()   { return iterator(nullptr); }
+        };
+    }
+}
+
+#endif
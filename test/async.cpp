@@ -0,0 +1,107 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_variant.h"
+#include "../htslibpp_async.h"
+
+using namespace YiCppLib::HTSLibpp;
+
+class AsyncReader : public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.na12878.bam";
+        const std::string brca2Region = "13:32900000-32950000";
+};
+
+TEST(SPSCQueue, IsBoundedAndOrdered) {
+    htsSPSCQueue<int> queue(3);
+    ASSERT_EQ(queue.capacity(), 4);
+    for(int i = 0; i < 4; i++) ASSERT_TRUE(queue.push(i));
+    ASSERT_FALSE(queue.push(4));
+
+    int value = -1;
+    for(int i = 0; i < 4; i++) {
+        ASSERT_TRUE(queue.pop(value));
+        ASSERT_EQ(value, i);
+    }
+    ASSERT_FALSE(queue.pop(value));
+}
+
+TEST_F(AsyncReader, CanReadBamSequencially) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+
+    size_t read_count = 0;
+    int32_t last = -1;
+    bool sorted = true;
+    htsAsyncReader<bamRecord> reader(fp, header, 500, 3);
+    for(auto& r : reader) {
+        read_count++;
+        if(r.core.tid == 12 && r.core.pos < last) sorted = false;
+        if(r.core.tid == 12) last = r.core.pos;
+    }
+    ASSERT_EQ(read_count, 45256);
+    ASSERT_TRUE(sorted);
+}
+
+TEST_F(AsyncReader, CanReadBamRegion) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+    auto index = htsIndexOpen(testFile, testFile + ".bai");
+    htsIterator iter{sam_itr_querys(index.get(), header.get(), brca2Region.c_str())};
+
+    size_t read_count = 0;
+    htsAsyncReader<bamRecord> reader(fp, iter);
+    for(auto& r : reader) read_count++;
+    ASSERT_EQ(read_count, 27112);
+}
+
+TEST_F(AsyncReader, CanReadVcf) {
+    auto fp = htsOpen("datasets/brca2.platnium-trio.vcf", "r");
+    auto header = htsHeader<bcfHeader>::read(fp);
+
+    size_t record_count = 0;
+    htsAsyncReader<bcfRecord> reader(fp, header, 16);
+    for(auto& v : reader) record_count++;
+    ASSERT_EQ(record_count, 173);
+}
+
+TEST_F(AsyncReader, CanStopEarly) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+
+    size_t read_count = 0;
+    {
+        htsAsyncReader<bamRecord> reader(fp, header, 100, 2);
+        for(auto& r : reader) if(++read_count == 250) break;
+    }
+    ASSERT_EQ(read_count, 250);
+}
+
+TEST_F(AsyncReader, EndIsSticky) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+
+    size_t read_count = 0;
+    htsAsyncReader<bamRecord> reader(fp, header, 1000);
+    for(auto& r : reader) { (void)r; read_count++; }
+    ASSERT_EQ(read_count, 45256);
+    ASSERT_TRUE(reader.begin() == reader.end());
+    ASSERT_EQ(reader.next(), nullptr);
+    ASSERT_EQ(reader.status(), 0);
+}
+
+TEST_F(AsyncReader, ReadErrorIsReported) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+
+    // the second refill fails, after the records of the first one
+    int fills = 0;
+    htsAsyncReader<bamRecord> reader([&](htsBatch<bamRecord>& b) -> ssize_t {
+        return fills++ == 0 ? b.fill(fp, header) : -1;
+    }, 100);
+
+    size_t read_count = 0;
+    for(auto& r : reader) { (void)r; read_count++; }
+    ASSERT_EQ(read_count, 100);
+    ASSERT_EQ(reader.status(), -1);
+}
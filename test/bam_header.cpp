@@ -47,3 +47,16 @@ TEST_F(BamHeader, CanIterateOverRecordsSequencially) {
     ASSERT_EQ(rg_ct, 1);
     ASSERT_EQ(line_ct, 116);
 }
+
+TEST_F(BamHeader, CanBuildHeaderIndex) {
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    auto index = htsHeaderIndex<bamHeader>::build(header);
+
+    ASSERT_EQ(index->contigCount(), 86);
+    ASSERT_EQ(index->lines().size(), 116);
+    ASSERT_EQ(index->lines().front().substr(0, 3), "@HD");
+
+    ASSERT_EQ(index->tid("13"), bam_name2id(header.get(), "13"));
+    ASSERT_EQ(index->find("13")->length, header->target_len[index->tid("13")]);
+    ASSERT_EQ(index->find("no-such-contig"), nullptr);
+}
@@ -2,8 +2,11 @@
 #include "htslib/hfile.h"
 #include "../htslibpp.h"
 #include "../htslibpp_alignment.h"
+#include "scratch.h"
 
 #include <algorithm>
+#include <fstream>
+#include <sys/stat.h>
 
 using namespace YiCppLib::HTSLibpp;
 
@@ -45,6 +48,17 @@ TEST_F(BamRecord, CanIterateRecordUsingRangeExpression) {
     ASSERT_EQ(read_count, 45256);
 }
 
+TEST_F(BamRecord, CanIterateRecordsWithThreadPool) {
+    size_t read_count = 0;
+    YiCppLib::HTSLibpp::htsThreadPool pool(4);
+    auto fp = htsOpen(testFile, "r", pool);
+    auto header = htsHeader<bamHeader>::read(fp);
+
+    for(auto &r : htsReader<bamRecord>::range(fp, header)) read_count++;
+
+    ASSERT_EQ(read_count, 45256);
+}
+
 TEST_F(BamRecord, CanIterateRegionSequencially) {
     size_t read_count = 0;
     auto header = htsHeader<bamHeader>::read(htsFileHandler);
@@ -90,6 +104,219 @@ TEST_F(BamRecord, CanGetQueryName) {
     auto proxy = htsProxy(*firstRead);
 
     ASSERT_EQ(proxy.queryName(), "ERR194147.537888192");
-    //ASSERT_EQ(proxy.cigar(), "101M");
-    
+    ASSERT_EQ(proxy.queryName().size(), strlen("ERR194147.537888192"));
+}
+
+TEST_F(BamRecord, CanGetCigar) {
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    auto firstRead = htsReader<bamRecord>::begin(htsFileHandler, header);
+    auto cigar = htsProxy(*firstRead).cigar();
+
+    ASSERT_EQ(cigar.size(), 1);
+    ASSERT_EQ(bam_cigar_op(cigar[0]), BAM_CMATCH);
+    ASSERT_EQ(bam_cigar_oplen(cigar[0]), 101);
+}
+
+TEST_F(BamRecord, CanGetSequenceAndQualities) {
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    auto firstRead = htsReader<bamRecord>::begin(htsFileHandler, header);
+    auto proxy = htsProxy(*firstRead);
+
+    auto seq = proxy.sequence();
+    ASSERT_EQ(seq.size(), proxy.queryLength());
+    ASSERT_EQ(seq.str().size(), seq.size());
+    ASSERT_EQ(seq[0], proxy.get_base(0));
+    ASSERT_TRUE(std::all_of(seq.begin(), seq.end(), [](char b) { return strchr("=ACMGRSVTWYHKDBN", b) != nullptr; }));
+
+    ASSERT_EQ(proxy.baseQualities().size(), proxy.queryLength());
+    ASSERT_EQ(proxy.auxiliary_length(), bam_get_l_aux((*firstRead).get()));
+}
+
+TEST_F(BamRecord, CanProxyRecordsInBatch) {
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    htsBatch<bamRecord> batch(16);
+    batch.fill(htsFileHandler, header);
+
+    ASSERT_EQ(htsProxy(batch[0]).queryName(), "ERR194147.537888192");
+}
+
+TEST_F(BamRecord, CanReadRecordsInBatches) {
+    size_t read_count = 0;
+    size_t batch_count = 0;
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    htsBatch<bamRecord> batch(4096);
+
+    while(batch.fill(htsFileHandler, header) > 0) {
+        ASSERT_LE(batch.size(), batch.capacity());
+        for(auto& r : batch) read_count++;
+        batch_count++;
+    }
+
+    ASSERT_EQ(read_count, 45256);
+    ASSERT_EQ(batch_count, (45256 + 4095) / 4096);
+}
+
+TEST_F(BamRecord, CanReadRegionInBatches) {
+    size_t read_count = 0;
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    auto index  = htsIndexOpen(testFile, testFile + ".bai");
+    htsIterator iter{sam_itr_querys(index.get(), header.get(), brca2Region.c_str())};
+    htsBatch<bamRecord> batch(1000);
+
+    while(batch.fill(htsFileHandler, iter) > 0) read_count += batch.span().size();
+
+    ASSERT_EQ(read_count, 27112);
+}
+
+TEST_F(BamRecord, TruncatedBatchIsAnError) {
+    scratchDir scratch;
+    auto truncated = scratch.path("truncated.bam");
+    {
+        std::ifstream in(testFile, std::ios::binary);
+        std::ofstream out(truncated, std::ios::binary);
+        out << in.rdbuf();
+    }
+    struct stat st;
+    ASSERT_EQ(stat(truncated.c_str(), &st), 0);
+    ASSERT_EQ(truncate(truncated.c_str(), st.st_size / 2), 0);
+
+    auto fp = htsOpen(truncated, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+    ASSERT_NE(header.get(), nullptr);
+    htsBatch<bamRecord> batch(4096);
+    size_t read_count = 0;
+    ssize_t n;
+    while((n = batch.fill(fp, header)) > 0) read_count += n;
+
+    ASSERT_EQ(n, -1);
+    ASSERT_LT(read_count + batch.size(), 45256);
+}
+
+TEST_F(BamRecord, MultiRegionYieldsOverlappingRecordsOnce) {
+    size_t read_count = 0;
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    auto index  = htsIndexOpen(testFile, testFile + ".bai");
+    std::vector<std::string> regions{"13:32900000-32930000", "13:32920000-32950000", "13:32925000-32926000"};
+
+    for(auto &r : htsReader<bamRecord>::range(htsFileHandler, header, index, regions)) read_count++;
+
+    ASSERT_EQ(read_count, 27112);
+}
+
+TEST_F(BamRecord, MultiRegionSkipsRecordsBetweenTargets) {
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    auto index  = htsIndexOpen(testFile, testFile + ".bai");
+    const std::string first = "13:32900000-32910000";
+    const std::string second = "13:32910500-32920000";
+    auto secondBeg = htsHeader<bamHeader>::region(header, second).beg;
+
+    size_t first_count = 0, second_count = 0, both_count = 0;
+    for(auto &r : htsReader<bamRecord>::range(htsFileHandler, header, index, first)) {
+        first_count++;
+        if(bam_endpos(r.get()) > secondBeg) both_count++;
+    }
+    for(auto &r : htsReader<bamRecord>::range(htsFileHandler, header, index, second)) second_count++;
+
+    // with the default gap both targets are fetched by a single query
+    for(int gap : {0, htsReader<bamRecord>::bam_range_m::defaultMergeGap}) {
+        size_t read_count = 0;
+        for(auto &r : htsReader<bamRecord>::range(htsFileHandler, header, index, std::vector<std::string>{first, second}, gap)) read_count++;
+        ASSERT_EQ(read_count, first_count + second_count - both_count);
+    }
+}
+
+TEST_F(BamRecord, CanReadRegionsFromBed) {
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    std::istringstream bed("track name=brca2\n13\t32899999\t32950000\n13\t32920000\t32930000\nunknown\t0\t100\n");
+
+    auto regions = htsHeader<bamHeader>::regions(header, bed);
+    ASSERT_EQ(regions.size(), 1);
+    ASSERT_EQ(regions[0], htsHeader<bamHeader>::region(header, brca2Region));
+}
+
+TEST_F(BamRecord, CanWriteAndIndexRegion) {
+    scratchDir scratch;
+    auto filename = scratch.path("region.bam");
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    auto index  = htsIndexOpen(testFile, testFile + ".bai");
+    {
+        auto out = htsWriter<bamRecord>::open(filename, htsOutputFormat::BAM, 1);
+        ASSERT_EQ(htsWriter<bamRecord>::writeHeader(out, header), 0);
+        for(auto &r : htsReader<bamRecord>::range(htsFileHandler, header, index, brca2Region))
+            ASSERT_GE(htsWriter<bamRecord>::write(out, header, r), 0);
+    }
+    ASSERT_EQ(htsWriter<bamRecord>::buildIndex(filename), 0);
+
+    size_t read_count = 0;
+    auto fp = htsOpen(filename, "r");
+    auto copy = htsHeader<bamHeader>::read(fp);
+    auto copyIndex = htsIndexOpen(filename, filename + ".bai");
+    for(auto &r : htsReader<bamRecord>::range(fp, copy, copyIndex, brca2Region)) read_count++;
+    ASSERT_EQ(read_count, 27112);
+}
+
+TEST_F(BamRecord, CanQueryFileInMemory) {
+    htsMappedFile file(testFile);
+    auto fp = htsOpen(file);
+    ASSERT_NE(fp.get(), nullptr);
+
+    size_t read_count = 0;
+    auto header = htsHeader<bamHeader>::read(fp);
+    auto index = htsIndexOpen(testFile, testFile + ".bai");
+    for(auto &r : htsReader<bamRecord>::range(fp, header, index, brca2Region)) read_count++;
+    ASSERT_EQ(read_count, 27112);
+}
+
+TEST_F(BamRecord, PooledRecordsAreRecycled) {
+    using pool = htsRecordPool<bamRecord>;
+    pool::trim();
+
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    std::vector<bamPooledRecord> window;
+    for(auto rec = pool::read(htsFileHandler, header); rec && window.size() < 100; rec = pool::read(htsFileHandler, header))
+        window.push_back(pool::dup(*rec));
+    ASSERT_EQ(window.size(), 100);
+    ASSERT_GT(pool::cached(), 0);
+
+    // releasing the window fills the free list, and the next records
+    // come out of it again
+    std::vector<bam1_t *> released;
+    for(const auto& r : window) released.push_back(r.get());
+    window.clear();
+    auto cached = pool::cached();
+    ASSERT_GE(cached, 100);
+
+    auto rec = pool::read(htsFileHandler, header);
+    ASSERT_NE(rec.get(), nullptr);
+    ASSERT_EQ(pool::cached(), cached - 1);
+    ASSERT_NE(std::find(released.begin(), released.end(), rec.get()), released.end());
+}
+
+TEST_F(BamRecord, ProjectedReadsSeeTheSameCoreFields) {
+    using fields = htsFields<htsField::Core, htsField::Cigar>;
+    static_assert(htsReader<bamRecord>::requiredFields<fields>() == (SAM_FLAG | SAM_RNAME | SAM_POS | SAM_MAPQ | SAM_CIGAR), "");
+
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    std::vector<int32_t> ends;
+    for(auto r : htsReader<bamRecord>::projected<fields>(htsFileHandler, header)) ends.push_back(r.endPos());
+
+    auto fp = htsOpen(testFile, "r");
+    auto copy = htsHeader<bamHeader>::read(fp);
+    std::vector<int32_t> expected;
+    for(auto& r : htsReader<bamRecord>::range(fp, copy)) expected.push_back(bam_endpos(r.get()));
+
+    ASSERT_EQ(ends.size(), 45256);
+    ASSERT_EQ(ends, expected);
+}
+
+TEST_F(BamRecord, CanReadRegionProjected) {
+    size_t read_count = 0;
+    auto header = htsHeader<bamHeader>::read(htsFileHandler);
+    auto index = htsIndexOpen(testFile, testFile + ".bai");
+    htsIterator iter{sam_itr_querys(index.get(), header.get(), brca2Region.c_str())};
+    for(auto r : htsReader<bamRecord>::projected<htsFields<htsField::Core>>(htsFileHandler, std::move(iter))) {
+        ASSERT_EQ(r.chrID(), 0);
+        read_count++;
+    }
+    ASSERT_EQ(read_count, 27112);
 }
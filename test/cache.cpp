@@ -0,0 +1,118 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_variant.h"
+#include "../htslibpp_cache.h"
+#include "scratch.h"
+
+#include <thread>
+
+using namespace YiCppLib::HTSLibpp;
+
+class HtsCache : public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.na12878.bam";
+        const std::string brca2Region = "13:32900000-32950000";
+
+        // an indexed BCF copy of the trio dataset
+        static std::string bcfCopy(const std::string& bcfFile) {
+            {
+                auto in = htsOpen("datasets/brca2.platnium-trio.vcf", "r");
+                auto hdr = htsHeader<bcfHeader>::read(in);
+                auto out = htsWriter<bcfRecord>::open(bcfFile);
+                htsWriter<bcfRecord>::writeHeader(out, hdr);
+                for(auto& v : htsReader<bcfRecord>::range(in, hdr)) htsWriter<bcfRecord>::write(out, hdr, v);
+            }
+            htsWriter<bcfRecord>::buildIndex(bcfFile);
+            return bcfFile;
+        }
+
+        static size_t count(htsCache::lease<bamHeader>& l, const std::string& region) {
+            size_t read_count = 0;
+            for(auto &r : htsReader<bamRecord>::range(l.file(), l.query(region))) read_count++;
+            return read_count;
+        }
+};
+
+TEST_F(HtsCache, SharesHeaderAndIndex) {
+    htsCache cache;
+    auto first = cache.acquire<bamHeader>(testFile);
+    auto second = cache.acquire<bamHeader>(testFile);
+    ASSERT_TRUE(first.good());
+    ASSERT_TRUE(second.good());
+
+    ASSERT_EQ(first.header().get(), second.header().get());
+    ASSERT_EQ(first.index().get(), second.index().get());
+    ASSERT_NE(first.file().get(), second.file().get());
+    ASSERT_EQ(cache.size(), 1);
+}
+
+TEST_F(HtsCache, ReusesReleasedHandles) {
+    htsCache cache;
+    ::htsFile * handle = nullptr;
+    {
+        auto l = cache.acquire<bamHeader>(testFile);
+        handle = l.file().get();
+    }
+    auto l = cache.acquire<bamHeader>(testFile);
+    ASSERT_EQ(l.file().get(), handle);
+}
+
+TEST_F(HtsCache, CachedQueriesCanBeRepeated) {
+    htsCache cache;
+    auto l = cache.acquire<bamHeader>(testFile);
+    ASSERT_EQ(count(l, brca2Region), 27112);
+    ASSERT_EQ(count(l, brca2Region), 27112);
+    ASSERT_EQ(count(l, "."), 45256);
+    ASSERT_EQ(l.query("no-such-contig:1-100").get(), nullptr);
+}
+
+TEST_F(HtsCache, ServesManyThreads) {
+    htsCache cache;
+    std::vector<size_t> counts(4, 0);
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < counts.size(); t++)
+        threads.emplace_back([&, t]() {
+            auto l = cache.acquire<bamHeader>(testFile);
+            counts[t] = count(l, brca2Region);
+        });
+    for(auto& t : threads) t.join();
+
+    for(auto c : counts) ASSERT_EQ(c, 27112);
+    ASSERT_EQ(cache.size(), 1);
+}
+
+TEST_F(HtsCache, EvictsLeastRecentlyUsed) {
+    scratchDir scratch;
+    auto bcfFile = bcfCopy(scratch.path("cache.bcf"));
+
+    htsCache cache(1);
+    auto bam = cache.acquire<bamHeader>(testFile);
+    auto bcf = cache.acquire<bcfHeader>(bcfFile);
+    ASSERT_TRUE(bam.good());
+    ASSERT_TRUE(bcf.good());
+    ASSERT_EQ(cache.size(), 1);
+
+    // the evicted entry lives on for as long as it is leased
+    ASSERT_EQ(count(bam, brca2Region), 27112);
+    ASSERT_NE(bcf.query("13:32900000-32950000").get(), nullptr);
+}
+
+TEST_F(HtsCache, ReloadsFilesReplacedOnDisk) {
+    scratchDir scratch;
+    auto bcfFile = bcfCopy(scratch.path("cache.bcf"));
+
+    // the first lease keeps the old entry, and its header, alive
+    htsCache cache;
+    auto first = cache.acquire<bcfHeader>(bcfFile);
+    ASSERT_TRUE(first.good());
+
+    // the same bytes under a new inode, most likely within the same second
+    auto replacement = bcfCopy(scratch.path("replacement.bcf"));
+    ASSERT_EQ(rename(replacement.c_str(), bcfFile.c_str()), 0);
+
+    auto l = cache.acquire<bcfHeader>(bcfFile);
+    ASSERT_TRUE(l.good());
+    ASSERT_NE(l.header().get(), first.header().get());
+    ASSERT_NE(l.query("13:32900000-32950000").get(), nullptr);
+}
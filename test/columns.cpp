@@ -0,0 +1,146 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_columns.h"
+#include "scratch.h"
+
+#include <fstream>
+#include <numeric>
+#include <sys/stat.h>
+
+using namespace YiCppLib::HTSLibpp;
+
+class AlignmentColumns : public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.na12878.bam";
+};
+
+TEST_F(AlignmentColumns, ColumnsAreAlignedAndMatchTheRecords) {
+    auto fp = htsOpen(testFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    bamRecord rec{bam_init1()};
+
+    htsAlignmentColumns cols(1000);
+    ASSERT_EQ(cols.fill(fp, hdr, rec), 1000);
+    ASSERT_TRUE(cols.full());
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(cols.pos().data()) % 64, 0);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(cols.mapq().data()) % 64, 0);
+
+    auto again = htsOpen(testFile, "r");
+    auto hdr2 = htsHeader<bamHeader>::read(again);
+    size_t i = 0;
+    for(auto& r : htsReader<bamRecord>::range(again, hdr2)) {
+        if(i == cols.size()) break;
+        ASSERT_EQ(cols.tid()[i], r->core.tid);
+        ASSERT_EQ(cols.pos()[i], r->core.pos);
+        ASSERT_EQ(cols.mapq()[i], r->core.qual);
+        ASSERT_EQ(cols.flag()[i], r->core.flag);
+        ASSERT_EQ(cols.matePos()[i], r->core.mpos);
+        ASSERT_EQ(cols.insertSize()[i], r->core.isize);
+        ASSERT_EQ(cols.queryLength()[i], r->core.l_qseq);
+        i++;
+    }
+}
+
+TEST_F(AlignmentColumns, ChunksCoverTheRange) {
+    auto fp = htsOpen(testFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+
+    htsAlignmentColumns cols(4096);
+    size_t chunks = 0, mapped = 0;
+    auto total = cols.forEachChunk(htsReader<bamRecord>::range(fp, hdr), [&](const htsAlignmentColumns& c) {
+        chunks++;
+        mapped += c.flagMask(0, BAM_FUNMAP).count();
+    });
+    ASSERT_EQ(total, 45256);
+    ASSERT_EQ(chunks, (45256 + 4095) / 4096);
+
+    size_t expected = 0;
+    auto again = htsOpen(testFile, "r");
+    auto hdr2 = htsHeader<bamHeader>::read(again);
+    for(auto& r : htsReader<bamRecord>::range(again, hdr2)) if(!(r->core.flag & BAM_FUNMAP)) expected++;
+    ASSERT_EQ(mapped, expected);
+}
+
+TEST_F(AlignmentColumns, FillFromARegion) {
+    auto fp = htsOpen(testFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    auto idx = htsIndexOpen(testFile, testFile + ".bai");
+    htsIterator iter{sam_itr_querys(idx.get(), hdr.get(), "13:32900000-32950000")};
+    bamRecord rec{bam_init1()};
+
+    htsAlignmentColumns cols(10000);
+    size_t total = 0;
+    while(cols.fill(fp, iter, rec) > 0) total += cols.size();
+    ASSERT_EQ(total, 27112);
+}
+
+TEST_F(AlignmentColumns, MasksCombine) {
+    htsAlignmentColumns cols(100);
+    bam1_t rec;
+    memset(&rec, 0, sizeof(rec));
+    for(int i = 0; i < 100; i++) {
+        rec.core.qual = i;
+        rec.core.flag = i % 2 ? BAM_FREVERSE : 0;
+        ASSERT_TRUE(cols.push(rec));
+    }
+    ASSERT_FALSE(cols.push(rec));
+
+    auto mask = cols.mapqMask(60);
+    ASSERT_EQ(mask.count(), 40);
+    mask &= cols.flagMask(BAM_FREVERSE);
+    ASSERT_EQ(mask.count(), 20);
+    ASSERT_TRUE(mask.test(61));
+    ASSERT_FALSE(mask.test(62));
+    ASSERT_EQ(mask.flip().count(), 80);
+}
+
+TEST_F(AlignmentColumns, HistogramAndGroupBy) {
+    auto fp = htsOpen(testFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+
+    htsColumnHistogram mapq(0, 10, 7);
+    htsColumnHistogram filtered(0, 10, 7);
+    htsColumnGroupBy byTid(hdr->n_targets);
+    htsAlignmentColumns cols(4096);
+    cols.forEachChunk(htsReader<bamRecord>::range(fp, hdr), [&](const htsAlignmentColumns& c) {
+        mapq.add(c.mapq());
+        filtered.add(c.mapq(), c.mapqMask(20));
+        byTid.add(c.tid(), c.queryLength(), c.flagMask(0, BAM_FUNMAP));
+    });
+
+    ASSERT_EQ(mapq.total(), 45256);
+    auto counts = mapq.counts();
+    ASSERT_EQ(std::accumulate(counts.begin(), counts.end(), 0ULL), 45256);
+    ASSERT_EQ(filtered[0] + filtered[1], 0);
+    ASSERT_EQ(filtered.total(), mapq.total() - mapq[0] - mapq[1]);
+
+    uint64_t grouped = 0;
+    for(size_t k = 0; k < byTid.groups(); k++) grouped += byTid[k].count;
+    auto tid = bam_name2id(hdr.get(), "13");
+    ASSERT_GT(byTid[tid].count, 0);
+    ASSERT_LE(byTid[tid].min, byTid[tid].max);
+    ASSERT_LE(grouped, 45256);
+}
+
+TEST_F(AlignmentColumns, TruncatedInputIsAnError) {
+    scratchDir scratch;
+    auto truncated = scratch.path("truncated.bam");
+    {
+        std::ifstream in(testFile, std::ios::binary);
+        std::ofstream out(truncated, std::ios::binary);
+        out << in.rdbuf();
+    }
+    struct stat st;
+    ASSERT_EQ(stat(truncated.c_str(), &st), 0);
+    ASSERT_EQ(truncate(truncated.c_str(), st.st_size / 2), 0);
+
+    auto fp = htsOpen(truncated, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    ASSERT_NE(hdr.get(), nullptr);
+    bamRecord rec{bam_init1()};
+    htsAlignmentColumns cols(4096);
+    ssize_t n;
+    while((n = cols.fill(fp, hdr, rec)) > 0);
+    ASSERT_EQ(n, -1);
+}
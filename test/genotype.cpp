@@ -0,0 +1,125 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_variant.h"
+#include "../htslibpp_genotype.h"
+#include "scratch.h"
+#include <sys/stat.h>
+
+using namespace YiCppLib::HTSLibpp;
+
+class Genotype: public testing::Test {
+    public:
+        YiCppLib::HTSLibpp::htsFile htsFileHandler = htsOpen("datasets/brca2.platnium-trio.vcf", "r");
+
+        struct totals { size_t variants, alleles, called, hets, skipped; };
+
+        totals reduceAll(bcfHeader& header, size_t capacity) {
+            totals t{0, 0, 0, 0, 0};
+            auto block = htsGenotypeBlock::forHeader(header, capacity);
+            bcfRecord rec{bcf_init()};
+
+            while(block.fill(htsFileHandler, header, rec) > 0) {
+                for(size_t v = 0; v < block.size(); v++) {
+                    t.alleles += block.alleleCount(v);
+                    t.called  += block.calledCount(v);
+                    t.hets    += block.hetCount(v);
+                }
+                t.variants += block.size();
+                t.skipped  += block.skipped();
+            }
+            return t;
+        }
+};
+
+TEST_F(Genotype, CanEncodeGenotypes) {
+    htsGenotypeBlock block(3, 2);
+    const int32_t gt[] = {
+        bcf_gt_unphased(0), bcf_gt_unphased(0),
+        bcf_gt_unphased(0), bcf_gt_phased(1),
+        bcf_gt_missing,     bcf_gt_missing };
+
+    ASSERT_TRUE(block.push(0, 100, gt, 2));
+    ASSERT_EQ(block.at(0, 0), htsGenotypeBlock::HOM_REF);
+    ASSERT_EQ(block.at(0, 1), htsGenotypeBlock::HET);
+    ASSERT_EQ(block.at(0, 2), htsGenotypeBlock::MISSING);
+    ASSERT_EQ(block.calledCount(0), 2);
+    ASSERT_EQ(block.alleleCount(0), 1);
+    ASSERT_DOUBLE_EQ(block.heterozygosity(0), 0.5);
+
+    ASSERT_TRUE(block.push(0, 101, gt, 2));
+    ASSERT_FALSE(block.push(0, 102, gt, 2));
+}
+
+TEST_F(Genotype, RejectsGenotypesThatAreNotDiploid) {
+    htsGenotypeBlock block(2, 4);
+    const int32_t haploid[] = { bcf_gt_unphased(0), bcf_gt_unphased(1) };
+    const int32_t triploid[] = {
+        bcf_gt_unphased(0), bcf_gt_unphased(1), bcf_gt_unphased(1),
+        bcf_gt_unphased(0), bcf_gt_unphased(0), bcf_gt_unphased(0) };
+    const int32_t mixed[] = {
+        bcf_gt_unphased(0), bcf_gt_unphased(1),
+        bcf_gt_unphased(1), bcf_int32_vector_end };
+    const int32_t missing[] = {
+        bcf_gt_unphased(1), bcf_gt_unphased(1),
+        bcf_gt_missing,     bcf_int32_vector_end };
+
+    ASSERT_FALSE(block.push(0, 100, haploid, 1));
+    ASSERT_FALSE(block.push(0, 101, triploid, 3));
+    ASSERT_FALSE(block.push(0, 102, mixed, 2));
+    ASSERT_EQ(block.size(), 0);
+
+    ASSERT_TRUE(block.push(0, 103, missing, 2));
+    ASSERT_EQ(block.at(0, 0), htsGenotypeBlock::HOM_ALT);
+    ASSERT_EQ(block.at(0, 1), htsGenotypeBlock::MISSING);
+    ASSERT_DOUBLE_EQ(block.alleleFrequency(0), 1.0);
+}
+
+TEST_F(Genotype, CanReduceTrio) {
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+    auto t = reduceAll(header, 50);
+
+    ASSERT_EQ(t.variants, 173);
+    ASSERT_EQ(t.skipped, 0);
+    ASSERT_EQ(t.called, 173 * 3);
+    ASSERT_EQ(t.alleles, 490);
+    ASSERT_EQ(t.hets, 172);
+}
+
+TEST_F(Genotype, CanReduceSampleSubset) {
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+    ASSERT_EQ(htsHeader<bcfHeader>::setSamples(header, {"NA12878", "NA12892"}), 0);
+
+    auto t = reduceAll(header, 4096);
+
+    ASSERT_EQ(t.variants, 173);
+    ASSERT_EQ(t.called, 173 * 2);
+    ASSERT_EQ(t.alleles, 317);
+    ASSERT_EQ(t.hets, 159);
+}
+
+TEST_F(Genotype, TruncatedInputIsAnError) {
+    scratchDir scratch;
+    auto gzFile = scratch.path("genotype.vcf.gz");
+    {
+        auto fp = htsOpen("datasets/brca2.exac.vcf", "r");
+        auto hdr = htsHeader<bcfHeader>::read(fp);
+        auto out = htsWriter<bcfRecord>::open(gzFile, htsOutputFormat::VCF_GZ);
+        htsWriter<bcfRecord>::writeHeader(out, hdr);
+        for(auto& r : htsReader<bcfRecord>::range(fp, hdr)) htsWriter<bcfRecord>::write(out, hdr, *r);
+    }
+    struct stat st;
+    ASSERT_EQ(stat(gzFile.c_str(), &st), 0);
+    ASSERT_EQ(truncate(gzFile.c_str(), st.st_size / 2), 0);
+
+    auto fp = htsOpen(gzFile, "r");
+    auto header = htsHeader<bcfHeader>::read(fp);
+    ASSERT_NE(header.get(), nullptr);
+    auto block = htsGenotypeBlock::forHeader(header, 256);
+    bcfRecord rec{bcf_init()};
+    size_t variants = 0;
+    ssize_t n;
+    while((n = block.fill(fp, header, rec)) > 0) variants += n;
+
+    ASSERT_EQ(n, -1);
+    ASSERT_LT(variants + block.size(), 2196);
+}
@@ -7,3 +7,55 @@ TEST(HTSLibpp, CanCreateHTSFileObjectWithBamFile) {
     auto htsFileHandle = htsOpen("datasets/brca2.na12878.bam", "r");
     ASSERT_NE(htsFileHandle.get(), nullptr);
 }
+
+TEST(HTSLibpp, CanCreateHTSFileObjectWithThreadPool) {
+    YiCppLib::HTSLibpp::htsThreadPool pool(2);
+    ASSERT_NE(pool.get(), nullptr);
+    ASSERT_EQ(pool.size(), 2);
+
+    auto htsFileHandle = htsOpen("datasets/brca2.na12878.bam", "r", pool);
+    ASSERT_NE(htsFileHandle.get(), nullptr);
+}
+
+TEST(HTSLibpp, CanShareThreadPoolAcrossFiles) {
+    YiCppLib::HTSLibpp::htsThreadPool pool(2);
+    auto first  = htsOpen("datasets/brca2.na12878.bam", "r", pool);
+    auto second = htsOpen("datasets/brca2.na12878.bam", "r", pool);
+    ASSERT_NE(first.get(), nullptr);
+    ASSERT_NE(second.get(), nullptr);
+}
+
+TEST(HTSLibpp, CanMapFile) {
+    htsMappedFile file("datasets/brca2.na12878.bam");
+    ASSERT_TRUE(file.good());
+
+    struct stat st;
+    ASSERT_EQ(stat("datasets/brca2.na12878.bam", &st), 0);
+    ASSERT_EQ(file.size(), st.st_size);
+
+    // a BAM file is a series of gzip blocks
+    auto bytes = static_cast<const unsigned char *>(file.data());
+    ASSERT_EQ(bytes[0], 0x1f);
+    ASSERT_EQ(bytes[1], 0x8b);
+    ASSERT_EQ(file.advise(st.st_size / 2, 4096, htsMappedFile::Access::WILLNEED), 0);
+}
+
+TEST(HTSLibpp, MissingFileIsNotMapped) {
+    htsMappedFile file("datasets/does-not-exist.bam");
+    ASSERT_FALSE(file.good());
+    ASSERT_EQ(htsOpen(file).get(), nullptr);
+}
+
+TEST(HTSLibpp, CanOpenMappedFile) {
+    htsMappedFile file("datasets/brca2.na12878.bam");
+    auto htsFileHandle = htsOpen(file);
+    ASSERT_NE(htsFileHandle.get(), nullptr);
+    ASSERT_EQ(htsFileHandle->format.format, bam);
+}
+
+TEST(HTSLibpp, CanOpenBufferInPlace) {
+    const std::string text = "##fileformat=VCFv4.2\n#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\n";
+    auto htsFileHandle = htsOpenMemory(text.data(), text.size());
+    ASSERT_NE(htsFileHandle.get(), nullptr);
+    ASSERT_EQ(htsFileHandle->format.format, vcf);
+}
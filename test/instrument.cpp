@@ -0,0 +1,68 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_variant.h"
+
+using namespace YiCppLib::HTSLibpp;
+
+class Instrument : public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.na12878.bam";
+        const std::string brca2Region = "13:32900000-32950000";
+};
+
+#ifdef HTSLIBPP_INSTRUMENT
+TEST_F(Instrument, CountsSequentialReads) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+    uint64_t decoded = 0;
+    for(auto& r : htsReader<bamRecord>::range(fp, header)) decoded += r->l_data;
+
+    auto stats = htsStatsOf(fp);
+    ASSERT_EQ(stats.filename, testFile);
+    ASSERT_EQ(stats.records, 45256);
+    ASSERT_EQ(stats.bytesOut, decoded);
+    ASSERT_GT(stats.bytesIn, 0);
+    ASSERT_GT(stats.blocks, 0);
+    ASSERT_GT(stats.readNanos, 0);
+}
+
+TEST_F(Instrument, CountsRegionSeeks) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+    auto index = htsIndexOpen(testFile, testFile + ".bai");
+    for(auto& r : htsReader<bamRecord>::range(fp, header, index, brca2Region));
+
+    auto stats = htsStatsOf(fp);
+    ASSERT_EQ(stats.records, 27112);
+    ASSERT_GT(stats.seeks, 0);
+}
+
+TEST_F(Instrument, ClosedFilesAreKeptInSnapshot) {
+    auto before = uint64_t{0};
+    for(const auto& s : htsStatsSnapshot()) if(s.filename == "datasets/brca2.platnium-trio.vcf") before = s.records;
+    {
+        auto fp = htsOpen("datasets/brca2.platnium-trio.vcf", "r");
+        auto header = htsHeader<bcfHeader>::read(fp);
+        for(auto& v : htsReader<bcfRecord>::range(fp, header));
+    }
+
+    auto after = uint64_t{0};
+    for(const auto& s : htsStatsSnapshot()) if(s.filename == "datasets/brca2.platnium-trio.vcf") after = s.records;
+    ASSERT_EQ(after - before, 173);
+
+    auto text = htsStatsPrometheus();
+    ASSERT_NE(text.find("# TYPE htslibpp_records_total counter"), std::string::npos);
+    ASSERT_NE(text.find("htslibpp_records_total{file=\"datasets/brca2.platnium-trio.vcf\"}"), std::string::npos);
+}
+#else
+TEST_F(Instrument, IsEmptyWhenCompiledOut) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+    for(auto& r : htsReader<bamRecord>::range(fp, header));
+
+    ASSERT_EQ(htsStatsOf(fp).records, 0);
+    ASSERT_TRUE(htsStatsSnapshot().empty());
+    ASSERT_TRUE(htsStatsPrometheus().empty());
+}
+#endif
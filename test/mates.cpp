@@ -0,0 +1,77 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_mates.h"
+
+using namespace YiCppLib::HTSLibpp;
+
+class MatePairer : public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.na12878.bam";
+        const std::string testIndex = testFile + ".bai";
+
+        YiCppLib::HTSLibpp::htsFile htsFileHandler = htsOpen(testFile, "r");
+        bamHeader header = htsHeader<bamHeader>::read(htsFileHandler);
+
+        struct tally {
+            size_t eligible = 0;
+            size_t pairs = 0;
+            size_t orphans = 0;
+            bool matched = true;
+        };
+
+        tally pairAll(size_t maxPending, const std::string& spillPrefix = "", int status = 0) {
+            tally t;
+            auto onPair = [&](const bam1_t& first, const bam1_t& second) {
+                t.pairs++;
+                if(strcmp(bam_get_qname(&first), bam_get_qname(&second)) != 0) t.matched = false;
+                if((first.core.flag & BAM_FREAD1) == (second.core.flag & BAM_FREAD1)) t.matched = false;
+            };
+            auto onOrphan = [&](const bam1_t&) { t.orphans++; };
+
+            htsMatePairer pairer(header, maxPending, 64, spillPrefix);
+            for(auto& r : htsReader<bamRecord>::range(htsFileHandler, header)) {
+                if((r->core.flag & BAM_FPAIRED) && !(r->core.flag & (BAM_FSECONDARY | BAM_FSUPPLEMENTARY))) t.eligible++;
+                pairer.push(r, onPair, onOrphan);
+            }
+            EXPECT_EQ(pairer.finish(onPair, onOrphan), status);
+            return t;
+        }
+};
+
+TEST_F(MatePairer, EveryReadIsPairedOrOrphaned) {
+    auto t = pairAll(htsMatePairer::defaultMaxPending);
+    ASSERT_GT(t.pairs, 0);
+    ASSERT_TRUE(t.matched);
+    ASSERT_EQ(t.pairs * 2 + t.orphans, t.eligible);
+}
+
+TEST_F(MatePairer, SpillingFindsTheSamePairs) {
+    auto unbounded = pairAll(htsMatePairer::defaultMaxPending);
+
+    auto fp = htsOpen(testFile, "r");
+    htsFileHandler.swap(fp);
+    header = htsHeader<bamHeader>::read(htsFileHandler);
+    auto bounded = pairAll(64);
+
+    ASSERT_TRUE(bounded.matched);
+    ASSERT_EQ(bounded.pairs, unbounded.pairs);
+    ASSERT_EQ(bounded.orphans, unbounded.orphans);
+}
+
+TEST_F(MatePairer, ShardsFindTheSamePairs) {
+    auto serial = pairAll(htsMatePairer::defaultMaxPending);
+
+    auto shards = htsHeader<bamHeader>::shards(header, 5000, true);
+    size_t pairs = 0;
+    ASSERT_EQ(htsMatePairer::reduce(testFile, testIndex, shards, 4, pairs,
+            [](size_t& acc, const bam1_t&, const bam1_t&) { acc++; },
+            [](size_t& acc, size_t&& other) { acc += other; }), 0);
+    ASSERT_EQ(pairs, serial.pairs);
+}
+
+TEST_F(MatePairer, UnwritableSpillFallsBackToOrphans) {
+    auto t = pairAll(64, "/nonexistent-htslibpp-dir/mates-", -1);
+    ASSERT_TRUE(t.matched);
+    ASSERT_EQ(t.pairs * 2 + t.orphans, t.eligible);
+}
@@ -0,0 +1,68 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_parallel.h"
+
+using namespace YiCppLib::HTSLibpp;
+
+class BamParallel : public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.na12878.bam";
+        const std::string testIndex = testFile + ".bai";
+        const std::string brca2Region = "13:32900000-32950000";
+
+        static auto count() { return [](size_t& acc, const bamRecord& r) { acc++; }; }
+        static auto sum() { return [](size_t& acc, size_t&& other) { acc += other; }; }
+};
+
+TEST_F(BamParallel, HeaderShardsCoverEveryReference) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+
+    auto shards = htsHeader<bamHeader>::shards(header, 1000000, true);
+    ASSERT_EQ(shards.back().tid, HTS_IDX_NOCOOR);
+
+    int64_t covered = 0, total = 0;
+    for(const auto& s : shards) if(s.tid >= 0) covered += s.end - s.beg;
+    for(int32_t tid = 0; tid < header->n_targets; tid++) total += header->target_len[tid];
+    ASSERT_EQ(covered, total);
+}
+
+TEST_F(BamParallel, OverlappingRegionsAreMerged) {
+    auto fp = htsOpen(testFile, "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+
+    auto regions = htsHeader<bamHeader>::regions(header, {"13:32900000-32920000", "13:32910000-32950000"});
+    ASSERT_EQ(regions.size(), 1);
+    ASSERT_EQ(regions[0], htsHeader<bamHeader>::region(header, brca2Region));
+}
+
+TEST_F(BamParallel, CanCountWholeFile) {
+    size_t read_count = 0;
+    ASSERT_EQ(htsParallel<bamRecord>::reduce(testFile, testIndex, 10000000, 4, read_count, count(), sum()), 0);
+    ASSERT_EQ(read_count, 45256);
+}
+
+TEST_F(BamParallel, RegionShardsVisitEachRecordOnce) {
+    std::vector<std::string> regions{brca2Region};
+    size_t read_count = 0;
+    ASSERT_EQ(htsParallel<bamRecord>::reduce(testFile, testIndex, regions, 1000, 8, read_count, count(), sum()), 0);
+    ASSERT_EQ(read_count, 27112);
+}
+
+TEST_F(BamParallel, MergeFollowsShardOrder) {
+    std::vector<std::string> regions{brca2Region};
+    std::vector<int32_t> positions;
+    ASSERT_EQ(htsParallel<bamRecord>::reduce(testFile, testIndex, regions, 5000, 4, positions,
+            [](auto& acc, const bamRecord& r) { acc.push_back(r->core.pos); },
+            [](auto& acc, auto&& other) { acc.insert(acc.end(), other.begin(), other.end()); }), 0);
+
+    ASSERT_EQ(positions.size(), 27112);
+    ASSERT_TRUE(std::is_sorted(positions.begin(), positions.end()));
+}
+
+TEST_F(BamParallel, MissingIndexIsReported) {
+    size_t read_count = 42;
+    ASSERT_EQ(htsParallel<bamRecord>::reduce(testFile, testFile + ".missing.bai", 10000000, 4, read_count, count(), sum()), -1);
+    ASSERT_EQ(read_count, 42);
+}
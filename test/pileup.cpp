@@ -0,0 +1,118 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_pileup.h"
+
+using namespace YiCppLib::HTSLibpp;
+
+class BamPileup : public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.na12878.bam";
+        const std::string testIndex = testFile + ".bai";
+        const std::string brca2Region = "13:32900000-32950000";
+
+        YiCppLib::HTSLibpp::htsFile htsFileHandler = htsOpen(testFile, "r");
+        bamHeader header = htsHeader<bamHeader>::read(htsFileHandler);
+        htsIndex index = htsIndexOpen(testFile, testIndex);
+};
+
+TEST_F(BamPileup, DepthMatchesAlignedBases) {
+    auto region = htsHeader<bamHeader>::region(header, brca2Region);
+    auto depth = htsPileup::depth(htsFileHandler, header, index, region);
+    ASSERT_EQ(depth.size(), region.end - region.beg);
+
+    // count every reference base covered by an M, =, X or D operation
+    // directly, clipped to the region
+    htsPileupFilter filter;
+    uint64_t expected = 0;
+    auto fp = htsOpen(testFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    for(auto& r : htsReader<bamRecord>::range(fp, hdr, index, brca2Region)) {
+        if(!filter.pass(*r)) continue;
+        auto pos = r->core.pos;
+        for(auto op : htsProxy(r).cigar()) {
+            auto len = static_cast<int32_t>(bam_cigar_oplen(op));
+            auto type = bam_cigar_type(bam_cigar_op(op));
+            if(type & 2) {
+                if(type & 1 || bam_cigar_op(op) == BAM_CDEL)
+                    expected += std::max(0, std::min(pos + len, region.end) - std::max(pos, region.beg));
+                pos += len;
+            }
+        }
+    }
+
+    uint64_t total = 0;
+    for(auto d : depth) total += d;
+    ASSERT_GT(total, 0);
+    ASSERT_EQ(total, expected);
+}
+
+TEST_F(BamPileup, ColumnsAreSortedAndCounted) {
+    auto region = htsHeader<bamHeader>::region(header, brca2Region);
+    auto columns = htsPileup::columns(htsFileHandler, header, index, region);
+    ASSERT_GT(columns.size(), 0);
+
+    for(size_t i = 1; i < columns.size(); i++) ASSERT_LT(columns[i-1].pos, columns[i].pos);
+    for(const auto& c : columns) {
+        ASSERT_EQ(c.tid, region.tid);
+        ASSERT_GE(c.pos, region.beg);
+        ASSERT_LT(c.pos, region.end);
+        ASSERT_GT(c.depth(), 0);
+    }
+}
+
+TEST_F(BamPileup, BaseQualityFilterLowersDepth) {
+    auto region = htsHeader<bamHeader>::region(header, brca2Region);
+    htsPileupFilter filter;
+    filter.minBaseQ = 30;
+
+    auto all = htsPileup::depth(htsFileHandler, header, index, region);
+    auto fp = htsOpen(testFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    auto filtered = htsPileup::depth(fp, hdr, index, region, filter);
+
+    ASSERT_EQ(all.size(), filtered.size());
+    for(size_t i = 0; i < all.size(); i++) ASSERT_LE(filtered[i], all[i]);
+}
+
+TEST_F(BamPileup, ParallelShardsMatchSerialPass) {
+    auto region = htsHeader<bamHeader>::region(header, brca2Region);
+    auto serial = htsPileup::columns(htsFileHandler, header, index, region);
+    auto serialDepth = htsPileup::depth(htsFileHandler, header, index, region);
+
+    auto shards = htsSplitRegions({region}, 3000);
+    std::vector<htsPileupColumn> columns;
+    std::vector<uint32_t> depth;
+    ASSERT_EQ(htsPileup::columns(testFile, testIndex, shards, 4, columns), 0);
+    ASSERT_EQ(htsPileup::depth(testFile, testIndex, shards, 4, depth), 0);
+    ASSERT_EQ(columns, serial);
+    ASSERT_EQ(depth, serialDepth);
+}
+
+TEST_F(BamPileup, ParallelPassesReportAMissingIndex) {
+    auto shards = htsSplitRegions({htsHeader<bamHeader>::region(header, brca2Region)}, 3000);
+    std::vector<htsPileupColumn> columns;
+    std::vector<uint32_t> depth{1, 2, 3};
+    ASSERT_EQ(htsPileup::columns(testFile, testFile + ".missing.bai", shards, 4, columns), -1);
+    ASSERT_EQ(htsPileup::depth(testFile, testFile + ".missing.bai", shards, 4, depth), -1);
+    ASSERT_TRUE(columns.empty());
+    ASSERT_EQ(depth, std::vector<uint32_t>({1, 2, 3}));
+}
+
+TEST_F(BamPileup, RecordsBehindThePileupAreRejected) {
+    auto fp = htsOpen(testFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    htsPileupFilter filter;
+    bamRecord first{bam_init1()}, later{bam_init1()};
+    while(htsReader<bamRecord>::next(fp, hdr, first.get()) >= 0 && !(first->core.tid >= 0 && filter.pass(*first)));
+    while(htsReader<bamRecord>::next(fp, hdr, later.get()) >= 0 && !(filter.pass(*later) && later->core.pos > bam_endpos(first.get())));
+    ASSERT_EQ(later->core.tid, first->core.tid);
+
+    size_t emitted = 0;
+    auto emit = [&](const htsPileupColumn&) { emitted++; };
+    htsPileup pileup;
+    ASSERT_EQ(pileup.push(first, emit), 0);
+    ASSERT_EQ(pileup.push(later, emit), 0);
+    ASSERT_GT(emitted, 0);
+    ASSERT_EQ(pileup.push(first, emit), -1);
+}
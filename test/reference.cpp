@@ -0,0 +1,133 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_reference.h"
+#include "scratch.h"
+#include <htslib/bgzf.h>
+#include <htslib/faidx.h>
+#include <htslib/sam.h>
+
+#include <fstream>
+#include <random>
+
+using namespace YiCppLib::HTSLibpp;
+
+// Two contigs of random bases, 60 to a line, written both plain and bgzip
+// compressed, and indexed by htslib
+class Reference : public testing::Test {
+    public:
+        scratchDir scratch;
+        std::string plain;
+        std::string compressed;
+        std::vector<std::string> sequences;
+
+        void SetUp() override {
+            plain = scratch.path("reference.fa");
+            compressed = scratch.path("reference.fa.gz");
+
+            std::mt19937 rng(42);
+            std::string text;
+            for(auto length : {250000, 1234}) {
+                std::string seq(length, 'N');
+                for(auto& b : seq) b = "ACGT"[rng() & 3];
+
+                text += ">chr" + std::to_string(sequences.size() + 1) + "\n";
+                for(size_t i = 0; i < seq.size(); i += 60) text += seq.substr(i, 60) + "\n";
+                sequences.push_back(seq);
+            }
+
+            std::ofstream(plain) << text;
+            auto fp = bgzf_open(compressed.c_str(), "w");
+            bgzf_write(fp, text.data(), text.size());
+            bgzf_close(fp);
+
+            fai_build(plain.c_str());
+            fai_build(compressed.c_str());
+        }
+};
+
+TEST_F(Reference, PlainSlicesWithinALineAreViews) {
+    htsReference ref(plain);
+    ASSERT_TRUE(ref.good());
+    ASSERT_FALSE(ref.compressed());
+    ASSERT_EQ(ref.contigs().size(), 2);
+    ASSERT_EQ(ref.tid("chr2"), 1);
+    ASSERT_EQ(ref.contigs()[1].length, 1234);
+
+    auto inLine = ref.slice("chr1", 125, 170);
+    ASSERT_TRUE(inLine.zeroCopy());
+    ASSERT_EQ(inLine.view(), sequences[0].substr(125, 45));
+
+    auto acrossLines = ref.slice("chr1", 100, 10100);
+    ASSERT_FALSE(acrossLines.zeroCopy());
+    ASSERT_EQ(acrossLines.view(), sequences[0].substr(100, 10000));
+
+    ASSERT_EQ(ref.slice("chr2", 1200, 5000).view(), sequences[1].substr(1200));
+    ASSERT_TRUE(ref.slice("chrM", 0, 10).empty());
+}
+
+TEST_F(Reference, CompressedSlicesMatchThroughABoundedCache) {
+    htsReference ref(compressed, 64 << 10);
+    ASSERT_TRUE(ref.good());
+    ASSERT_TRUE(ref.compressed());
+
+    std::mt19937 rng(7);
+    for(int i = 0; i < 200; i++) {
+        int tid = rng() % 2;
+        int64_t beg = rng() % sequences[tid].size();
+        int64_t len = rng() % 5000;
+        auto slice = ref.slice(tid, beg, beg + len);
+        ASSERT_EQ(slice.view(), sequences[tid].substr(beg, len));
+        ASSERT_LE(ref.cacheBytes(), 64 << 10);
+    }
+}
+
+TEST_F(Reference, ProvidersAreSharedPerFile) {
+    auto first = htsReference::shared(plain);
+    auto second = htsReference::shared(plain);
+    ASSERT_EQ(first.get(), second.get());
+    ASSERT_NE(first.get(), htsReference::shared(compressed).get());
+}
+
+// CRAM readers attached to one htsReference only share a refs_t with
+// htslib 1.10 or later; below that attach() only points each reader at the
+// FASTA file, so the test is not built and does not appear in the test list
+#if defined(HTS_VERSION) && HTS_VERSION >= 101000
+TEST_F(Reference, CramReadersShareOneReference) {
+    auto ref = htsReference::shared(plain);
+    auto cram = scratch.path("reads.cram");
+
+    std::string text = "@HD\tVN:1.6\tSO:coordinate\n@SQ\tSN:chr1\tLN:250000\n@SQ\tSN:chr2\tLN:1234\n";
+    bamHeader hdr{sam_hdr_parse(static_cast<int>(text.size()), text.c_str())};
+    {
+        auto out = htsOpen(cram, htsWriteMode(htsOutputFormat::CRAM), *ref);
+        ASSERT_NE(out.get(), nullptr);
+        ASSERT_EQ(htsWriter<bamRecord>::writeHeader(out, hdr), 0);
+
+        bamRecord rec{bam_init1()};
+        for(int pos = 100; pos < 200000; pos += 5000) {
+            std::string line = "r" + std::to_string(pos) + "\t0\tchr1\t" + std::to_string(pos + 1) + "\t60\t50M\t*\t0\t0\t" + sequences[0].substr(pos, 50) + "\t*";
+            kstring_t ks{line.size(), line.size() + 1, &line[0]};
+            ASSERT_EQ(sam_parse1(&ks, hdr.get(), rec.get()), 0);
+            ASSERT_GE(htsWriter<bamRecord>::write(out, hdr, rec), 0);
+        }
+    }
+
+    auto first = htsOpen(cram, "r", *ref);
+    auto second = htsOpen(cram, "r", *ref);
+    ASSERT_NE(first.get(), nullptr);
+    ASSERT_NE(second.get(), nullptr);
+    ASSERT_EQ(cram_get_refs(first.get()), cram_get_refs(second.get()));
+
+    for(auto fp : {&first, &second}) {
+        auto h = htsHeader<bamHeader>::read(*fp);
+        size_t count = 0;
+        for(auto& r : htsReader<bamRecord>::range(*fp, h)) {
+            std::string seq;
+            for(int i = 0; i < r->core.l_qseq; i++) seq += seq_nt16_str[bam_seqi(bam_get_seq(r.get()), i)];
+            ASSERT_EQ(seq, sequences[0].substr(r->core.pos, 50));
+            count++;
+        }
+        ASSERT_EQ(count, 40);
+    }
+}
+#endif
@@ -0,0 +1,50 @@
+// Scratch files for the tests
+//
+// Every test that writes files gets a directory of its own, created with
+// mkdtemp in $TMPDIR, so that test runs in parallel never share a path.
+// The directory is removed with everything in it when the object goes out
+// of scope, which also happens when an assertion returns early.
+
+#include "../htslibpp.h"
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#ifndef YICPPLIB_HTSLIBPP_TEST_SCRATCH
+#define YICPPLIB_HTSLIBPP_TEST_SCRATCH
+
+class scratchDir {
+    protected:
+        std::string m_path;
+
+    public:
+        scratchDir() {
+            auto path = YiCppLib::HTSLibpp::htsTempDir() + "/htslibpp-test-XXXXXX";
+            if(mkdtemp(&path[0]) != nullptr) m_path = path;
+        }
+
+        scratchDir(const scratchDir&) = delete;
+        scratchDir& operator=(const scratchDir&) = delete;
+
+        ~scratchDir() {
+            if(m_path.empty()) return;
+
+            // the tests only write plain files, such as outputs and their indexes
+            DIR * dir = opendir(m_path.c_str());
+            if(dir != nullptr) {
+                while(auto entry = readdir(dir)) {
+                    std::string name(entry->d_name);
+                    if(name != "." && name != "..") unlink((m_path + "/" + name).c_str());
+                }
+                closedir(dir);
+            }
+            rmdir(m_path.c_str());
+        }
+
+        bool good() const { return !m_path.empty(); }
+
+        // a path in the directory. nothing is created
+        std::string path(const std::string& name) const { return m_path + "/" + name; }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_simd.h"
+
+#include <random>
+#include <vector>
+
+using namespace YiCppLib::HTSLibpp;
+
+class Simd : public testing::Test {
+    public:
+        std::vector<simd::Level> levels() {
+            std::vector<simd::Level> supported{simd::Level::SCALAR};
+            if(simd::detectedLevel() != simd::Level::SCALAR) supported.push_back(simd::Level::SSE);
+            if(simd::detectedLevel() == simd::Level::AVX2) supported.push_back(simd::Level::AVX2);
+            return supported;
+        }
+
+        std::vector<uint8_t> randomBytes(size_t n, unsigned seed) {
+            std::mt19937 rng(seed);
+            std::vector<uint8_t> bytes(n);
+            for(auto& b : bytes) b = static_cast<uint8_t>(rng());
+            return bytes;
+        }
+};
+
+TEST_F(Simd, CanDecodeKnownSequence) {
+    // ACGTN packed as 0x12 0x48 0xf0
+    const uint8_t packed[] = { 0x12, 0x48, 0xf0 };
+    char out[5];
+
+    for(auto level : levels()) {
+        simd::decodeSequence(packed, 5, out, level);
+        ASSERT_EQ(std::string(out, 5), "ACGTN");
+
+        simd::reverseComplement(packed, 5, out, level);
+        ASSERT_EQ(std::string(out, 5), "NACGT");
+    }
+}
+
+TEST_F(Simd, VectorDecodingMatchesScalar) {
+    for(size_t len = 0; len < 300; len += 7) {
+        auto packed = randomBytes((len + 1) / 2, len);
+        std::vector<char> expected(len), actual(len);
+        std::vector<uint8_t> expected2(len), actual2(len);
+
+        simd::decodeSequence(packed.data(), len, expected.data(), simd::Level::SCALAR);
+        simd::decodeSequence2Bit(packed.data(), len, expected2.data(), simd::Level::SCALAR);
+
+        for(auto level : levels()) {
+            simd::decodeSequence(packed.data(), len, actual.data(), level);
+            ASSERT_EQ(actual, expected);
+
+            simd::decodeSequence2Bit(packed.data(), len, actual2.data(), level);
+            ASSERT_EQ(actual2, expected2);
+        }
+    }
+}
+
+TEST_F(Simd, VectorReverseComplementMatchesScalar) {
+    for(size_t len = 0; len < 300; len += 5) {
+        auto packed = randomBytes((len + 1) / 2, len);
+        std::vector<char> expected(len), actual(len);
+
+        simd::reverseComplement(packed.data(), len, expected.data(), simd::Level::SCALAR);
+        for(auto level : levels()) {
+            simd::reverseComplement(packed.data(), len, actual.data(), level);
+            ASSERT_EQ(actual, expected);
+        }
+    }
+}
+
+TEST_F(Simd, VectorQualityStatsMatchScalar) {
+    // long enough to exercise the flushing of the per-byte counters
+    for(size_t len : {0, 1, 15, 16, 33, 101, 151, 250, 10000}) {
+        auto qual = randomBytes(len, len);
+        for(auto& q : qual) q %= 42;
+
+        auto expected = simd::baseQualityStats(qual.data(), len, 20, simd::Level::SCALAR);
+        for(auto level : levels()) {
+            auto actual = simd::baseQualityStats(qual.data(), len, 20, level);
+            ASSERT_EQ(actual.sum, expected.sum);
+            ASSERT_EQ(actual.min, expected.min);
+            ASSERT_EQ(actual.count, expected.count);
+            ASSERT_EQ(actual.countAbove, expected.countAbove);
+        }
+    }
+}
+
+TEST_F(Simd, CanDecodeAlignmentSequence) {
+    auto fp = htsOpen("datasets/brca2.na12878.bam", "r");
+    auto header = htsHeader<bamHeader>::read(fp);
+    auto firstRead = htsReader<bamRecord>::begin(fp, header);
+    auto proxy = htsProxy(*firstRead);
+
+    std::vector<char> out(proxy.queryLength());
+    simd::decodeSequence(proxy.sequence(), out.data());
+    ASSERT_EQ(std::string(out.begin(), out.end()), proxy.sequence().str());
+
+    auto stats = simd::baseQualityStats(proxy.baseQualities(), 20);
+    ASSERT_EQ(stats.count, proxy.queryLength());
+}
@@ -0,0 +1,140 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_variant.h"
+#include "../htslibpp_sort.h"
+#include "scratch.h"
+
+using namespace YiCppLib::HTSLibpp;
+
+class AlignmentSort : public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.na12878.bam";
+        scratchDir scratch;
+
+        // the number of records of file, and whether they are in order
+        std::pair<size_t, bool> check(const std::string& filename, htsSortOrder order) {
+            auto fp = htsOpen(filename, "r");
+            auto hdr = htsHeader<bamHeader>::read(fp);
+            bamRecord prev{bam_init1()};
+            size_t count = 0;
+            bool sorted = true;
+            for(auto& r : htsReader<bamRecord>::range(fp, hdr)) {
+                if(count++ > 0 && htsSorter<bamRecord>::compare(order, *prev, *r) > 0) sorted = false;
+                bam_copy1(prev.get(), r.get());
+            }
+            return std::make_pair(count, sorted);
+        }
+
+        std::vector<std::pair<int32_t, int32_t>> positions(const std::string& filename) {
+            auto fp = htsOpen(filename, "r");
+            auto hdr = htsHeader<bamHeader>::read(fp);
+            std::vector<std::pair<int32_t, int32_t>> result;
+            for(auto& r : htsReader<bamRecord>::range(fp, hdr)) result.emplace_back(r->core.tid, r->core.pos);
+            return result;
+        }
+};
+
+TEST_F(AlignmentSort, SmallInputStaysInMemory) {
+    auto fp = htsOpen(testFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    auto output = scratch.path("memory.bam");
+
+    htsSorter<bamRecord> sorter(hdr, htsSortOrder::QUERYNAME);
+    ASSERT_EQ(sorter.consume(htsReader<bamRecord>::range(fp, hdr)), 0);
+    ASSERT_EQ(sorter.runs(), 0);
+    ASSERT_EQ(sorter.finish(output), 0);
+
+    ASSERT_EQ(check(output, htsSortOrder::QUERYNAME), std::make_pair(static_cast<size_t>(45256), true));
+}
+
+TEST_F(AlignmentSort, QuerynameAndBackThroughRuns) {
+    auto byName = scratch.path("name.bam");
+    auto byCoordinate = scratch.path("coordinate.bam");
+
+    {
+        auto fp = htsOpen(testFile, "r");
+        auto hdr = htsHeader<bamHeader>::read(fp);
+        htsSorter<bamRecord> sorter(hdr, htsSortOrder::QUERYNAME, 1 << 20, 2);
+        ASSERT_EQ(sorter.consume(htsReader<bamRecord>::range(fp, hdr)), 0);
+        ASSERT_GT(sorter.runs(), 1);
+        ASSERT_EQ(sorter.finish(byName), 0);
+        ASSERT_EQ(sorter.runs(), 0);
+    }
+    ASSERT_EQ(check(byName, htsSortOrder::QUERYNAME), std::make_pair(static_cast<size_t>(45256), true));
+
+    {
+        auto fp = htsOpen(byName, "r");
+        auto hdr = htsHeader<bamHeader>::read(fp);
+        ASSERT_THAT(std::string(hdr->text, hdr->l_text), testing::HasSubstr("SO:queryname"));
+
+        htsSorter<bamRecord> sorter(hdr, htsSortOrder::COORDINATE, 1 << 20, 2);
+        ASSERT_EQ(sorter.consume(htsReader<bamRecord>::range(fp, hdr)), 0);
+        ASSERT_EQ(sorter.finish(byCoordinate), 0);
+    }
+    ASSERT_EQ(positions(byCoordinate), positions(testFile));
+}
+
+TEST_F(AlignmentSort, MergeSortedInputs) {
+    std::vector<std::string> parts{scratch.path("part0.bam"), scratch.path("part1.bam"), scratch.path("part2.bam")};
+    auto merged = scratch.path("merged.bam");
+
+    {
+        auto fp = htsOpen(testFile, "r");
+        auto hdr = htsHeader<bamHeader>::read(fp);
+        std::vector<YiCppLib::HTSLibpp::htsFile> out;
+        for(auto& part : parts) {
+            out.push_back(htsWriter<bamRecord>::open(part));
+            htsWriter<bamRecord>::writeHeader(out.back(), hdr);
+        }
+        size_t i = 0;
+        for(auto& r : htsReader<bamRecord>::range(fp, hdr)) htsWriter<bamRecord>::write(out[i++ % out.size()], hdr, r);
+    }
+
+    ASSERT_EQ(htsSorter<bamRecord>::merge(parts, merged), 0);
+    ASSERT_EQ(positions(merged), positions(testFile));
+}
+
+class VariantSort : public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.platnium-trio.vcf";
+        const std::string otherFile = "datasets/brca2.exac.vcf";
+        scratchDir scratch;
+};
+
+TEST_F(VariantSort, SortThroughRuns) {
+    auto output = scratch.path("variants.bcf");
+
+    {
+        auto fp = htsOpen(testFile, "r");
+        auto hdr = htsHeader<bcfHeader>::read(fp);
+        htsSorter<bcfRecord> sorter(hdr, 16 << 10, 2);
+        ASSERT_EQ(sorter.consume(htsReader<bcfRecord>::range(fp, hdr)), 0);
+        ASSERT_GT(sorter.runs(), 1);
+        ASSERT_EQ(sorter.finish(output), 0);
+    }
+
+    auto fp = htsOpen(output, "r");
+    auto hdr = htsHeader<bcfHeader>::read(fp);
+    std::vector<int32_t> pos;
+    for(auto& r : htsReader<bcfRecord>::range(fp, hdr)) pos.push_back(r->pos);
+
+    ASSERT_EQ(pos.size(), 173);
+    ASSERT_EQ(pos.front(), 32889967);
+    ASSERT_TRUE(std::is_sorted(pos.begin(), pos.end()));
+}
+
+TEST_F(VariantSort, MergeChecksHeaders) {
+    auto output = scratch.path("merged.bcf");
+
+    ASSERT_EQ(htsSorter<bcfRecord>::merge({testFile, testFile}, output), 0);
+    {
+        auto fp = htsOpen(output, "r");
+        auto hdr = htsHeader<bcfHeader>::read(fp);
+        size_t count = 0;
+        for(auto& r : htsReader<bcfRecord>::range(fp, hdr)) { (void)r; count++; }
+        ASSERT_EQ(count, 173 * 2);
+    }
+
+    ASSERT_EQ(htsSorter<bcfRecord>::merge({testFile, otherFile}, output), -1);
+}
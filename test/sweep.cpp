@@ -0,0 +1,81 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_alignment.h"
+#include "../htslibpp_variant.h"
+#include "../htslibpp_sweep.h"
+
+using namespace YiCppLib;
+using namespace YiCppLib::HTSLibpp;
+
+class SweepJoin : public testing::Test {
+    public:
+        const std::string bamFile = "datasets/brca2.na12878.bam";
+        const std::string vcfFile = "datasets/brca2.exac.vcf";
+
+        // the number of reads overlapping every site, one region query at a time
+        std::vector<int> queried() {
+            auto fp = htsOpen(bamFile, "r");
+            auto hdr = htsHeader<bamHeader>::read(fp);
+            auto idx = htsIndexOpen(bamFile, bamFile + ".bai");
+            htsPileupFilter filter;
+            bamRecord rec{bam_init1()};
+
+            auto vcf = htsOpen(vcfFile, "r");
+            auto vcfHdr = htsHeader<bcfHeader>::read(vcf);
+            std::vector<int> result;
+            for(auto& site : htsReader<bcfRecord>::range(vcf, vcfHdr)) {
+                auto tid = bam_name2id(hdr.get(), bcf_hdr_id2name(vcfHdr.get(), site->rid));
+                htsIterator iter{sam_itr_queryi(idx.get(), tid, site->pos, site->pos + site->rlen)};
+                int count = 0;
+                while(htsReader<bamRecord>::next(fp, iter.get(), rec.get()) >= 0) if(filter.pass(*rec)) count++;
+                result.push_back(count);
+            }
+            return result;
+        }
+
+        std::vector<int> swept(htsIndex * idx, int64_t seekGap, size_t * seeks = nullptr) {
+            auto fp = htsOpen(bamFile, "r");
+            auto hdr = htsHeader<bamHeader>::read(fp);
+            auto vcf = htsOpen(vcfFile, "r");
+            auto vcfHdr = htsHeader<bcfHeader>::read(vcf);
+
+            htsSweepJoin join(fp, hdr, idx, htsPileupFilter{}, seekGap);
+            std::vector<int> result;
+            auto sites = join.run(vcf, vcfHdr, [&](const bcf1_t& site, htsSpan<const bam1_t * const> reads) {
+                for(auto r : reads) EXPECT_TRUE(r->core.pos < site.pos + site.rlen && bam_endpos(r) > site.pos);
+                result.push_back(static_cast<int>(reads.size()));
+            });
+            EXPECT_EQ(sites, static_cast<int64_t>(result.size()));
+            if(seeks != nullptr) *seeks = join.seeks();
+            return result;
+        }
+};
+
+TEST_F(SweepJoin, SequentialPassMatchesRegionQueries) {
+    auto expected = queried();
+    ASSERT_EQ(expected.size(), 2196);
+    ASSERT_EQ(swept(nullptr, htsSweepJoin::defaultSeekGap), expected);
+}
+
+TEST_F(SweepJoin, SeekingAcrossGapsMatchesRegionQueries) {
+    auto idx = htsIndexOpen(bamFile, bamFile + ".bai");
+    size_t seeks = 0;
+    ASSERT_EQ(swept(&idx, 0, &seeks), queried());
+    ASSERT_GT(seeks, 0);
+}
+
+TEST_F(SweepJoin, SitesOutOfOrderNeedAnIndex) {
+    auto fp = htsOpen(bamFile, "r");
+    auto hdr = htsHeader<bamHeader>::read(fp);
+    auto vcf = htsOpen(vcfFile, "r");
+    auto vcfHdr = htsHeader<bcfHeader>::read(vcf);
+
+    bcfRecord first{bcf_init()}, second{bcf_init()};
+    ASSERT_GE(htsReader<bcfRecord>::next(vcf, vcfHdr, first.get()), 0);
+    for(int i = 0; i < 100; i++) ASSERT_GE(htsReader<bcfRecord>::next(vcf, vcfHdr, second.get()), 0);
+
+    auto ignore = [](const bcf1_t&, htsSpan<const bam1_t * const>) {};
+    htsSweepJoin join(fp, hdr);
+    ASSERT_GE(join.push(second, vcfHdr, ignore), 0);
+    ASSERT_EQ(join.push(first, vcfHdr, ignore), -1);
+}
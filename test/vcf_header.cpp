@@ -94,3 +94,32 @@ TEST_F(VcfHeader, CanIterateOverSampleDictionary) {
 
 // Tests for CREATE
 // Tests for WRITE
+
+TEST_F(VcfHeader, CanBuildHeaderIndex) {
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+    auto index = htsHeaderIndex<bcfHeader>::build(header);
+    using LineType = htsHeader<bcfHeader>::LineType;
+
+    ASSERT_EQ(index->lines().size(), 59);
+    ASSERT_EQ(index->contigCount(), 1);
+    ASSERT_EQ(index->tagCount(LineType::FILTER), 1);
+    ASSERT_EQ(index->tagCount(LineType::INFO), 43);
+    ASSERT_EQ(index->tagCount(LineType::FORMAT), 8);
+
+    auto dp = index->findTag(LineType::INFO, "DP");
+    ASSERT_NE(dp, nullptr);
+    ASSERT_EQ(dp->id, htsHeader<bcfHeader>::tagID(header, "DP"));
+    ASSERT_EQ(dp->type, htsHeader<bcfHeader>::DataType::INT);
+    ASSERT_EQ(dp->length, htsHeader<bcfHeader>::VarLength::FIXED);
+    ASSERT_EQ(dp->number, 1);
+
+    ASSERT_EQ(index->findTag(LineType::INFO, "AF")->length, htsHeader<bcfHeader>::VarLength::A);
+    ASSERT_EQ(index->findTag(LineType::FORMAT, "GL")->type, htsHeader<bcfHeader>::DataType::REAL);
+    ASSERT_EQ(index->findTag(LineType::FORMAT, "AF"), nullptr);
+    ASSERT_EQ(index->tagCount(LineType::CONTIG), 0);
+    ASSERT_EQ(index->findTag(LineType::GENERAL, "GT"), nullptr);
+
+    ASSERT_EQ(index->sampleCount(), 3);
+    ASSERT_EQ(index->sample("NA12878"), 0);
+    ASSERT_EQ(index->sample("nobody"), -1);
+}
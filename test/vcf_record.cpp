@@ -0,0 +1,232 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_variant.h"
+#include "scratch.h"
+#include <htslib/tbx.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+using namespace YiCppLib::HTSLibpp;
+
+// write the test dataset out as a BCF or bgzipped VCF and index it, so
+// that region queries can be tested without shipping more datasets
+static std::string indexedCopy(const scratchDir& scratch, const std::string& source, const std::string& suffix, htsOutputFormat format) {
+    auto filename = scratch.path("copy" + suffix);
+
+    auto in = htsOpen(source, "r");
+    auto hdr = htsHeader<bcfHeader>::read(in);
+    {
+        auto out = htsWriter<bcfRecord>::open(filename, format);
+        htsWriter<bcfRecord>::writeHeader(out, hdr);
+        for(auto& v : htsReader<bcfRecord>::range(in, hdr)) htsWriter<bcfRecord>::write(out, hdr, v);
+    }
+
+    EXPECT_EQ(htsWriter<bcfRecord>::buildIndex(filename, format), 0);
+    return filename;
+}
+
+class VcfRecord: public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.platnium-trio.vcf";
+        YiCppLib::HTSLibpp::htsFile htsFileHandler = htsOpen(testFile, "r");
+};
+
+TEST_F(VcfRecord, CanIterateRecordsSequencially) {
+    size_t record_count = 0;
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+
+    std::for_each(
+            htsReader<bcfRecord>::begin(htsFileHandler, header),
+            htsReader<bcfRecord>::end(htsFileHandler, header),
+            [&record_count](auto& v) { record_count++; });
+
+    ASSERT_EQ(record_count, 173);
+}
+
+TEST_F(VcfRecord, CanReadRecordsInBatches) {
+    size_t record_count = 0;
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+    htsBatch<bcfRecord> batch(50);
+
+    while(batch.fill(htsFileHandler, header) > 0) {
+        for(auto& v : batch) ASSERT_EQ(v.rid, 0);
+        record_count += batch.size();
+    }
+
+    ASSERT_EQ(record_count, 173);
+}
+
+class VcfRegion: public testing::Test {
+    public:
+        const std::string testFile = "datasets/brca2.platnium-trio.vcf";
+        const std::string brca2Region = "13:32900000-32950000";
+        scratchDir scratch;
+};
+
+TEST_F(VcfRegion, CanQueryIndexedBcf) {
+    auto filename = indexedCopy(scratch, testFile, ".bcf", htsOutputFormat::BCF);
+    auto fp = htsOpen(filename, "r");
+    auto header = htsHeader<bcfHeader>::read(fp);
+    auto index = bcfIndexOpen(filename);
+    ASSERT_NE(index.get(), nullptr);
+
+    size_t record_count = 0;
+    for(auto& v : htsReader<bcfRecord>::range(fp, header, index, brca2Region)) record_count++;
+    ASSERT_EQ(record_count, 95);
+
+    // a second pass over the same handle gives the same answer
+    record_count = 0;
+    for(auto& v : htsReader<bcfRecord>::range(fp, header, index, brca2Region)) record_count++;
+    ASSERT_EQ(record_count, 95);
+}
+
+TEST_F(VcfRegion, CanQueryTabixIndexedVcf) {
+    auto filename = indexedCopy(scratch, testFile, ".vcf.gz", htsOutputFormat::VCF_GZ);
+    ASSERT_EQ(access((filename + ".tbi").c_str(), F_OK), 0);
+    auto fp = htsOpen(filename, "r");
+    auto header = htsHeader<bcfHeader>::read(fp);
+    auto tbx = tbxIndexOpen(filename);
+    ASSERT_NE(tbx.get(), nullptr);
+
+    size_t record_count = 0;
+    for(auto& v : htsReader<bcfRecord>::range(fp, header, tbx, brca2Region)) {
+        ASSERT_EQ(v->rid, 0);
+        record_count++;
+    }
+    ASSERT_EQ(record_count, 95);
+}
+
+TEST_F(VcfRegion, CanQueryMultipleRegions) {
+    auto filename = indexedCopy(scratch, testFile, ".bcf", htsOutputFormat::BCF);
+    auto fp = htsOpen(filename, "r");
+    auto header = htsHeader<bcfHeader>::read(fp);
+    auto index = bcfIndexOpen(filename);
+
+    std::vector<std::string> regions{"13:32900000-32910000", "13:32930001-32950000", "13:32940000-32941000"};
+    size_t record_count = 0;
+    int32_t last_pos = -1;
+    for(auto& v : htsReader<bcfRecord>::range(fp, header, index, regions)) {
+        ASSERT_GT(v->pos, last_pos);
+        last_pos = v->pos;
+        record_count++;
+    }
+    ASSERT_EQ(record_count, 51);
+}
+
+TEST_F(VcfRecord, CanGetTypedInfoValues) {
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+    auto first = htsReader<bcfRecord>::read(htsFileHandler, header);
+    auto proxy = htsProxy(first);
+
+    auto dp = proxy.infoInt(htsHeader<bcfHeader>::tagID(header, "DP"));
+    ASSERT_EQ(dp.size(), 1);
+    ASSERT_EQ(dp[0], 128);
+
+    auto af = proxy.infoFloat(htsHeader<bcfHeader>::tagID(header, "AF"));
+    ASSERT_EQ(af.size(), 1);
+    ASSERT_FLOAT_EQ(af[0], 0.833333);
+
+    ASSERT_EQ(proxy.infoString(htsHeader<bcfHeader>::tagID(header, "TYPE")), "snp");
+}
+
+TEST_F(VcfRecord, CanGetTypedFormatValues) {
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+    auto first = htsReader<bcfRecord>::read(htsFileHandler, header);
+    auto proxy = htsProxy(first);
+
+    auto dp = proxy.formatInt(htsHeader<bcfHeader>::tagID(header, "DP"));
+    ASSERT_EQ(dp.size(), 3);
+    ASSERT_EQ(dp[0], 29);
+    ASSERT_EQ(dp[1], 41);
+    ASSERT_EQ(dp[2], 58);
+
+    auto gtID = htsHeader<bcfHeader>::tagID(header, "GT");
+    auto gt = proxy.formatInt(gtID);
+    ASSERT_EQ(proxy.valuesPerSample(gtID), 2);
+    ASSERT_EQ(bcf_gt_allele(gt[2]), 0);
+    ASSERT_EQ(bcf_gt_allele(gt[3]), 1);
+
+    auto gl = proxy.formatFloat(htsHeader<bcfHeader>::tagID(header, "GL"));
+    ASSERT_EQ(gl.size(), 9);
+    ASSERT_FLOAT_EQ(gl[0], -80.4722);
+}
+
+TEST_F(VcfRegion, ProxyUnpacksLazily) {
+    // records read from BCF start out packed
+    auto filename = indexedCopy(scratch, testFile, ".bcf", htsOutputFormat::BCF);
+    auto fp = htsOpen(filename, "r");
+    auto header = htsHeader<bcfHeader>::read(fp);
+    auto first = htsReader<bcfRecord>::read(fp, header);
+    auto proxy = htsProxy(first);
+
+    ASSERT_EQ(proxy.pos(), 32889968 - 1);
+    ASSERT_EQ(first->unpacked & BCF_UN_ALL, 0);
+
+    ASSERT_EQ(proxy.ref(), "G");
+    ASSERT_EQ(proxy.allele(1), "A");
+    ASSERT_TRUE(proxy.hasFilter(htsHeader<bcfHeader>::tagID(header, "PASS")));
+    ASSERT_EQ(proxy.infoInt(htsHeader<bcfHeader>::tagID(header, "DP"))[0], 128);
+    ASSERT_EQ(first->unpacked & BCF_UN_FMT, 0);
+
+    ASSERT_EQ(proxy.formatInt(htsHeader<bcfHeader>::tagID(header, "DP"))[0], 29);
+    ASSERT_EQ(first->unpacked & BCF_UN_ALL, BCF_UN_ALL);
+}
+
+TEST_F(VcfRecord, CanWriteBatchesWithThreadPool) {
+    scratchDir scratch;
+    auto filename = scratch.path("batch.bcf");
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+    {
+        YiCppLib::HTSLibpp::htsThreadPool pool(2);
+        auto out = htsWriter<bcfRecord>::open(filename, htsOutputFormat::BCF, 6, pool);
+        ASSERT_EQ(htsWriter<bcfRecord>::writeHeader(out, header), 0);
+
+        htsBatch<bcfRecord> batch(64);
+        while(batch.fill(htsFileHandler, header) > 0)
+            ASSERT_EQ(htsWriter<bcfRecord>::write(out, header, batch), static_cast<int>(batch.size()));
+    }
+
+    auto in = htsOpen(filename, "r");
+    auto copy = htsHeader<bcfHeader>::read(in);
+    size_t record_count = 0;
+    for(auto& v : htsReader<bcfRecord>::range(in, copy)) record_count++;
+    ASSERT_EQ(record_count, 173);
+}
+
+TEST_F(VcfRecord, PooledRecordsCanBeCopied) {
+    using pool = htsRecordPool<bcfRecord>;
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+
+    std::vector<bcfPooledRecord> copies;
+    for(auto rec = pool::read(htsFileHandler, header); rec; rec = pool::read(htsFileHandler, header))
+        copies.push_back(pool::dup(*rec));
+
+    ASSERT_EQ(copies.size(), 173);
+    ASSERT_EQ(copies.front()->pos, 32889968 - 1);
+    ASSERT_EQ(htsProxy(*copies.front()).ref(), "G");
+}
+
+TEST_F(VcfRecord, ProjectedReadsSkipUnprojectedColumns) {
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+    size_t record_count = 0;
+    for(auto v : htsReader<bcfRecord>::projected<htsFields<htsField::Core, htsField::Alleles>>(htsFileHandler, header)) {
+        if(record_count++ > 0) continue;
+        ASSERT_EQ(v.pos(), 32889967);
+        ASSERT_EQ(v.ref(), "G");
+    }
+    ASSERT_EQ(record_count, 173);
+}
+
+TEST_F(VcfRecord, ProjectedReadsCanSubsetSamples) {
+    auto header = htsHeader<bcfHeader>::read(htsFileHandler);
+    auto range = htsReader<bcfRecord>::projected<htsFields<htsField::Format>>(htsFileHandler, header, {"NA12878"});
+    auto dpID = htsHeader<bcfHeader>::tagID(header, "DP");
+
+    auto first = range.begin();
+    ASSERT_NE(first, range.end());
+    ASSERT_EQ((*first).sampleCount(), 1);
+    auto dp = (*first).formatInt(dpID);
+    ASSERT_EQ(dp.size(), 1);
+    ASSERT_EQ(dp[0], 29);
+}
@@ -0,0 +1,122 @@
+#include <gmock/gmock.h>
+#include "../htslibpp.h"
+#include "../htslibpp_variant.h"
+#include "../htslibpp_vcfparse.h"
+#include "scratch.h"
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace YiCppLib::HTSLibpp;
+
+class VcfParse : public testing::Test {
+    public:
+        const std::string exacFile = "datasets/brca2.exac.vcf";
+        const std::string trioFile = "datasets/brca2.platnium-trio.vcf";
+
+        static std::string format(const bcfHeader& hdr, const bcf1_t& rec) {
+            kstring_t s{0, 0, nullptr};
+            vcf_format(hdr.get(), &rec, &s);
+            std::string result(s.s, s.l);
+            free(s.s);
+            return result;
+        }
+
+        // every record of the file formatted back to text, read with bcf_read
+        std::vector<std::string> sequential(const std::string& filename) {
+            auto fp = htsOpen(filename, "r");
+            auto hdr = htsHeader<bcfHeader>::read(fp);
+            std::vector<std::string> result;
+            for(auto& r : htsReader<bcfRecord>::range(fp, hdr)) result.push_back(format(hdr, *r));
+            return result;
+        }
+
+        std::vector<std::string> parallel(const std::string& filename, size_t nThreads, size_t linesPerChunk) {
+            auto fp = htsOpen(filename, "r");
+            auto hdr = htsHeader<bcfHeader>::read(fp);
+            std::vector<std::string> result;
+            htsVcfParser parser(fp, hdr, nThreads, linesPerChunk);
+            for(auto& r : parser) result.push_back(format(hdr, *r));
+            EXPECT_EQ(parser.status(), 0);
+            return result;
+        }
+};
+
+TEST_F(VcfParse, RecordsComeOutInFileOrder) {
+    auto expected = sequential(exacFile);
+    ASSERT_EQ(expected.size(), 2196);
+    ASSERT_EQ(parallel(exacFile, 4, 64), expected);
+    ASSERT_EQ(parallel(exacFile, 3, 7), expected);
+    ASSERT_EQ(parallel(exacFile, 1, 100000), expected);
+}
+
+TEST_F(VcfParse, UndeclaredContigsGrowTheHeaderInOrder) {
+    auto fp = htsOpen(trioFile, "r");
+    auto hdr = htsHeader<bcfHeader>::read(fp);
+    ASSERT_EQ(bcf_hdr_name2id(hdr.get(), "13"), -1);
+
+    htsVcfParser parser(fp, hdr, 4, 16);
+    ASSERT_TRUE(parser.parallel());
+    size_t count = 0;
+    for(auto& r : parser) {
+        if(count++ == 0) {
+            ASSERT_EQ(r->pos, 32889967);
+        }
+        ASSERT_STREQ(bcf_hdr_id2name(hdr.get(), r->rid), "13");
+    }
+    ASSERT_EQ(count, 173);
+
+    ASSERT_EQ(parallel(trioFile, 4, 16), sequential(trioFile));
+}
+
+TEST_F(VcfParse, StoppingEarly) {
+    auto fp = htsOpen(exacFile, "r");
+    auto hdr = htsHeader<bcfHeader>::read(fp);
+    htsVcfParser parser(fp, hdr, 4, 8, 4);
+    size_t count = 0;
+    for(auto& r : parser) { (void)r; if(++count == 100) break; }
+    ASSERT_EQ(count, 100);
+}
+
+TEST_F(VcfParse, BinaryInputSkipsTheWorkers) {
+    scratchDir scratch;
+    auto bcfFile = scratch.path("vcfparse.bcf");
+    {
+        auto fp = htsOpen(exacFile, "r");
+        auto hdr = htsHeader<bcfHeader>::read(fp);
+        auto out = htsWriter<bcfRecord>::open(bcfFile);
+        htsWriter<bcfRecord>::writeHeader(out, hdr);
+        for(auto& r : htsReader<bcfRecord>::range(fp, hdr)) htsWriter<bcfRecord>::write(out, hdr, *r);
+    }
+
+    auto fp = htsOpen(bcfFile, "r");
+    auto hdr = htsHeader<bcfHeader>::read(fp);
+    htsVcfParser parser(fp, hdr, 4, 100);
+    ASSERT_FALSE(parser.parallel());
+    std::vector<std::string> records;
+    for(auto& r : parser) records.push_back(format(hdr, *r));
+    ASSERT_EQ(records, sequential(exacFile));
+}
+
+TEST_F(VcfParse, TruncatedInputIsAnError) {
+    scratchDir scratch;
+    auto gzFile = scratch.path("vcfparse.vcf.gz");
+    {
+        auto fp = htsOpen(exacFile, "r");
+        auto hdr = htsHeader<bcfHeader>::read(fp);
+        auto out = htsWriter<bcfRecord>::open(gzFile, htsOutputFormat::VCF_GZ);
+        htsWriter<bcfRecord>::writeHeader(out, hdr);
+        for(auto& r : htsReader<bcfRecord>::range(fp, hdr)) htsWriter<bcfRecord>::write(out, hdr, *r);
+    }
+    struct stat st;
+    ASSERT_EQ(stat(gzFile.c_str(), &st), 0);
+    ASSERT_EQ(truncate(gzFile.c_str(), st.st_size / 2), 0);
+
+    auto fp = htsOpen(gzFile, "r");
+    auto hdr = htsHeader<bcfHeader>::read(fp);
+    ASSERT_NE(hdr.get(), nullptr);
+    htsVcfParser parser(fp, hdr, 4, 64);
+    size_t count = 0;
+    for(auto& r : parser) { (void)r; count++; }
+    ASSERT_LT(count, 2196);
+    ASSERT_EQ(parser.status(), -1);
+}